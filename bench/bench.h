@@ -0,0 +1,43 @@
+/*
+	What the benchmarks share: the editor without its main, the clock,
+	resident memory and an editor set up as it starts, drawing to nowhere.
+*/
+#define CEDIT_NO_MAIN
+#include "../editor.c"
+
+// Resident anonymous memory in KB, pages of the mapped file are not counted
+long benchRss(){
+
+	char buf[256];
+	long kb = 0;
+	FILE *fp = fopen("/proc/self/status", "r");
+
+	if(fp == NULL)
+		return 0;
+
+	while(fgets(buf, sizeof(buf), fp)){
+
+		if(sscanf(buf, "RssAnon: %ld", &kb) == 1)
+			break;
+	}
+
+	fclose(fp);
+	return kb;
+}
+
+/*
+	An editor with a text area of 'rows' by 'cols', its settings taken from
+	the environment as the editor takes them. Edits are not journaled, so
+	no swap files are written next to the files benchmarked.
+*/
+void benchSetup(int rows, int cols){
+
+	int null = open("/dev/null", O_RDWR);
+
+	if(null == -1)
+		die("/dev/null");
+
+	editorHeadless(null, null, rows + 2, cols);
+	initEditor();
+	E.journal->enabled = 0;
+}
@@ -0,0 +1,185 @@
+/*
+	Frame build time for a full screen of highlighted C: the renderer that
+	appended every character on its own to a buffer grown by realloc, as
+	it was before the cell grid, against drawing into the grid and writing
+	it out in runs, all of it and after a scroll by one line.
+	usage: bench/frame [source.c] [cols] [rows]
+*/
+#include "bench.h"
+
+#define BENCH_FRAMES 5000
+
+// abAppend before the buffer kept its capacity
+void legacyAppend(struct abuf *ab, const char *s, int len){
+
+	char *new = realloc(ab->b, ab->len + len);
+
+	if(new == NULL)
+		return;
+
+	memcpy(&new[ab->len], s, len);
+
+	ab->b = new;
+	ab->len += len;
+}
+
+// The text rows of editorDrawRows before the cell grid
+void legacyDrawRows(struct abuf *ab){
+
+	int y;
+
+	for(y = 0; y < E.screenrows; y++){
+
+		erow *row = editorRowRender(y + E.rowoff);
+		int len = row->rsize - E.coloff;
+
+		if(len < 0)
+			len = 0;
+
+		if(len > E.screencols)
+			len = E.screencols;
+
+		char *c = &editorRowRenderText(row)[E.coloff];
+		unsigned char *hl = &editorRowHighlight(row)[E.coloff];
+		int current_color = -1;
+		int j;
+
+		for(j = 0; j < len; j++){
+
+			if(iscntrl(c[j])){
+
+				char sym = (c[j] <= 26) ? '@' + c[j] : '?';
+				legacyAppend(ab, "\x1b[7m", 4);
+				legacyAppend(ab, &sym, 1);
+				legacyAppend(ab, "\x1b[m", 3);
+
+				if(current_color != -1){
+
+					char buf[16];
+					int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
+					legacyAppend(ab, buf, clen);
+				}
+			}
+			else if(hl[j] == HL_NORMAL){
+
+				if(current_color != -1){
+
+					legacyAppend(ab, "\x1b[39m", 5);
+					current_color = -1;
+				}
+
+				legacyAppend(ab, &c[j], 1);
+			}
+			else{
+
+				int color = editorSyntaxToColor(hl[j]);
+
+				if(color != current_color){
+
+					char buf[16];
+					int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+
+					current_color = color;
+					legacyAppend(ab, buf, clen);
+				}
+
+				legacyAppend(ab, &c[j], 1);
+			}
+		}
+
+		legacyAppend(ab, "\x1b[39m", 5);
+		legacyAppend(ab, "\x1b[K", 3);
+		legacyAppend(ab, "\r\n", 2);
+	}
+}
+
+// The rows drawn into the grid and written out, all of them or what changed
+long gridFrame(int repaint){
+
+	E.out.len = 0;
+
+	if(repaint)
+		E.shown_valid = 0;
+
+	editorFrameResize(&E.frame, E.screenrows, E.screencols);
+	editorDrawRows(&E.frame);
+	editorFrameDiff(&E.out);
+
+	return E.out.len;
+}
+
+int main(int argc, char *argv[]){
+
+	char *path = argc > 1 ? argv[1] : "editor.c";
+	int top, frame;
+
+	benchSetup(argc > 3 ? atoi(argv[3]) : 60, argc > 2 ? atoi(argv[2]) : 200);
+
+	editorOpen(path);
+	editorScanFinish();
+
+	if(E.numrows < E.screenrows){
+
+		fprintf(stderr, "frame: %s has fewer lines than the screen\n", path);
+		return 1;
+	}
+
+	// Scrolling visits the screens from the top of the file, all highlighted up front
+	top = E.numrows - E.screenrows;
+
+	if(top > 1000)
+		top = 1000;
+
+	for(E.rowoff = 0; E.rowoff <= top; E.rowoff++)
+		editorRowRender(E.rowoff + E.screenrows - 1);
+
+	printf("frame: %s, %dx%d, %d frames\n", path, E.screencols, E.screenrows, BENCH_FRAMES);
+
+	double t = editorNow();
+	long bytes = 0;
+
+	for(frame = 0; frame < BENCH_FRAMES; frame++){
+
+		struct abuf ab = ABUF_INIT;
+
+		E.rowoff = frame % (top + 1);
+		legacyDrawRows(&ab);
+		bytes += ab.len;
+		free(ab.b);
+	}
+
+	double legacy = (editorNow() - t) / BENCH_FRAMES;
+
+	printf("  per character appends  %8.1f us  %8ld bytes\n", legacy * 1e6, bytes / BENCH_FRAMES);
+
+	t = editorNow();
+	bytes = 0;
+
+	for(frame = 0; frame < BENCH_FRAMES; frame++){
+
+		E.rowoff = frame % (top + 1);
+		bytes += gridFrame(1);
+	}
+
+	double repaint = (editorNow() - t) / BENCH_FRAMES;
+
+	printf("  grid, full repaint     %8.1f us  %8ld bytes  (%.1fx)\n", repaint * 1e6, bytes / BENCH_FRAMES, legacy / repaint);
+
+	E.rowoff = 0;
+	gridFrame(1);
+
+	t = editorNow();
+	bytes = 0;
+
+	for(frame = 1; frame <= BENCH_FRAMES; frame++){
+
+		E.rowoff = frame % (top + 1);
+		bytes += gridFrame(0);
+	}
+
+	double scroll = (editorNow() - t) / BENCH_FRAMES;
+
+	printf("  grid, scrolled a line  %8.1f us  %8ld bytes  (%.1fx)\n", scroll * 1e6, bytes / BENCH_FRAMES, legacy / scroll);
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+/*
+	Highlighter throughput, the keyword loop the editor used to run against
+	the table driven lexer. The corpus is C source repeated from editor.c.
+
+	usage: bench/highlight [source.c]
+*/
+#include "bench.h"
+
+#define BENCH_BYTES (64 << 20)
+
+// editorUpdateSyntax before the lexer tables, for comparison
+int legacySyntaxScan(char *s, int len, unsigned char *hl, int in_comment){
+
+	memset(hl, HL_NORMAL, len);
+
+	char **keywords = E.syntax->keywords;
+
+	char *scs = E.syntax->singleline_comment_start;
+	char *mcs = E.syntax->multiline_comment_start;
+	char *mce = E.syntax->multiline_comment_end;
+
+	int scs_len = scs ? strlen(scs) : 0;
+	int mcs_len = mcs ? strlen(mcs) : 0;
+	int mce_len = mce ? strlen(mce) : 0;
+
+	int prev_sep = 1;
+	int in_string = 0;
+
+	int i = 0;
+	while(i < len){
+
+		char c = s[i];
+		unsigned char prev_hl = (i > 0) ? hl[i - 1] : HL_NORMAL;
+
+		if(scs_len && !in_string && !in_comment){
+
+			if(!strncmp(&s[i], scs, scs_len)){
+
+				memset(&hl[i], HL_COMMENT, len - i);
+				break;
+			}
+		}
+
+		if(mcs_len && mce_len && !in_string){
+
+			if(in_comment){
+
+				hl[i] = HL_MLCOMMENT;
+
+				if(!strncmp(&s[i], mce, mce_len)){
+
+					memset(&hl[i], HL_MLCOMMENT, mce_len);
+					i += mce_len;
+					in_comment = 0;
+					prev_sep = 1;
+					continue;
+				}
+
+				i++;
+				continue;
+			}
+			else if(!strncmp(&s[i], mcs, mcs_len)){
+
+				memset(&hl[i], HL_MLCOMMENT, mcs_len);
+				i += mcs_len;
+				in_comment = 1;
+				continue;
+			}
+		}
+
+		if(E.syntax->flags & HL_HIGHLIGHT_STRINGS){
+
+			if(in_string){
+
+				hl[i] = HL_STRING;
+
+				if(c == '\\' && i + 1 < len){
+
+					hl[i + 1] = HL_STRING;
+					i += 2;
+					continue;
+				}
+				if(c == in_string)
+					in_string = 0;
+				i++;
+				prev_sep = 1;
+				continue;
+			}
+			else if(c == '"' || c == '\''){
+
+				in_string = c;
+				hl[i] = HL_STRING;
+				i++;
+				continue;
+			}
+		}
+
+		if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS){
+
+			if((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || (c == '.' && prev_hl == HL_NUMBER)){
+
+				hl[i] = HL_NUMBER;
+				i++;
+				prev_sep = 0;
+				continue;
+			}
+		}
+
+		if(prev_sep){
+
+			int j;
+			for(j = 0; keywords[j]; j++){
+
+				int klen = strlen(keywords[j]);
+				int kw2 = keywords[j][klen - 1] == '|';
+				if(kw2) klen--;
+
+				if(!strncmp(&s[i], keywords[j], klen) && is_separator(s[i + klen])){
+
+					memset(&hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+					i += klen;
+					break;
+				}
+			}
+			if(keywords[j] != NULL){
+
+				prev_sep = 0;
+				continue;
+			}
+		}
+		prev_sep = is_separator(c);
+		i++;
+	}
+
+	return in_comment;
+}
+
+int main(int argc, char *argv[]){
+
+	FILE *fp = fopen(argc > 1 ? argv[1] : "editor.c", "r");
+
+	if(fp == NULL){
+
+		perror("fopen");
+		return 1;
+	}
+
+	// Source lines are repeated into one buffer, NUL terminated like render
+	char *src = malloc(BENCH_BYTES + 65536);
+	unsigned char *hl_legacy = malloc(BENCH_BYTES + 65536);
+	unsigned char *hl_tables = malloc(BENCH_BYTES + 65536);
+	int *start = NULL;
+	int nlines = 0;
+	size_t used = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	long pos = 0;
+
+	while(used < BENCH_BYTES){
+
+		if((linelen = getline(&line, &linecap, fp)) == -1){
+
+			if(pos == 0)
+				break;
+
+			rewind(fp);
+			pos = 0;
+			continue;
+		}
+
+		pos++;
+		while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+			linelen--;
+
+		if(nlines % 4096 == 0)
+			start = realloc(start, sizeof(int) * (nlines + 4097));
+
+		start[nlines++] = used;
+		memcpy(&src[used], line, linelen);
+		used += linelen;
+		src[used++] = '\0';
+	}
+
+	start[nlines] = used;
+	fclose(fp);
+
+	E.syntax = &HLDB[0];
+	editorSyntaxCompile(E.syntax);
+
+	double best_legacy = 1e9, best_tables = 1e9;
+	int round, j;
+
+	for(round = 0; round < 3; round++){
+
+		int state = 0;
+		double t = editorNow();
+
+		for(j = 0; j < nlines; j++)
+			state = legacySyntaxScan(&src[start[j]], start[j + 1] - start[j] - 1, &hl_legacy[start[j]], state);
+
+		t = editorNow() - t;
+		if(t < best_legacy)
+			best_legacy = t;
+
+		state = 0;
+		t = editorNow();
+
+		for(j = 0; j < nlines; j++)
+			state = editorSyntaxScan(&src[start[j]], start[j + 1] - start[j] - 1, &hl_tables[start[j]], state);
+
+		t = editorNow() - t;
+		if(t < best_tables)
+			best_tables = t;
+	}
+
+	for(j = 0; j < nlines; j++){
+
+		int len = start[j + 1] - start[j] - 1;
+
+		if(memcmp(&hl_legacy[start[j]], &hl_tables[start[j]], len)){
+
+			fprintf(stderr, "highlight: output differs on line %d: %s\n", j, &src[start[j]]);
+			return 1;
+		}
+	}
+
+	double mb = used / 1048576.0;
+
+	printf("highlight: %.1f MB, %d lines\n", mb, nlines);
+	printf("  keyword loop  %8.1f MB/s\n", mb / best_legacy);
+	printf("  lexer tables  %8.1f MB/s  (%.1fx)\n", mb / best_tables, best_legacy / best_tables);
+
+	free(line);
+	free(start);
+	free(src);
+	free(hl_legacy);
+	free(hl_tables);
+	return 0;
+}
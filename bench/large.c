@@ -0,0 +1,155 @@
+/*
+	A file past every 32 bit limit: a sparse 5 GB file whose hole makes
+	one line of more than 4 GB between a thousand short lines at either
+	end. It is opened, searched for the text at the end of the long line,
+	which is found again from its byte offset,
+	edited at both ends and saved, and the saved file is checked byte for
+	byte where it was edited. The long line is never copied out of the
+	mapping. Saving writes the whole file, so it needs 5 GB of disk.
+	usage: bench/large [gigabytes]
+*/
+#include "bench.h"
+
+#define BENCH_LINES 1000 // Short lines before and after the hole
+
+// 'len' bytes of the file at 'off' must be 'want'
+int largeCheck(int fd, off_t off, const char *want, size_t len, const char *what){
+
+	char *got = malloc(len);
+	int ok = pread(fd, got, len, off) == (ssize_t)len && memcmp(got, want, len) == 0;
+
+	if(!ok)
+		fprintf(stderr, "large: the saved file differs %s\n", what);
+
+	free(got);
+	return ok;
+}
+
+int main(int argc, char *argv[]){
+
+	off_t size = (off_t)(argc > 1 ? atoi(argv[1]) : 5) << 30;
+	char path[] = "/tmp/cedit-large-XXXXXX";
+	int fd = mkstemp(path);
+	char *head = malloc(BENCH_LINES * 16);
+	char *tail = malloc(BENCH_LINES * 16 + 16);
+	char *want = malloc(BENCH_LINES * 16 + 16);
+	size_t head_len = 0, tail_len = 0, want_len;
+	int j;
+
+	for(j = 0; j < BENCH_LINES; j++)
+		head_len += sprintf(&head[head_len], "head %d\n", j);
+
+	tail_len = sprintf(tail, "needle\n");
+
+	for(j = 0; j < BENCH_LINES; j++)
+		tail_len += sprintf(&tail[tail_len], "tail %d\n", j);
+
+	if(fd == -1 || write(fd, head, head_len) != (ssize_t)head_len || ftruncate(fd, size - tail_len) == -1 ||
+		pwrite(fd, tail, tail_len, size - tail_len) != (ssize_t)tail_len){
+
+		perror("bench/large");
+		return 1;
+	}
+
+	close(fd);
+
+	benchSetup(24, 80);
+
+	long base = benchRss();
+	double t = editorNow();
+
+	editorOpen(path);
+	editorScanFinish();
+
+	double opened = editorNow() - t;
+	long lines = 2 * BENCH_LINES + 1;
+
+	printf("large: %.1f GB file, %ld lines, the longest %lld bytes\n", size / 1073741824.0, E.numrows, (long long)(size - head_len - tail_len + 6));
+	printf("  open and index    %8.1f ms\n", opened * 1e3);
+
+	if(E.numrows != lines){
+
+		fprintf(stderr, "large: %ld lines instead of %ld\n", E.numrows, lines);
+		unlink(path);
+		return 1;
+	}
+
+	// The needle ends the long line, past any column an int can hold
+	long row = 0, col = 0;
+
+	E.match.query = "needle";
+	E.match.len = 6;
+	t = editorNow();
+
+	if(!editorSearch(&row, &col, 1) || row != BENCH_LINES || col != (long)(size - head_len - tail_len)){
+
+		fprintf(stderr, "large: needle found at %ld:%ld\n", row, col);
+		unlink(path);
+		return 1;
+	}
+
+	printf("  search            %8.1f ms  to column %ld\n", (editorNow() - t) * 1e3, col);
+
+	// The same place from its byte offset, and the offset of the line after it
+	off_t needle = size - tail_len;
+
+	t = editorNow();
+	row = rowTreeLine(needle, &col);
+
+	if(row != BENCH_LINES || col != (long)(size - head_len - tail_len) || rowTreeOffset(BENCH_LINES + 1) != needle + 7){
+
+		fprintf(stderr, "large: byte %lld found at %ld:%ld\n", (long long)needle, row, col);
+		unlink(path);
+		return 1;
+	}
+
+	printf("  go to offset      %8.1f us\n", (editorNow() - t) * 1e6);
+
+	E.match.query = NULL;
+
+	// Edits at both ends, the long line in between stays in the mapping
+	editorRowInsertText(0, 0, "edited ", 7);
+	editorDelRow(1);
+	editorRowAppendString(E.numrows - 1, " end", 4);
+	editorInsertRow(E.numrows, "appended", 8);
+
+	t = editorNow();
+	editorSave();
+
+	double saved = editorNow() - t;
+
+	printf("  save              %8.1f ms  %8.1f MB/s  (%s)\n", saved * 1e3, size / 1048576.0 / saved, E.statusmsg);
+	printf("  memory held       %8ld KB\n", benchRss() - base);
+
+	want_len = sprintf(want, "edited head 0\n");
+	memcpy(&want[want_len], strchr(strchr(head, '\n') + 1, '\n') + 1, head_len - 14);
+	want_len += head_len - 14;
+
+	struct stat st;
+	off_t saved_size = size + 4 + 9; // "edited " took the place of "head 1\n"
+	int ok = 1;
+
+	fd = open(path, O_RDONLY);
+
+	if(fd == -1 || fstat(fd, &st) == -1 || st.st_size != saved_size){
+
+		fprintf(stderr, "large: the saved file has %lld bytes instead of %lld\n", (long long)st.st_size, (long long)saved_size);
+		ok = 0;
+	}
+
+	ok = ok && largeCheck(fd, 0, want, want_len, "at the start");
+
+	// The hole comes back as zeros
+	memset(want, 0, 4096);
+	ok = ok && largeCheck(fd, size / 2, want, 4096, "in the middle");
+
+	memcpy(want, tail, tail_len - 1);
+	want_len = tail_len - 1;
+	want_len += sprintf(&want[want_len], " end\nappended\n");
+	ok = ok && largeCheck(fd, saved_size - want_len, want, want_len, "at the end");
+
+	close(fd);
+	unlink(path);
+
+	return ok ? 0 : 1;
+}
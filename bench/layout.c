@@ -0,0 +1,109 @@
+/*
+	Memory per line of a large source tree once every line is rendered
+	and highlighted, as after scrolling through all of it with a cache
+	budget too large to trim anything. The files under the directory are
+	joined into one, in the order they are walked, up to the line limit.
+	usage: bench/layout [directory] [lines]
+*/
+#include "bench.h"
+
+#include <ftw.h>
+
+FILE *tree_out;
+long tree_lines, tree_limit, tree_files;
+
+// Copy a text file into the joined one, files with NUL bytes are taken as binary
+int treeAdd(const char *path, const struct stat *st, int type, struct FTW *ftw){
+
+	(void)ftw;
+
+	if(type != FTW_F || !S_ISREG(st->st_mode) || tree_lines >= tree_limit)
+		return 0;
+
+	FILE *fp = fopen(path, "r");
+	char buf[65536];
+	size_t n;
+
+	if(fp == NULL)
+		return 0;
+
+	n = fread(buf, 1, sizeof(buf), fp);
+
+	if(memchr(buf, '\0', n) == NULL){
+
+		tree_files++;
+
+		do{
+			char *p = buf;
+
+			while(tree_lines < tree_limit && (p = memchr(p, '\n', n - (p - buf))) != NULL){
+
+				tree_lines++;
+				p++;
+			}
+
+			fwrite(buf, 1, p ? n : (size_t)(p - buf), tree_out);
+
+		}while(tree_lines < tree_limit && (n = fread(buf, 1, sizeof(buf), fp)) > 0);
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+
+	char *dir = argc > 1 ? argv[1] : "/usr/include";
+	char path[] = "/tmp/cedit-layout-XXXXXX";
+	int fd = mkstemp(path);
+	long tabbed = 0;
+	int j;
+
+	tree_limit = argc > 2 ? atol(argv[2]) : 4000000;
+
+	if(fd == -1 || (tree_out = fdopen(fd, "w")) == NULL){
+
+		perror("bench/layout");
+		return 1;
+	}
+
+	nftw(dir, treeAdd, 64, FTW_PHYS);
+	fclose(tree_out);
+
+	benchSetup(24, 80);
+	E.cache_budget = (size_t)-1;
+
+	long base = benchRss();
+	double t = editorNow();
+
+	editorOpen(path);
+	editorScanFinish();
+
+	for(j = 0; j < E.numrows; j++)
+		editorRowAt(j);
+
+	long loaded = benchRss() - base;
+
+	for(j = 0; j < E.numrows; j++){
+
+		erow *row = editorRowRender(j);
+
+		if(memchr(row->chars, '\t', row->size) != NULL)
+			tabbed++;
+	}
+
+	t = editorNow() - t;
+
+	long rendered = benchRss() - base;
+	double lines = E.numrows ? E.numrows : 1;
+
+	unlink(path);
+
+	printf("layout: %s, %ld files, %ld lines, %.1f%% with tabs, %zu byte rows\n", dir, tree_files,
+		E.numrows, tabbed * 100.0 / lines, sizeof(erow));
+	printf("  loaded                 %8.1f bytes per line\n", loaded * 1024.0 / lines);
+	printf("  rendered, highlighted  %8.1f bytes per line  (%.1f of caches)  %.0f ms\n",
+		rendered * 1024.0 / lines, E.cache_bytes / lines, t * 1e3);
+
+	return 0;
+}
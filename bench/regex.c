@@ -0,0 +1,139 @@
+/*
+	Regex search throughput over a generated log, the lazy DFAs against
+	POSIX regexec from libc. regexec only gets the first
+	part of the log, it is too slow for all of it; the match counts over
+	that part must agree.
+	usage: bench/regex [megabytes]
+*/
+#include "bench.h"
+
+#include <regex.h>
+
+#define BENCH_POSIX_BYTES (16 << 20)
+
+// Lines with a match in the first 'n' bytes of the log
+long regexCount(struct editorRegex *re, const char *log, size_t n){
+
+	const char *p = log;
+	const char *end = log + n;
+	const char *hit;
+	size_t len;
+	long lines = 0;
+
+	while(p < end && (hit = editorRegexFind(re, p, p, end, &len)) != NULL){
+
+		const char *nl = memchr(hit, '\n', end - hit);
+
+		lines++;
+		p = nl ? nl + 1 : end;
+	}
+
+	return lines;
+}
+
+long posixCount(regex_t *px, char *log, size_t n){
+
+	char *p = log;
+	char *end = log + n;
+	long lines = 0;
+
+	while(p < end){
+
+		char *nl = memchr(p, '\n', end - p);
+		regmatch_t m;
+
+		m.rm_so = 0;
+		m.rm_eo = (nl ? nl : end) - p;
+
+		if(regexec(px, p, 1, &m, REG_STARTEND) == 0)
+			lines++;
+
+		p = nl ? nl + 1 : end;
+	}
+
+	return lines;
+}
+
+int main(int argc, char *argv[]){
+
+	const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+	const char *patterns[] = {
+		"ERROR",
+		"^2026-10-1[0-9]T12:[0-5][0-9].* WARN ",
+		"worker\\[4[0-9]\\].*status=(fail|retry)",
+		"latency=[0-9]{4,}ms$",
+		"\\bid=0*42\\b",
+		"(a|aa)*c",
+		NULL
+	};
+	size_t size = (size_t)(argc > 1 ? atoi(argv[1]) : 256) << 20;
+	char *log = malloc(size + 256);
+	size_t used = 0;
+	int q;
+
+	srand(1);
+
+	while(used < size){
+
+		int status = rand() % 20;
+
+		used += sprintf(&log[used], "2026-10-%02dT12:%02d:%02d.%03d %s worker[%d] processed request id=%010d status=%s latency=%dms\n",
+			10 + rand() % 10, rand() % 60, rand() % 60, rand() % 1000, levels[rand() % 6], rand() % 64,
+			rand(), status == 0 ? "fail" : status == 1 ? "retry" : "ok", rand() % 100 == 0 ? 1000 + rand() % 9000 : rand() % 1000);
+
+		// Now and then a line that makes backtracking engines crawl
+		if(rand() % 1000 == 0){
+
+			memset(&log[used], 'a', 100);
+			used += 100;
+			log[used++] = '\n';
+		}
+	}
+
+	double mb = used / 1048576.0;
+	size_t posix_bytes = used < BENCH_POSIX_BYTES ? used : BENCH_POSIX_BYTES;
+	double posix_mb = posix_bytes / 1048576.0;
+
+	while(posix_bytes > 0 && log[posix_bytes - 1] != '\n')
+		posix_bytes--;
+
+	printf("regex: %.1f MB log, regexec on the first %.1f MB\n", mb, posix_mb);
+
+	for(q = 0; patterns[q]; q++){
+
+		const char *error;
+		struct editorRegex *re = editorRegexCompile(patterns[q], &error);
+		regex_t px;
+
+		if(re == NULL || regcomp(&px, patterns[q], REG_EXTENDED | REG_NOSUB) != 0){
+
+			fprintf(stderr, "regex: %s does not compile: %s\n", patterns[q], re ? "regcomp" : error);
+			return 1;
+		}
+
+		// \b is a GNU extension to POSIX, regcomp reads it the same way
+		double t = editorNow();
+		long lines = regexCount(re, log, used);
+		double dfa = editorNow() - t;
+
+		t = editorNow();
+		long posix = posixCount(&px, log, posix_bytes);
+		double libc = editorNow() - t;
+
+		if(posix != regexCount(re, log, posix_bytes)){
+
+			fprintf(stderr, "regex: match counts differ for %s\n", patterns[q]);
+			return 1;
+		}
+
+		printf("  %-42s %8ld lines\n", patterns[q], lines);
+		printf("    regexec      %8.1f MB/s\n", posix_mb / libc);
+		printf("    lazy DFA     %8.1f MB/s  (%.1fx)\n", mb / dfa, (mb / dfa) / (posix_mb / libc));
+
+		regfree(&px);
+		editorRegexFree(re);
+	}
+
+	free(log);
+	return 0;
+}
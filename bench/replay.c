@@ -0,0 +1,198 @@
+/*
+	Editing sessions replayed headless on generated files: opening a large
+	file and moving through it, typing at the top of a large C file,
+	pasting lines into it, searching it and saving it. Each scenario runs
+	in a process of its own, so its peak RSS is its own, and reports the
+	latency of its keys, the bytes of its frames and its peak RSS.
+	usage: bench/replay [scenario] [MB to open] [source.c]
+*/
+#include "bench.h"
+
+#include <sys/wait.h>
+
+#define REPLAY_ROWS 50
+#define REPLAY_COLS 160
+#define REPLAY_MB 16 // Of the C file typed, pasted and searched in
+
+struct abuf trace = ABUF_INIT; // Keys of the scenario being built
+
+void keys(const char *s, int times){
+
+	while(times-- > 0)
+		abAppend(&trace, s, strlen(s));
+}
+
+// A file of at least 'mb' megabytes, the source over and over
+int corpus(const char *source, long mb, char *path){
+
+	int in = open(source, O_RDONLY), out = mkstemp(path);
+	off_t size = lseek(in, 0, SEEK_END), written = 0;
+	char *text = in == -1 || size <= 0 ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, in, 0);
+
+	if(out == -1 || text == MAP_FAILED){
+
+		perror("bench/replay");
+		return -1;
+	}
+
+	while(written < (off_t)mb << 20){
+
+		if(write(out, text, size) != size){
+
+			perror("bench/replay");
+			return -1;
+		}
+
+		written += size;
+	}
+
+	munmap(text, size);
+	close(in);
+	close(out);
+
+	return 0;
+}
+
+// Replay the keys built so far on 'file' in a child, and report
+int run(const char *name, const char *file){
+
+	char path[] = "/tmp/cedit-trace-XXXXXX";
+	int fd = mkstemp(path), status;
+
+	if(fd == -1 || write(fd, trace.b, trace.len) != trace.len){
+
+		perror("bench/replay");
+		return -1;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	unlink(path);
+	fflush(stdout);
+	trace.len = 0;
+
+	pid_t pid = fork();
+
+	if(pid == 0){
+
+		int screen = open("/dev/null", O_WRONLY);
+
+		editorHeadless(fd, screen, REPLAY_ROWS, REPLAY_COLS);
+		initEditor();
+		editorInputInit();
+		editorOpen((char *)file);
+		editorReplay();
+
+		printf("replay: %s\n", name);
+		editorReplayReport(stdout);
+		exit(0);
+	}
+
+	close(fd);
+
+	if(pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+
+		fprintf(stderr, "replay: %s failed\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+
+	char *only = argc > 1 ? argv[1] : NULL;
+	long mb = argc > 2 ? atol(argv[2]) : 1024;
+	char *source = argc > 3 ? argv[3] : "editor.c";
+	char large[] = "/tmp/cedit-replay-XXXXXX";
+	char c[] = "/tmp/cedit-replay-XXXXXX";
+	char line[64];
+	int j, failed = 0;
+
+	// Typed, pasted, searched and saved in
+	if(corpus(source, REPLAY_MB, c) == -1)
+		return 1;
+
+	if(only == NULL || !strcmp(only, "open")){
+
+		if(corpus(source, mb, large) == -1)
+			return 1;
+
+		// A screen at a time, then jumps to the middle and the end
+		keys("\x1b[6~", 50);
+		keys("\x07" "50%\r", 1);
+		keys("\x1b[6~", 50);
+		keys("\x07" "100%\r", 1);
+		keys("\x1b[5~", 50);
+		keys("\x07" "1\r", 1);
+
+		snprintf(line, sizeof(line), "open %ld MB, page and jump through it", mb);
+		failed |= run(line, large);
+		unlink(large);
+	}
+
+	if(only == NULL || !strcmp(only, "type")){
+
+		// 10000 characters at the top, a line of C at a time
+		for(j = 0; j < 10000; j++){
+
+			const char *text = "\tcount = count * 31 + value;";
+
+			if(text[j % 29] == '\0')
+				keys("\r", 1);
+			else{
+
+				char ch[2] = { text[j % 29], '\0' };
+				keys(ch, 1);
+			}
+		}
+
+		failed |= run("type 10000 characters at the top of a C file", c);
+	}
+
+	if(only == NULL || !strcmp(only, "paste")){
+
+		keys("\x1b[B", 100);
+		keys("\x1b[200~", 1);
+
+		for(j = 0; j < 50000; j++){
+
+			snprintf(line, sizeof(line), "\tpasted[%d] = editorRowAt(%d)->size;\n", j, j);
+			keys(line, 1);
+		}
+
+		keys("\x1b[201~", 1);
+		keys("\x1b[6~", 20);
+
+		failed |= run("paste 50000 lines into a C file", c);
+	}
+
+	if(only == NULL || !strcmp(only, "search")){
+
+		// Each character searches again, then the arrows go from match to match
+		keys("\x06" "editorRowAt", 1);
+		keys("\x1b[B", 100);
+		keys("\r", 1);
+		keys("\x12" "row[A-Z][a-z]+\\(", 1);
+		keys("\x1b[B", 100);
+		keys("\r", 1);
+
+		failed |= run("search a C file, plain and by regex", c);
+	}
+
+	if(only == NULL || !strcmp(only, "save")){
+
+		// An edit somewhere else before each save
+		for(j = 0; j < 10; j++){
+
+			snprintf(line, sizeof(line), "\x07%d%%\r", j * 10);
+			keys(line, 1);
+			keys("x\x13", 1);
+		}
+
+		failed |= run("edit and save a C file, ten times", c);
+	}
+
+	unlink(c);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+/*
+	Row storage, a malloc for every line as rows used to be loaded against
+	the row allocator with its file arenas: load time and resident memory
+	once every row is loaded, after typing into rows spread over the file,
+	and once the text of all rows is freed again. Each runs in a child of its own so
+	neither sees the heap of the other. The file is C source repeated from
+	editor.c to about a million lines.
+	usage: bench/rows [source.c] [lines]
+*/
+#include "bench.h"
+
+#include <sys/wait.h>
+
+#define BENCH_TYPED 200000 // Characters typed, one each into rows spread over the file
+
+void benchReport(const char *what, double t, long rss, long base){
+
+	printf("    %-22s %8.1f ms  %8ld KB\n", what, t * 1e3, rss - base);
+}
+
+// Rows as they were: each line copied into a block of its own, typing reallocs
+void legacyRows(const char *path){
+
+	long base = benchRss();
+	double t = editorNow();
+	FILE *fp = fopen(path, "r");
+	erow *rows = NULL;
+	int numrows = 0, cap = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	int j;
+
+	while((linelen = getline(&line, &linecap, fp)) != -1){
+
+		while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+			linelen--;
+
+		if(numrows == cap){
+
+			cap = cap ? cap * 2 : 4096;
+			rows = realloc(rows, sizeof(erow) * cap);
+		}
+
+		rows[numrows].size = linelen;
+		rows[numrows].chars = malloc(linelen + 1);
+		memcpy(rows[numrows].chars, line, linelen);
+		rows[numrows].chars[linelen] = '\0';
+		numrows++;
+	}
+
+	free(line);
+	fclose(fp);
+	benchReport("loaded", editorNow() - t, benchRss(), base);
+
+	t = editorNow();
+	srand(1);
+
+	for(j = 0; j < BENCH_TYPED; j++){
+
+		erow *row = &rows[rand() % numrows];
+
+		row->chars = realloc(row->chars, row->size + 2);
+		row->chars[row->size++] = 'x';
+		row->chars[row->size] = '\0';
+	}
+
+	benchReport("typed", editorNow() - t, benchRss(), base);
+
+	t = editorNow();
+
+	for(j = 0; j < numrows; j++)
+		free(rows[j].chars);
+
+	free(rows);
+	benchReport("deleted", editorNow() - t, benchRss(), base);
+}
+
+void allocatorRows(const char *path){
+
+	long base = benchRss();
+	double t = editorNow();
+	int j;
+
+	benchSetup(24, 80);
+
+	editorOpen((char *)path);
+	editorScanFinish();
+
+	for(j = 0; j < E.numrows; j++)
+		editorRowAt(j);
+
+	benchReport("loaded", editorNow() - t, benchRss(), base);
+
+	// Rows stay where they are while none are added or deleted
+	erow **rows = malloc(sizeof(erow *) * E.numrows);
+
+	for(j = 0; j < E.numrows; j++)
+		rows[j] = editorRowAt(j);
+
+	t = editorNow();
+	srand(1);
+
+	for(j = 0; j < BENCH_TYPED; j++){
+
+		erow *row = rows[rand() % E.numrows];
+
+		row->chars = rowMemResize(row->chars, row->size + 1, row->size + 2);
+		row->chars[row->size++] = 'x';
+		row->chars[row->size] = '\0';
+	}
+
+	benchReport("typed", editorNow() - t, benchRss(), base);
+
+	printf("    %ld buffers, %ld slab, %ld arena and %ld large chunks, %zu KB mapped\n", E.mem.buffers,
+		E.mem.chunks[ROWMEM_SLAB], E.mem.chunks[ROWMEM_ARENA], E.mem.chunks[ROWMEM_LARGE], E.mem.mapped >> 10);
+
+	t = editorNow();
+
+	for(j = 0; j < E.numrows; j++)
+		rowMemFree(rows[j]->chars);
+
+	free(rows);
+	benchReport("deleted", editorNow() - t, benchRss(), base);
+	printf("    %zu KB left mapped, the rest is the row tree\n", E.mem.mapped >> 10);
+}
+
+int main(int argc, char *argv[]){
+
+	FILE *fp = fopen(argc > 1 ? argv[1] : "editor.c", "r");
+	long lines = argc > 2 ? atol(argv[2]) : 1000000;
+	char path[] = "/tmp/cedit-rows-XXXXXX";
+	int fd = mkstemp(path);
+
+	if(fp == NULL || fd == -1){
+
+		perror("bench/rows");
+		return 1;
+	}
+
+	FILE *out = fdopen(fd, "w");
+	char *line = NULL;
+	size_t linecap = 0;
+	long n = 0, pos = 0;
+
+	while(n < lines){
+
+		if(getline(&line, &linecap, fp) == -1){
+
+			if(pos == 0)
+				break;
+
+			rewind(fp);
+			pos = 0;
+			continue;
+		}
+
+		pos++;
+		fputs(line, out);
+		n++;
+	}
+
+	free(line);
+	fclose(fp);
+	fclose(out);
+
+	printf("rows: %ld lines\n", n);
+
+	printf("  malloc per row\n");
+	fflush(stdout);
+
+	if(fork() == 0){
+
+		legacyRows(path);
+		exit(0);
+	}
+	wait(NULL);
+
+	printf("  row allocator\n");
+	fflush(stdout);
+
+	if(fork() == 0){
+
+		allocatorRows(path);
+		exit(0);
+	}
+	wait(NULL);
+
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,164 @@
+/*
+	Search throughput, the strstr loop the prompt used to run over each
+	row against the search kernel, per row and over contiguous text. The
+	corpus is C source repeated from editor.c.
+	usage: bench/search [source.c]
+*/
+#include "bench.h"
+
+#define BENCH_BYTES (128 << 20)
+
+// Matches of 'query' the way editorFindCallback used to look for them
+long legacySearch(char *src, int *start, int nlines, const char *query){
+
+	long hits = 0;
+	int j;
+
+	for(j = 0; j < nlines; j++){
+
+		char *p = &src[start[j]];
+
+		while((p = strstr(p, query)) != NULL){
+
+			hits++;
+			p++;
+		}
+	}
+
+	return hits;
+}
+
+long kernelSearchRows(char *src, int *start, int nlines, const char *query){
+
+	size_t m = strlen(query);
+	long hits = 0;
+	int j;
+
+	for(j = 0; j < nlines; j++){
+
+		const char *p = &src[start[j]];
+		const char *end = &src[start[j + 1] - 1];
+
+		while((p = editorMemMem(p, end - p, query, m)) != NULL){
+
+			hits++;
+			p++;
+		}
+	}
+
+	return hits;
+}
+
+long kernelSearchText(char *src, size_t used, const char *query){
+
+	size_t m = strlen(query);
+	const char *p = src;
+	long hits = 0;
+
+	while((p = editorMemMem(p, used - (p - src), query, m)) != NULL){
+
+		hits++;
+		p++;
+	}
+
+	return hits;
+}
+
+int main(int argc, char *argv[]){
+
+	const char *queries[] = { "editorRow", "->", "memcpy(", "no such needle", NULL };
+	FILE *fp = fopen(argc > 1 ? argv[1] : "editor.c", "r");
+
+	if(fp == NULL){
+
+		perror("fopen");
+		return 1;
+	}
+
+	// Source lines are repeated into one buffer, NUL terminated like render
+	char *src = malloc(BENCH_BYTES + 65536);
+	int *start = NULL;
+	int nlines = 0;
+	size_t used = 0;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	long pos = 0;
+
+	while(used < BENCH_BYTES){
+
+		if((linelen = getline(&line, &linecap, fp)) == -1){
+
+			if(pos == 0)
+				break;
+
+			rewind(fp);
+			pos = 0;
+			continue;
+		}
+		pos++;
+
+		while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+			linelen--;
+
+		if(nlines % 4096 == 0)
+			start = realloc(start, sizeof(int) * (nlines + 4097));
+
+		start[nlines++] = used;
+		memcpy(&src[used], line, linelen);
+		used += linelen;
+		src[used++] = '\0';
+	}
+	start[nlines] = used;
+	fclose(fp);
+
+	double mb = used / 1048576.0;
+	int q;
+
+	printf("search: %.1f MB, %d lines\n", mb, nlines);
+
+	for(q = 0; queries[q]; q++){
+
+		double best_legacy = 1e9, best_rows = 1e9, best_text = 1e9;
+		long legacy = 0, rows = 0, text = 0;
+		int round;
+
+		for(round = 0; round < 3; round++){
+
+			double t = editorNow();
+
+			legacy = legacySearch(src, start, nlines, queries[q]);
+			t = editorNow() - t;
+			if(t < best_legacy)
+				best_legacy = t;
+
+			t = editorNow();
+			rows = kernelSearchRows(src, start, nlines, queries[q]);
+			t = editorNow() - t;
+			if(t < best_rows)
+				best_rows = t;
+
+			t = editorNow();
+			text = kernelSearchText(src, used, queries[q]);
+			t = editorNow() - t;
+			if(t < best_text)
+				best_text = t;
+		}
+
+		if(legacy != rows || legacy != text){
+
+			fprintf(stderr, "search: match counts differ for \"%s\": %ld %ld %ld\n", queries[q], legacy, rows, text);
+			return 1;
+		}
+
+		printf("  \"%s\", %ld matches\n", queries[q], legacy);
+		printf("    strstr per row  %8.1f MB/s\n", mb / best_legacy);
+		printf("    kernel per row  %8.1f MB/s  (%.1fx)\n", mb / best_rows, best_legacy / best_rows);
+		printf("    kernel on text  %8.1f MB/s  (%.1fx)\n", mb / best_text, best_legacy / best_text);
+	}
+
+	free(line);
+	free(start);
+	free(src);
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+	Startup cost of syntax definitions as languages are added: compiling a
+	directory of definitions, against mapping the cache compiled from it,
+	and finding the definition of a file name by hash, against the scan
+	over every name of every definition it replaced.
+	usage: bench/syntax [languages] [keywords]
+*/
+#include "bench.h"
+
+#define BENCH_LOADS 50
+#define BENCH_LOOKUPS 200000
+
+// Drop the loaded definitions so the next select loads them again
+void benchUnload(){
+
+	struct editorSyntaxDb *db = &E.syntaxdb;
+
+	if(db->mapped)
+		munmap(db->base, db->len);
+	else
+		free(db->base);
+
+	free(db->loaded);
+	memset(db, 0, sizeof(*db));
+}
+
+// Time per load, from the directory with the cache removed or from the cache
+double benchLoad(const char *cache, int cached){
+
+	double t = 0;
+	int j;
+
+	for(j = 0; j < BENCH_LOADS; j++){
+
+		if(!cached)
+			unlink(cache);
+
+		double start = editorNow();
+
+		editorSyntaxLoad();
+		t += editorNow() - start;
+
+		if(E.syntaxdb.mapped != cached){
+
+			fprintf(stderr, "syntax: the cache was %s\n", cached ? "not used" : "used");
+			exit(1);
+		}
+
+		benchUnload();
+	}
+
+	return t / BENCH_LOADS;
+}
+
+// editorSelectSyntaxHighlight before the hash, over the definitions as read
+struct editorSyntax *scanSelect(struct editorSyntax **defs, int n, char *filename){
+
+	char *ext = strrchr(filename, '.');
+	int j, i;
+
+	for(j = 0; j < n; j++){
+
+		for(i = 0; defs[j]->filematch[i]; i++){
+
+			int is_ext = (defs[j]->filematch[i][0] == '.');
+
+			if((is_ext && ext && !strcmp(ext, defs[j]->filematch[i])) || (!is_ext && strstr(filename, defs[j]->filematch[i])))
+				return defs[j];
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[]){
+
+	int languages = argc > 1 ? atoi(argv[1]) : 500;
+	int keywords = argc > 2 ? atoi(argv[2]) : 60;
+	char dir[] = "/tmp/cedit-syntax-XXXXXX";
+	char path[256], cache[256];
+	int j, k;
+
+	if(mkdtemp(dir) == NULL){
+
+		perror("bench/syntax");
+		return 1;
+	}
+
+	snprintf(cache, sizeof(cache), "%s.cache", dir);
+	setenv("CEDIT_SYNTAX_DIR", dir, 1);
+	srand(1);
+
+	for(j = 0; j < languages; j++){
+
+		snprintf(path, sizeof(path), "%s/lang%04d.syntax", dir, j);
+
+		FILE *out = fopen(path, "w");
+
+		if(out == NULL){
+
+			perror("bench/syntax");
+			return 1;
+		}
+
+		fprintf(out, "filetype lang%d\nmatch .l%da .l%db .l%dc File%d\nkeywords", j, j, j, j, j);
+
+		for(k = 0; k < keywords; k++)
+			fprintf(out, " kw%c%c%d", 'a' + rand() % 26, 'a' + rand() % 26, k);
+
+		fprintf(out, "\ntypes t%d u%d\ncomment //\nblock /* */\nstrings \" '\nnumbers\n", j, j);
+		fclose(out);
+	}
+
+	// The cache is only written for definitions at least a second old
+	struct timespec times[2] = { { time(NULL) - 10, 0 }, { time(NULL) - 10, 0 } };
+
+	for(j = 0; j < languages; j++){
+
+		snprintf(path, sizeof(path), "%s/lang%04d.syntax", dir, j);
+		utimensat(AT_FDCWD, path, times, 0);
+	}
+
+	utimensat(AT_FDCWD, dir, times, 0);
+
+	double compiled = benchLoad(cache, 0);
+
+	editorSyntaxLoad();
+
+	long size = E.syntaxdb.len;
+
+	benchUnload();
+
+	double mapped = benchLoad(cache, 1);
+
+	printf("syntax: %d languages of %d keywords, cache %ld KB\n", languages, keywords + 2, size / 1024);
+	printf("  compile the directory  %10.1f us\n", compiled * 1e6);
+	printf("  map the cache          %10.1f us  (%.0fx)\n", mapped * 1e6, compiled / mapped);
+
+	// The definitions as they were kept before, to scan
+	struct editorSyntax **defs = malloc(sizeof(struct editorSyntax *) * languages);
+	char **names = malloc(sizeof(char *) * BENCH_LOOKUPS);
+	long found = 0;
+
+	for(j = 0; j < languages; j++){
+
+		snprintf(path, sizeof(path), "%s/lang%04d.syntax", dir, j);
+		defs[j] = editorSyntaxParse(path, "lang.syntax");
+	}
+
+	for(j = 0; j < BENCH_LOOKUPS; j++){
+
+		names[j] = malloc(32);
+		snprintf(names[j], 32, "src/file.l%dc", rand() % languages);
+	}
+
+	editorSyntaxLoad();
+
+	double t = editorNow();
+
+	for(j = 0; j < BENCH_LOOKUPS; j++)
+		found += scanSelect(defs, languages, names[j]) != NULL;
+
+	double scanned = (editorNow() - t) / BENCH_LOOKUPS;
+
+	t = editorNow();
+
+	for(j = 0; j < BENCH_LOOKUPS; j++)
+		found -= editorSyntaxFind(strrchr(names[j], '.')) != NULL;
+
+	double hashed = (editorNow() - t) / BENCH_LOOKUPS;
+
+	if(found != 0){
+
+		fprintf(stderr, "syntax: the scan and the hash disagree\n");
+		return 1;
+	}
+
+	printf("  file type, scan        %10.3f us\n", scanned * 1e6);
+	printf("  file type, hash        %10.3f us  (%.0fx)\n", hashed * 1e6, scanned / hashed);
+
+	for(j = 0; j < languages; j++){
+
+		snprintf(path, sizeof(path), "%s/lang%04d.syntax", dir, j);
+		unlink(path);
+	}
+
+	unlink(cache);
+	rmdir(dir);
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+/*
+	Column conversions on long tab separated rows, as a TSV export has
+	them: the walk from column 0 that editorScroll did on every refresh
+	against the tab map of a rendered row, for the cursor near the end
+	of the row, and for the way back from a render column.
+	usage: bench/tabs [row bytes] [fields]
+*/
+#include "bench.h"
+
+#define BENCH_CONVERSIONS 20000
+
+int main(int argc, char *argv[]){
+
+	long size = argc > 1 ? atol(argv[1]) : 100000;
+	long fields = argc > 2 ? atol(argv[2]) : 10000;
+	char *line = malloc(size);
+	long j, sum = 0;
+
+	srand(1);
+
+	for(j = 0; j < size; j++)
+		line[j] = (rand() % (size / fields) == 0) ? '\t' : 'a' + rand() % 26;
+
+	benchSetup(24, 80);
+
+	editorInsertRow(0, line, size);
+
+	erow *row = editorRowRender(0);
+	erow walk = *row;
+
+	// The same row without its map converts by walking it
+	walk.flags &= ~ROW_TABMAP;
+
+	printf("tabs: %ld byte row, %ld tabs, %ld render columns\n", size, editorRowTabMap(row)[0], row->rsize);
+
+	double t = editorNow();
+
+	for(j = 0; j < BENCH_CONVERSIONS; j++)
+		sum += editorRowCxToRx(&walk, size - 1 - j % 100);
+
+	double walked = (editorNow() - t) / BENCH_CONVERSIONS;
+
+	t = editorNow();
+
+	for(j = 0; j < BENCH_CONVERSIONS; j++)
+		sum -= editorRowCxToRx(row, size - 1 - j % 100);
+
+	double mapped = (editorNow() - t) / BENCH_CONVERSIONS;
+
+	printf("  column to render, walk  %10.1f ns\n", walked * 1e9);
+	printf("  column to render, map   %10.1f ns  (%.0fx)\n", mapped * 1e9, walked / mapped);
+
+	t = editorNow();
+
+	for(j = 0; j < BENCH_CONVERSIONS; j++)
+		sum += editorRowRxToCx(&walk, row->rsize - 1 - j % 100);
+
+	walked = (editorNow() - t) / BENCH_CONVERSIONS;
+	t = editorNow();
+
+	for(j = 0; j < BENCH_CONVERSIONS; j++)
+		sum -= editorRowRxToCx(row, row->rsize - 1 - j % 100);
+
+	mapped = (editorNow() - t) / BENCH_CONVERSIONS;
+
+	printf("  render to column, walk  %10.1f ns\n", walked * 1e9);
+	printf("  render to column, map   %10.1f ns  (%.0fx)\n", mapped * 1e9, walked / mapped);
+
+	// Both ways must agree
+	if(sum != 0){
+
+		fprintf(stderr, "tabs: the map and the walk disagree\n");
+		return 1;
+	}
+
+	return 0;
+}
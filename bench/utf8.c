@@ -0,0 +1,167 @@
+/*
+	UTF-8 rows against ASCII ones: the check that sends all ASCII rows
+	down the byte path, against looking at each byte, and the frame time
+	of a screen of text in several scripts against one of C source, all
+	of it repainted and after a scroll by one line.
+	usage: bench/utf8 [source.c] [cols] [rows]
+*/
+#include "bench.h"
+
+#define BENCH_FRAMES 2000
+#define BENCH_CHECKS 200
+
+// The check as a loop over bytes
+int byteAscii(const char *s, long len){
+
+	long j;
+
+	for(j = 0; j < len; j++){
+
+		if((unsigned char)s[j] >= 0x80)
+			return 0;
+	}
+
+	return 1;
+}
+
+// Time of a full repaint and of a scroll by one line, per frame
+void frameTimes(double *repaint, double *scroll){
+
+	int top = E.numrows - E.screenrows, frame;
+	double t;
+
+	if(top > 1000)
+		top = 1000;
+
+	for(E.rowoff = 0; E.rowoff <= top; E.rowoff++)
+		editorRowRender(E.rowoff + E.screenrows - 1);
+
+	t = editorNow();
+
+	for(frame = 0; frame < BENCH_FRAMES; frame++){
+
+		E.out.len = 0;
+		E.rowoff = frame % (top + 1);
+		E.shown_valid = 0;
+		editorFrameResize(&E.frame, E.screenrows, E.screencols);
+		editorDrawRows(&E.frame);
+		editorFrameDiff(&E.out);
+	}
+
+	*repaint = (editorNow() - t) / BENCH_FRAMES;
+	t = editorNow();
+
+	for(frame = 1; frame <= BENCH_FRAMES; frame++){
+
+		E.out.len = 0;
+		E.rowoff = frame % (top + 1);
+		editorFrameResize(&E.frame, E.screenrows, E.screencols);
+		editorDrawRows(&E.frame);
+		editorFrameDiff(&E.out);
+	}
+
+	*scroll = (editorNow() - t) / BENCH_FRAMES;
+}
+
+void benchOpen(char *path){
+
+	editorOpen(path);
+	editorScanFinish();
+}
+
+int main(int argc, char *argv[]){
+
+	const char *words[] = { "naïve", "café", "größer", "日本語", "テキスト", "中文", "한국어", "ελληνικά", "русский", "e\xcc\x81", "\t", "emoji 😀", "x = 1;" };
+	char *path = argc > 1 ? argv[1] : "editor.c";
+	char text[] = "/tmp/cedit-utf8-XXXXXX";
+	int fd = mkstemp(text);
+	int j, k;
+
+	benchSetup(argc > 3 ? atoi(argv[3]) : 60, argc > 2 ? atoi(argv[2]) : 200);
+
+	FILE *out = fdopen(fd, "w");
+
+	if(fd == -1 || out == NULL){
+
+		perror("bench/utf8");
+		return 1;
+	}
+
+	srand(1);
+
+	for(j = 0; j < 2000; j++){
+
+		int n = rand() % 24;
+
+		for(k = 0; k < n; k++)
+			fprintf(out, "%s ", words[rand() % (sizeof(words) / sizeof(words[0]))]);
+
+		fputc('\n', out);
+	}
+
+	fclose(out);
+	benchOpen(path);
+
+	if(E.numrows < E.screenrows){
+
+		fprintf(stderr, "utf8: %s has fewer lines than the screen\n", path);
+		return 1;
+	}
+
+	// Every row of the source, checked whole
+	erow **rows = malloc(sizeof(erow *) * E.numrows);
+	long bytes = 0;
+	int ascii = 0;
+
+	for(j = 0; j < E.numrows; j++)
+		rows[j] = editorRowAt(j);
+
+	double t = editorNow();
+
+	for(k = 0; k < BENCH_CHECKS; k++){
+
+		for(j = 0; j < E.numrows; j++){
+
+			ascii += byteAscii(rows[j]->chars, rows[j]->size);
+			bytes += rows[j]->size;
+		}
+	}
+
+	double loop = editorNow() - t;
+
+	t = editorNow();
+
+	for(k = 0; k < BENCH_CHECKS; k++){
+
+		for(j = 0; j < E.numrows; j++)
+			ascii -= editorTextAscii(rows[j]->chars, rows[j]->size);
+	}
+
+	double vector = editorNow() - t;
+
+	if(ascii != 0){
+
+		fprintf(stderr, "utf8: the checks disagree\n");
+		return 1;
+	}
+
+	printf("utf8: %s, %dx%d, %d frames\n", path, E.screencols, E.screenrows, BENCH_FRAMES);
+	printf("  ASCII check, per byte  %8.1f MB/s\n", bytes / 1048576.0 / loop);
+	printf("  ASCII check, vector    %8.1f MB/s  (%.1fx)\n", bytes / 1048576.0 / vector, loop / vector);
+
+	double repaint, scroll;
+
+	free(rows);
+
+	frameTimes(&repaint, &scroll);
+	printf("  ASCII source           %8.1f us repainted  %8.1f us scrolled\n", repaint * 1e6, scroll * 1e6);
+
+	editorDelRows(0, E.numrows);
+	benchOpen(text);
+	unlink(text);
+
+	frameTimes(&repaint, &scroll);
+	printf("  UTF-8 text             %8.1f us repainted  %8.1f us scrolled\n", repaint * 1e6, scroll * 1e6);
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+	Soft wrapping on a long log with lines of every length: laying out
+	all of it, finding the row of a screen line from the tree against
+	adding up the lines of the rows before it, and the frame after a
+	page down, after an edit and after a resize, which lay out only the
+	rows that come on screen.
+	usage: bench/wrap [lines] [cols] [rows]
+*/
+#include "bench.h"
+
+#define BENCH_LOOKUPS 200000
+#define BENCH_WALKS 20
+#define BENCH_FRAMES 200
+
+// One refresh without the terminal: scroll, lay out and draw
+void benchFrame(){
+
+	E.out.len = 0;
+	editorScroll();
+	editorFrameResize(&E.frame, E.screenrows, E.screencols);
+	editorDrawRows(&E.frame);
+	editorFrameDiff(&E.out);
+}
+
+// Row of a screen line by adding up the lines of every row before it
+long walkRow(long line){
+
+	long j;
+
+	for(j = 0; j < E.numrows; j++){
+
+		long lines = editorRowAt(j)->segs ? editorRowAt(j)->segs : 1;
+
+		if(line < lines)
+			break;
+
+		line -= lines;
+	}
+
+	return j;
+}
+
+int main(int argc, char *argv[]){
+
+	long lines = argc > 1 ? atol(argv[1]) : 1000000;
+	char path[] = "/tmp/cedit-wrap-XXXXXX";
+	int fd = mkstemp(path);
+	FILE *out = fdopen(fd, "w");
+	long j, sum = 0, seg;
+	int frame;
+
+	if(fd == -1 || out == NULL){
+
+		perror("bench/wrap");
+		return 1;
+	}
+
+	// Mostly short lines, some a few screens long
+	srand(1);
+
+	for(j = 0; j < lines; j++){
+
+		int len = (rand() % 8 == 0) ? rand() % 1000 : 20 + rand() % 100;
+
+		fprintf(out, "%08ld ", j);
+
+		while(len-- > 0)
+			fputc(rand() % 6 ? 'a' + rand() % 26 : ' ', out);
+
+		fputc('\n', out);
+	}
+
+	fclose(out);
+
+	benchSetup(argc > 3 ? atoi(argv[3]) : 50, argc > 2 ? atoi(argv[2]) : 120);
+	E.wrap = 1;
+
+	editorOpen(path);
+	editorScanFinish();
+	unlink(path);
+
+	double t = editorNow();
+
+	for(j = 0; j < E.numrows; j++)
+		editorRowSegs(j);
+
+	double layout = editorNow() - t;
+	long total = E.rows->count + E.rows->wraps;
+
+	printf("wrap: %ld lines, %ld screen lines at %dx%d\n", E.numrows, total, E.screencols, E.screenrows);
+	printf("  lay out every row       %10.1f ms\n", layout * 1e3);
+
+	t = editorNow();
+
+	for(j = 0; j < BENCH_WALKS; j++)
+		sum += walkRow(total - 1 - j);
+
+	double walked = (editorNow() - t) / BENCH_WALKS;
+
+	for(j = 0; j < BENCH_WALKS; j++)
+		sum -= rowTreeWrapRow(total - 1 - j, &seg);
+
+	if(sum != 0){
+
+		fprintf(stderr, "wrap: the walk and the tree disagree\n");
+		return 1;
+	}
+
+	t = editorNow();
+
+	for(j = 0; j < BENCH_LOOKUPS; j++)
+		sum += rowTreeWrapRow(j * 7919 % total, &seg);
+
+	double found = (editorNow() - t) / BENCH_LOOKUPS;
+
+	printf("  screen line to row, walk %10.1f us\n", walked * 1e6);
+	printf("  screen line to row, tree %10.3f us  (%.0fx)\n", found * 1e6, walked / found);
+
+	// A page at a time from the top
+	E.cy = E.rowoff = E.segoff = 0;
+	benchFrame();
+	t = editorNow();
+
+	for(frame = 0; frame < BENCH_FRAMES; frame++){
+
+		editorWrapPage(1);
+		benchFrame();
+	}
+
+	printf("  frame after page down    %10.1f us\n", (editorNow() - t) / BENCH_FRAMES * 1e6);
+
+	// A character typed into the cursor row lays out that row again
+	t = editorNow();
+
+	for(frame = 0; frame < BENCH_FRAMES; frame++){
+
+		editorInsertChar('x');
+		benchFrame();
+	}
+
+	printf("  frame after an edit      %10.1f us\n", (editorNow() - t) / BENCH_FRAMES * 1e6);
+
+	// Every resize lays out the rows on screen, the rest as they are reached
+	t = editorNow();
+
+	for(frame = 0; frame < BENCH_FRAMES; frame++){
+
+		E.screencols = 80 + frame % 2 * 40;
+		benchFrame();
+	}
+
+	printf("  frame after a resize     %10.1f us\n", (editorNow() - t) / BENCH_FRAMES * 1e6);
+
+	return sum < 0;
+}
@@ -2,6 +2,7 @@
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE
 #define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64 // off_t is 64 bits on 32 bit systems too
 
 
 #include <unistd.h>
@@ -10,20 +11,48 @@
 #include <ctype.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <time.h>
 #include <stdarg.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
 
 
 #define CTRL_KEY(k) ((k) & 0x1f)
-#define ABUF_INIT {NULL,0}
+#define ABUF_INIT {NULL,0,0}
 #define EDITOR_VERSION "0.0.1"
-#define EDITOR_TAB_STOP 8
+#define EDITOR_TAB_STOP 8 // Columns between tab stops, CEDIT_TAB_STOP overrides
+#define EDITOR_TAB_MAP_MIN 8 // Tabs a rendered row needs to keep a map of them
 #define EDITOR_QUIT_TIMES 1
+#define EDITOR_SCAN_CHUNK (1 << 20) // Bytes of a mapped file indexed per step
+#define EDITOR_CACHE_BUDGET 32 // Megabytes of render and highlight caches, CEDIT_CACHE_MB overrides
+#define EDITOR_MATCH_MAX (1 << 24) // Match positions kept by the search index
+#define EDITOR_UNDO_LIMIT 16384 // Kilobytes of undo log, CEDIT_UNDO_KB overrides
+#define EDITOR_INPUT_RING 4096 // Bytes of terminal input read ahead, a power of two
+#define EDITOR_ESC_TIMEOUT 25 // Milliseconds an incomplete escape sequence waits for the rest
+#define EDITOR_PASTE_TIMEOUT 1000 // Milliseconds of quiet that end a paste missing its end marker
+#define EDITOR_SAVE_IOVS 512 // Pieces of rows handed to each writev when saving
+#define EDITOR_JOURNAL_SYNC 1000 // Milliseconds edits wait to be written to the swap file
+#define EDITOR_KEYWORD_SLOTS (1 << 16) // Largest keyword table, words that still collide go unhighlighted
+#define EDITOR_SYNTAX_DIR ".cedit/syntax" // Syntax definitions under $HOME, CEDIT_SYNTAX_DIR overrides
+
 
+#define ATTR_INVERSE 0x80 // Cell attribute bit, the others hold the foreground color, 0 for the default
 
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
@@ -40,10 +69,14 @@ enum editorKey {
   HOME_KEY,
   END_KEY, 
   PAGE_UP,
-  PAGE_DOWN
+  PAGE_DOWN,
+  PASTE_START // Bracketed paste, the text follows
 
 };
 
+// Lexer state of a row that has not been scanned since it last changed
+#define HL_STATE_STALE 0xff
+
 enum editorHighlight{
 
   HL_NORMAL = 0,
@@ -56,19 +89,165 @@ enum editorHighlight{
   HL_MATCH
 
 };
-// To store text from editor
+/*
+	To store text from editor. The render and highlight caches share one
+	buffer, hl bytes then the render text when tabs were expanded; a row
+	without tabs renders as its chars. A row with many tabs also keeps a
+	map of where they are, so columns convert to render columns with a
+	binary search. Rows with UTF-8 in them are drawn by decoding it, their
+	tabs expand to the next tab stop on screen. A row also keeps how many
+	screen lines it takes when long lines wrap. Leaves hold 256 rows
+	inline, so the row is kept to 40 bytes.
+*/
+#define ROW_RENDERED (1<<0) // rsize and cache are set
+#define ROW_EXPANDED (1<<1) // Render text follows hl in cache
+#define ROW_HIGHLIGHTED (1<<2) // hl in cache is current
+#define ROW_TABMAP (1<<3) // The tab map follows the render text
+#define ROW_UTF8 (1<<4) // Not all ASCII, render columns are not screen columns
+
 typedef struct erow {
 
-	int size;
-	int rsize;
 	char *chars;
-	char *render;
-	unsigned char *hl;
-	int idx;
-	int hl_open_comment;
+	unsigned char *cache; // hl, then render when expanded; NULL until rendered and for empty rows
+	long size;
+	long rsize;
+	unsigned char hl_open_comment; // Lexer state at the end of the row
+	unsigned char hl_start; // Lexer state the row was last scanned from
+	unsigned char flags;
+	unsigned int segs; // Screen lines when wrapped, 0 until laid out
 
 }erow;
 
+/*
+	Rows are kept in a B+ tree ordered by line number. Leaves store rows
+	inline and inner nodes track the number of rows below each child, so
+	lookup, insert and delete by line number are O(log n). Nodes also
+	count the bytes below them, so a line is found from its byte offset
+	in O(log n) too, and the screen lines below them when long lines
+	wrap, so a screen line is found from its number and back. Rows are
+	laid out for wrapping as they are shown, one not laid out yet counts
+	as one line. A lazy node stands in for a leaf whose lines are still
+	only in the mapped file.
+*/
+#define ROW_LEAF_MAX 256
+#define ROW_NODE_MAX 64
+
+enum rowNodeKind {
+
+	ROW_INNER = 0,
+	ROW_LEAF,
+	ROW_LAZY
+
+};
+
+typedef struct rowNode {
+
+	struct rowNode *parent;
+	int kind;
+	int n; // Rows (leaf) or children (inner node) in use
+	long count; // Total rows below this node
+	off_t bytes; // Their text as saved, a newline after each row
+	long wraps; // Screen lines past the first of each row, when wrapped
+
+}rowNode;
+
+typedef struct rowLeaf {
+
+	rowNode h;
+	int wrap_cols; // Screen width the rows were laid out for
+	erow rows[ROW_LEAF_MAX];
+
+}rowLeaf;
+
+typedef struct rowInner {
+
+	rowNode h;
+	rowNode *child[ROW_NODE_MAX + 1]; // One spare slot while splitting
+
+}rowInner;
+
+typedef struct rowLazy {
+
+	rowNode h;
+	off_t start; // File offset of the first line
+	off_t end; // Offset just past the last line
+	unsigned char hl_start; // Lexer states at either end of the lines
+	unsigned char hl_end;
+
+}rowLazy;
+
+/*
+	Row buffers, chars and render caches, come from chunks of 64 KB mapped
+	at 64 KB boundaries, so the chunk of a buffer is found from its
+	address. A chunk is a slab of one power of two size class, an arena
+	the lines of a file are copied into in bulk, or holds one large
+	buffer. Chunks go back to the system once nothing in them is used.
+*/
+#define ROWMEM_CHUNK (64 << 10)
+#define ROWMEM_HEADER 64 // Chunk header, buffers start after it
+#define ROWMEM_CLASSES 10 // Slab classes of 16 bytes to 8 KB
+#define ROWMEM_ARENA_MAX 4096 // Longer lines loaded from a file get their own buffer
+
+enum rowChunkKind {
+
+	ROWMEM_SLAB = 0,
+	ROWMEM_ARENA,
+	ROWMEM_LARGE
+
+};
+
+typedef struct rowChunk {
+
+	int kind;
+	int cls; // Size class of a slab
+	int live; // Buffers in use
+	size_t size; // Bytes mapped
+	char *free; // Freed slab buffers, linked through their first bytes
+	char *bump; // Start of the space never handed out
+	struct rowChunk *prev, *next; // Slabs of the class with room left
+
+}rowChunk;
+
+struct rowMem {
+
+	rowChunk *partial[ROWMEM_CLASSES];
+	rowChunk *arena; // Where loaded lines go
+	long chunks[3]; // Mapped chunks of each kind
+	size_t mapped;
+	long buffers; // In use
+
+};
+
+// Character classes of the lexer tables
+#define CC_SEP (1<<0) // Ends a word
+#define CC_DIGIT (1<<1)
+#define CC_QUOTE (1<<2) // Opens a string
+#define CC_COMMENT (1<<3) // First byte of a comment delimiter
+#define CC_WORD (1<<4) // Part of a word that can be skipped in one go
+
+struct editorKeyword {
+
+  uint32_t word; // Offset from the lexer, 0 for an empty slot
+  unsigned char len;
+  unsigned char hl;
+
+};
+
+// Lookup tables built once from an editorSyntax entry, one block without pointers
+struct editorLexer {
+
+  unsigned char cls[256];
+  int scs_len;
+  int mcs_len;
+  int mce_len;
+  uint32_t keywords; // Offset of a collision free hash table of kwmask + 1 slots
+  unsigned int kwmask;
+  unsigned int kwseed;
+  int kwmaxlen;
+  uint32_t size; // Bytes of the block, the words follow the table
+
+};
+
 // Syntax highlighting struct
 struct editorSyntax {
 
@@ -79,6 +258,254 @@ struct editorSyntax {
   char *multiline_comment_start;
   char *multiline_comment_end;
   int flags;
+  char *quotes; // Characters that open a string, NULL for both quotes
+  struct editorLexer *lexer; // Built on first use by editorSyntaxCompile
+
+};
+
+/*
+	Compiled syntax cache. Every definition found in the syntax directory
+	is compiled into one block: the records of each language, a hash of
+	the extensions and file names they match, and their strings and
+	lexers, all at offsets from the start. The block is written next to
+	the directory and mapped as it is while the directory and the files
+	in it are as they were, so startup reads no definitions at all.
+*/
+#define SYNTAX_MAGIC "cedit s2"
+
+struct syntaxHeader {
+
+	char magic[8];
+	int64_t mtime; // Newest of the directory it was compiled from and its definitions
+	int64_t bytes; // Of the definitions
+	int64_t files;
+	int64_t ino; // Of the directory
+	int64_t dev;
+	uint32_t size; // Bytes of the whole cache
+	uint32_t nsyntax;
+	uint32_t syntaxes; // Offset of the records
+	uint32_t names; // Offset of the name hash, namemask + 1 slots
+	uint32_t namemask;
+
+};
+
+struct syntaxRecord {
+
+	uint32_t filetype; // Offsets of strings, 0 for none
+	uint32_t singleline_comment_start;
+	uint32_t multiline_comment_start;
+	uint32_t multiline_comment_end;
+	int32_t flags;
+	uint32_t lexer;
+
+};
+
+struct syntaxName {
+
+	uint32_t name; // Extension with its dot or a whole file name, 0 for an empty slot
+	uint32_t syntax; // Record it selects
+
+};
+
+struct editorSyntaxDb {
+
+	char *base; // The cache, mapped or built on the heap, NULL until loaded
+	size_t len;
+	int mapped;
+	struct editorSyntax *loaded; // One per record, filled in when a file selects it
+
+};
+
+// Every match of the search query, collected by a worker thread
+struct editorMatchIndex {
+
+	pthread_t thread;
+	int running;
+	pthread_cond_t wake; // Signalled when the query changes
+	char *query; // NULL while no search is active
+	size_t len;
+	int use_regex; // The query is a regular expression
+	struct editorRegex *regex; // Its compiled form, NULL if it does not compile
+	const char *error; // Why it does not
+	long *row; // Stored match positions in file order
+	long *col;
+	int count;
+	int cap;
+	long total; // Matches found, more than count once the index is full
+	long indexed_row; // Rows above this have all their matches stored
+	long scan_row; // Next row for the worker to search
+	int done;
+	long shown; // Total last drawn in the status bar
+
+};
+
+/*
+	Undo log. Edits are recorded as the text or rows they insert or
+	delete and undone by applying the opposite. Typing extends the last
+	record rather than adding one. Record text lives in a ring that grows
+	up to the byte limit, past it the oldest edits are forgotten.
+*/
+enum undoKind {
+
+	UNDO_INSERT_TEXT = 0,
+	UNDO_DELETE_TEXT,
+	UNDO_INSERT_ROWS,
+	UNDO_DELETE_ROWS
+
+};
+
+struct undoRecord {
+
+	int kind;
+	unsigned int step; // Records made by one key are undone together
+	long row, col; // Where the text or the first row goes
+	long rows; // Of a row record
+	size_t off, len; // Text in the ring; for rows, the length then the bytes of each
+	long cx, cy; // Cursor before the key
+	long after_cx, after_cy; // and after it
+
+};
+
+struct editorUndo {
+
+	char *ring;
+	size_t cap; // Bytes in ring
+	size_t limit; // Bytes of ring and records together
+	struct undoRecord *rec; // Oldest first, from head round rec_cap slots
+	int rec_cap;
+	int head;
+	int count;
+	int applied; // Records done, those after them were undone and can be redone
+	unsigned int step; // Bumped for every key
+	unsigned int lost_step; // A record of this step did not fit, none of it is kept
+	int replaying; // Edits made by undo and redo are not recorded
+	long cx, cy; // Cursor when the key was read
+
+};
+
+/*
+	Swap file journal. Edits are appended to a buffer as they are made,
+	as records of the undo kinds, and a thread writes the buffer to a
+	swap file next to the file and syncs it, a batch at a time, so typing
+	never waits on the disk. The swap file names the file it was made
+	against, and after a crash its edits are replayed on top of it.
+*/
+#define JOURNAL_MAGIC "cedit j1"
+
+struct journalHeader {
+
+	char magic[8];
+	int64_t size; // The file the edits apply to, as it was opened or saved
+	int64_t mtime;
+	int64_t ino;
+	int64_t pid; // Editor appending to it
+
+};
+
+struct journalRecord {
+
+	uint32_t kind;
+	uint32_t sum; // Of the record with sum 0 and its data, a torn write fails it
+	int64_t row, col;
+	int64_t n; // Bytes inserted or deleted, or rows
+	int64_t len; // Bytes of data that follow, text or rows as the undo log keeps them
+
+};
+
+struct editorJournal {
+
+	int enabled; // Cleared when another editor has the file
+	int closed; // Its buffer is gone, the writer frees it
+	char *path; // Swap file, NULL while there is nothing to journal against
+	struct journalHeader header;
+	int replaying; // Edits replayed from the swap file are already in it
+	pthread_t thread;
+	int running;
+	pthread_mutex_t lock; // Guards the rest, the main thread never holds it across a disk write
+	pthread_cond_t wake; // Records were added
+	pthread_cond_t idle; // The writer finished a batch
+	int fd; // -1 until the writer creates the file
+	char *buf; // Records not yet taken by the writer
+	size_t len, cap;
+	int writing; // The writer has a batch out, it owns fd meanwhile
+	int error; // errno of a failed write, reported once
+
+};
+
+// Append buffer to limit write() syscalls
+struct abuf{
+
+	char *b;
+	int len;
+	int cap;
+
+};
+
+/*
+	A screen worth of cells, a character and an attribute each. A cell
+	whose character is 0 holds a glyph of more than one byte instead, a
+	character not in ASCII with any combining marks on it, and the cell
+	right of a wide character holds an empty one.
+*/
+#define FRAME_GLYPH 16 // Bytes of a glyph, NUL padded
+
+struct editorFrame {
+
+	int rows;
+	int cols;
+	char *chars;
+	unsigned char *attrs;
+	char *glyphs; // FRAME_GLYPH bytes for each cell
+	unsigned char *multi; // Rows with glyphs in them
+	int *used; // Columns of each row up to the last drawn, only blanks follow
+
+};
+
+/*
+	Headless run from a trace of terminal input. Keys are taken one at a
+	time as if typed apart, each drawn before the next, and the time from
+	handing out a key to being asked for the next is its latency.
+*/
+struct editorReplay {
+
+	double start; // The first frame is timed from here
+	double first_frame;
+	double taken; // When the last key was handed out, 0 if none is out
+	uint32_t *latency; // Microseconds of each key
+	long keys, cap;
+	int eof; // The trace is used up, Escape is read from then on
+
+};
+
+/*
+	An open file. The one being edited has its state in E, the others
+	wait here with their rows, caches, undo log and journal as they were
+	left, so switching back to one neither reads nor highlights its file
+	again. Syntax definitions and the lexers built from them are shared.
+*/
+struct editorBuffer {
+
+	long numrows;
+	long cx, cy;
+	long rowoff, coloff, segoff;
+	rowNode *rows;
+	rowLeaf *rowcache;
+	long rowcache_base;
+	char *map;
+	off_t maplen;
+	off_t scan_off, scan_start;
+	int scan_lines;
+	off_t scan_bytes;
+	int scan_done;
+	size_t cache_bytes;
+	long cache_hand;
+	long hl_front, hl_dirty_end;
+	struct editorUndo undo;
+	struct editorJournal *journal;
+	struct rowMem mem;
+	int dirty;
+	char *filename;
+	struct editorSyntax *syntax;
 
 };
 
@@ -87,23 +514,68 @@ struct editorConfig {
 	struct termios orig_termios;
 	int screenrows;
 	int screencols;
-	int numrows;
-	int cx,cy;
-	int rx; // Horizontal coordinate 
-	int rowoff; // For vertical screen scrolling 
-	int coloff; // For horizontal scrolling
-	erow *row;
+	long numrows;
+	long cx,cy;
+	long rx; // Horizontal coordinate 
+	int tabstop; // Columns between tab stops
+	long rowoff; // For vertical screen scrolling 
+	long coloff; // For horizontal scrolling
+	int wrap; // Long lines wrap instead of scrolling sideways
+	long segoff; // Screen lines of the top row above the screen, when wrapped
+	int cursor_y, cursor_x; // Cursor on the screen, set by editorScroll
+	rowNode *rows; // Root of the row tree
+	rowLeaf *rowcache; // Last leaf looked up, speeds up sequential access
+	long rowcache_base; // Line number of the first row in rowcache
+	char *map; // File mapped by a lazy open, rows are read from it on demand
+	off_t maplen;
+	off_t scan_off; // Bytes of the mapping indexed into lazy nodes so far
+	off_t scan_start; // Start of the lines not yet handed to a lazy node
+	int scan_lines; // Number of those lines
+	off_t scan_bytes; // And their bytes, as the rows will hold them
+	int scan_done;
+	size_t cache_bytes; // Memory held by render and highlight caches
+	size_t cache_budget; // Off screen caches are freed above this
+	long cache_hand; // Where the next cache trim starts
+	long hl_front; // Rows above this have an up to date lexer state
+	long hl_dirty_end; // Rows from here on were scanned in sequence and need no rescan
+	pthread_mutex_t lock; // Held by the main thread except while it waits for a key
+	pthread_mutex_t lock_gate; // Guards lock_waiting
+	pthread_cond_t lock_handoff;
+	int lock_waiting; // Main thread is blocked on lock
+	struct editorMatchIndex match;
+	struct editorUndo undo;
+	struct editorJournal *journal; // Of the buffer, NULL in tools that embed the editor
+	struct rowMem mem; // Row buffer allocator
 	int dirty; // Dirty bit to prevent losing unsaved changes
 	char *filename;
-	char statusmsg[80];
+	char statusmsg[256];
 	time_t statusmsg_time;
 	struct editorSyntax *syntax;
+	struct editorSyntaxDb syntaxdb; // Definitions of every language, shared by the buffers
+	struct editorBuffer *buffers; // Open files, the current one is only up to date in E
+	int nbuffers;
+	int buffer; // Current one
+	struct editorFrame frame; // Cells of the frame being drawn
+	struct editorFrame shown; // Cells on the terminal, frames are diffed against them
+	int shown_valid; // The terminal holds something else, repaint all of it
+	int shown_cx, shown_cy; // Where the terminal cursor was left
+	struct abuf out; // What a refresh writes, the buffer is kept between them
+	long frame_bytes; // Written to the terminal by the last refresh
+	long frames;
+	long frames_bytes; // Written by all of them
+	unsigned char in[EDITOR_INPUT_RING]; // Terminal input not yet decoded into keys
+	unsigned int in_head, in_tail; // Free running, masked on access
+	int winch_pipe[2]; // Written by the SIGWINCH handler, read by the input wait
+	int headless; // Keys come from a trace and frames go to a virtual screen
+	int in_fd, out_fd; // The terminal unless headless
+	int record_fd; // Terminal input is copied here, CEDIT_RECORD, -1 for none
+	struct editorReplay replay;
 
 };
 
 struct editorConfig E;
 
-// Syntax highlighting for C & CPP
+// Built in syntax for C & CPP, used unless the syntax directory defines the filetype
 
 char *C_HL_extensions[] = { ".c", ".h", ".cpp", NULL };
 
@@ -124,7 +596,9 @@ struct editorSyntax HLDB[] = {
     C_HL_extensions,
     C_HL_keywords,
     "//", "/*", "*/",
-    HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+    HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+    NULL,
+    NULL
   },
 
 };
@@ -135,7 +609,12 @@ struct editorSyntax HLDB[] = {
 
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
+int editorSyntaxScan(char *s, long len, unsigned char *hl, int in_comment);
+void editorScanChunk(off_t bytes);
+void editorJournalRecover();
+long editorMatchProgress();
 char *editorPrompt(char *prompt, void(*callback)(char *, int));
+void abAppend(struct abuf *ab, const char *s, int len);
 
 // Error handler
 void die(const char *s){
@@ -148,6 +627,7 @@ void die(const char *s){
 }
 
 void disableRawMode() {
+  write(STDOUT_FILENO, "\x1b[?2004l", 8); // Bracketed paste off
   if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
   	die("tcsetattr");
 }
@@ -170,1161 +650,8258 @@ void enableRawMode() {
   raw.c_oflag &= ~(OPOST); // Turn off output processing
   raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON); // Miscellaneous flags
   raw.c_cflag |= (CS8);
-  raw.c_cc[VMIN] = 0; // Minimum bytes of input needed before read() can return 
-  raw.c_cc[VTIME] = 1; // Maximum amount of time to wait before read() returns  
+  raw.c_cc[VMIN] = 0; // read() returns what is there, poll() does the waiting
+  raw.c_cc[VTIME] = 0;
  
 
 
   if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
   	die("tcsetattr");
-}
-
-// Manage low level terminal input 
-int editorReadKey(){
-	int nread;
-	char c;
 
-	while((nread = read(STDIN_FILENO, &c,1)) != 1){
-		if(nread == -1 && errno == EAGAIN)
-			die("read");
-	}
+  // Pasted text comes between ESC [ 200 ~ and ESC [ 201 ~ rather than as typed keys
+  write(STDOUT_FILENO, "\x1b[?2004h", 8);
+}
 
-	if(c == '\x1b'){
+/*
+	The row tree belongs to whoever holds E.lock. The main thread gives it
+	up only while waiting for input, and a worker that sees the main thread
+	waiting steps aside at its next chunk boundary.
+*/
+void editorLock(){
 
-		char seq[3];
+	pthread_mutex_lock(&E.lock_gate);
+	E.lock_waiting++;
+	pthread_mutex_unlock(&E.lock_gate);
 
-		if(read(STDIN_FILENO, &seq[0],1) != 1)
-			return '\x1b';
+	pthread_mutex_lock(&E.lock);
 
-		if(read(STDIN_FILENO, &seq[1],1) != 1)
-			return '\x1b';
+	pthread_mutex_lock(&E.lock_gate);
+	E.lock_waiting--;
+	pthread_cond_signal(&E.lock_handoff);
+	pthread_mutex_unlock(&E.lock_gate);
+}
 
-		// To move cursor with arrow keys
-		if(seq[0] == '['){
+void editorUnlock(){
 
-			if(seq[1] >= '0' && seq[1] <= '9'){
-				if(read(STDIN_FILENO,&seq[2],1) != 1)
-					return '\x1b';
+	pthread_mutex_unlock(&E.lock);
+}
 
-				if(seq[2] == '~'){
+// Called by workers between chunks of work
+void editorYieldLock(){
 
-					switch(seq[1]){
-						case '1': return HOME_KEY;
-						case '3': return DEL_KEY;
-						case '4': return END_KEY;
-						case '5': return PAGE_UP;
-						case '6': return PAGE_DOWN;
-						case '7': return HOME_KEY;
-						case '8': return END_KEY;
-					}
-				}
-			}
-			else{
+	pthread_mutex_lock(&E.lock_gate);
 
-				switch(seq[1]){
+	if(E.lock_waiting){
 
-					case 'A': return ARROW_UP;
-					case 'B': return ARROW_DOWN;
-					case 'C': return ARROW_RIGHT;
-					case 'D': return ARROW_LEFT;
-					case 'H': return HOME_KEY;
-					case 'F': return END_KEY;
+		pthread_mutex_unlock(&E.lock);
 
-				}
-			
-			}
+		while(E.lock_waiting)
+			pthread_cond_wait(&E.lock_handoff, &E.lock_gate);
 
-		}
-		else if(seq[0] == 'O'){
+		pthread_mutex_unlock(&E.lock_gate);
+		pthread_mutex_lock(&E.lock);
+	}
+	else
+		pthread_mutex_unlock(&E.lock_gate);
+}
 
-			switch(seq[1]){
+// A resize wakes the input wait through a pipe, whichever thread the signal lands on
+void editorHandleWinch(int sig){
 
-				case 'H': return HOME_KEY;
-				case 'F': return END_KEY; 
-			}
-		}
-		return '\x1b';
-	}
-	else{
+	int saved = errno;
 
-		return c;
-	}
+	(void)sig;
+	write(E.winch_pipe[1], "", 1);
+	errno = saved;
 }
 
-int getCursorPosition(int *rows,int *cols){
-
-	char buf[32];
-	unsigned int i = 0; 
+void editorInputInit(){
 
+	struct sigaction sa;
 
+	if(pipe(E.winch_pipe) == -1)
+		die("pipe");
 
-	if(write(STDOUT_FILENO, "\x1b[6n",4) != 4)
-		return -1;
+	fcntl(E.winch_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(E.winch_pipe[1], F_SETFL, O_NONBLOCK);
 
-	while(i < sizeof(buf) - 1){
-		if(read(STDIN_FILENO, &buf[i],1) != 1)
-			break;
+	// A virtual screen keeps its size
+	if(E.headless)
+		return;
 
-		if(buf[i] == 'R')
-			break;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = editorHandleWinch;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGWINCH, &sa, NULL);
+}
 
-		i++;	
+// Take the new size of the terminal, the next frame repaints all of it
+void editorResize(){
 
-	}
-	buf[i] = '\0';
-	if (buf[0] != '\x1b' || buf[1] != '[') 
-		return -1;
+	struct winsize ws;
 
-  	if (sscanf(&buf[2], "%d;%d", rows, cols) != 2)
-  		return -1;
+	if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0 || ws.ws_row < 3)
+		return;
 
-  	return 0;
+	E.screenrows = ws.ws_row - 2;
+	E.screencols = ws.ws_col;
+	E.shown_valid = 0;
+	E.shown_cx = E.shown_cy = -1;
 }
 
-// Utility function to get size of window
-int getWindowSize(int *rows, int *cols){
-	struct winsize ws;
-
-	// ioctl syscall 
-	if(ioctl(STDOUT_FILENO,TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0){
+#define INPUT_READY (1<<0) // editorInputWait results
+#define INPUT_RESIZED (1<<1)
 
-		// Escape sequence to send cursor move to right and then down (999 px)
-		if(write(STDOUT_FILENO, "\x1b[999C\xb[999B",12) != 12)
-			return -1;
+/*
+	Wait up to 'timeout' milliseconds, -1 for ever, for input or a
+	resize. Without 'input' only a resize or the timeout end the wait.
+*/
+int editorInputWait(int timeout, int input){
 
-		return getCursorPosition(rows,cols);
-	}
-	else{
+	struct pollfd pfd[2] = { { E.winch_pipe[0], POLLIN, 0 }, { E.in_fd, POLLIN, 0 } };
+	char drain[64];
+	int got = 0;
 
-		*cols = ws.ws_col;
-		*rows = ws.ws_row;
+	if(poll(pfd, input ? 2 : 1, timeout) <= 0)
 		return 0;
-	}
-}
 
-// returns true if separator character
-int is_separator(int c){
-
-	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+	if(pfd[0].revents & POLLIN){
 
-}
+		while(read(E.winch_pipe[0], drain, sizeof(drain)) > 0)
+			;
 
-void editorUpdateSyntax(erow *row) {
+		got |= INPUT_RESIZED;
+	}
 
-  row->hl = realloc(row->hl, row->rsize);
-  memset(row->hl, HL_NORMAL, row->rsize);
+	// The end of a trace piped in is a hangup, read finds it
+	if(input && (pfd[1].revents & (POLLIN | POLLHUP)))
+		got |= INPUT_READY;
 
-  if (E.syntax == NULL)
-  	return;
+	return got;
+}
 
-  char **keywords = E.syntax->keywords;
+/*
+	Wait up to 'timeout' milliseconds for input and read all that is
+	there into the ring. The row tree is free for workers while waiting.
+	A resize ends the wait and is drawn at once. Returns the bytes read.
+*/
+int editorInputFill(int timeout){
 
-  char *scs = E.syntax->singleline_comment_start;
-  char *mcs = E.syntax->multiline_comment_start;
-  char *mce = E.syntax->multiline_comment_end;
+	unsigned int at = E.in_head & (EDITOR_INPUT_RING - 1);
+	size_t room = EDITOR_INPUT_RING - (E.in_head - E.in_tail);
+	ssize_t n = 0;
+	int got;
 
-  int scs_len = scs ? strlen(scs) : 0;
-  int mcs_len = mcs ? strlen(mcs) : 0;
-  int mce_len = mce ? strlen(mce) : 0;
+	if(room > EDITOR_INPUT_RING - at)
+		room = EDITOR_INPUT_RING - at;
 
-  int prev_sep = 1;
-  int in_string = 0;
-  int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
+	editorUnlock();
+	got = editorInputWait(timeout, room > 0);
 
-  int i = 0;
-  while (i < row->rsize) {
+	if((got & INPUT_READY) && (n = read(E.in_fd, &E.in[at], room)) == -1 && errno != EAGAIN && errno != EINTR)
+		die("read");
 
-    char c = row->render[i];
-    unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+	if(n > 0 && E.record_fd != -1 && write(E.record_fd, &E.in[at], n) != n){
 
-    if (scs_len && !in_string && !in_comment) {
+		close(E.record_fd);
+		E.record_fd = -1;
+	}
 
-      if (!strncmp(&row->render[i], scs, scs_len)) {
+	if(n == 0 && (got & INPUT_READY) && E.headless)
+		E.replay.eof = 1;
 
-        memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-        break;
+	editorLock();
 
-      }
+	if(got & INPUT_RESIZED){
 
-    }
+		editorResize();
+		editorRefreshScreen();
+	}
 
-    if (mcs_len && mce_len && !in_string) {
+	if(n <= 0)
+		return 0;
 
-      if (in_comment) {
+	E.in_head += n;
+	return n;
+}
 
-        row->hl[i] = HL_MLCOMMENT;
+// Input byte 'i' places past the next undecoded one, -1 if not read yet
+int editorInputPeek(unsigned int i){
 
-        if (!strncmp(&row->render[i], mce, mce_len)) {
+	if(E.in_head - E.in_tail <= i)
+		return -1;
 
-          memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-          i += mce_len;
-          in_comment = 0;
-          prev_sep = 1;
-          continue;
+	return E.in[(E.in_tail + i) & (EDITOR_INPUT_RING - 1)];
+}
 
-        } 
-        else {
+// Key of a complete CSI sequence from its first parameter and final byte
+int editorCsiKey(int param, int final){
 
-          i++;
-          continue;
+	if(final == '~'){
 
-        }
+		switch(param){
+			case 1: return HOME_KEY;
+			case 3: return DEL_KEY;
+			case 4: return END_KEY;
+			case 5: return PAGE_UP;
+			case 6: return PAGE_DOWN;
+			case 7: return HOME_KEY;
+			case 8: return END_KEY;
+			case 200: return PASTE_START;
+		}
+	}
+	else{
 
-      } 
-      else if (!strncmp(&row->render[i], mcs, mcs_len)) {
+		switch(final){
 
-        memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-        i += mcs_len;
-        in_comment = 1;
-        continue;
+			case 'A': return ARROW_UP;
+			case 'B': return ARROW_DOWN;
+			case 'C': return ARROW_RIGHT;
+			case 'D': return ARROW_LEFT;
+			case 'H': return HOME_KEY;
+			case 'F': return END_KEY;
+		}
+	}
 
-      }
+	return '\x1b';
+}
 
-    }
+/*
+	Decode the key at the front of the input into *key and return the
+	bytes it takes, or 0 while its escape sequence is still incomplete.
+	A sequence is CSI, ESC [ then parameter bytes then a final byte, or
+	SS3, ESC O then one byte. Other input after ESC leaves it a bare
+	Escape, and so does a complete sequence that is no key of ours.
+*/
+int editorInputDecode(int *key){
 
-    if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+	enum { KEY_START, KEY_ESC, KEY_CSI, KEY_SS3 } state = KEY_START;
+	int param = 0, params = 0;
+	unsigned int i;
+	int c;
 
-      if (in_string) {
+	for(i = 0; (c = editorInputPeek(i)) != -1; i++){
 
-        row->hl[i] = HL_STRING;
+		switch(state){
 
-        if (c == '\\' && i + 1 < row->rsize) {
+			case KEY_START:
+				if(c != '\x1b'){
 
-          row->hl[i + 1] = HL_STRING;
-          i += 2;
-          continue;
+					*key = c;
+					return 1;
+				}
+				state = KEY_ESC;
+				break;
+
+			case KEY_ESC:
+				if(c == '[')
+					state = KEY_CSI;
+				else if(c == 'O')
+					state = KEY_SS3;
+				else{
+
+					*key = '\x1b';
+					return 1;
+				}
+				break;
 
-        }
-        if (c == in_string)
-        	in_string = 0;
+			case KEY_SS3:
+				*key = (c >= 'A' && c <= 'D') || c == 'H' || c == 'F' ? editorCsiKey(0, c) : '\x1b';
+				return i + 1;
 
-        i++;
-        prev_sep = 1;
-        continue;
+			case KEY_CSI:
+				if(c >= '0' && c <= '9' && params == 0)
+					param = param * 10 + c - '0';
+				else if(c == ';')
+					params++;
+				else if(c >= 0x40 && c <= 0x7e){
 
-      } 
-      else {
+					*key = editorCsiKey(param, c);
+					return i + 1;
+				}
+				else if(c < 0x20 || c > 0x7e || i > 32){
 
-        if (c == '"' || c == '\'') {
+					// Not a sequence after all
+					*key = '\x1b';
+					return 1;
+				}
+				break;
+		}
+	}
 
-          in_string = c;
-          row->hl[i] = HL_STRING;
-          i++;
-          continue;
+	return 0;
+}
 
-        }
+/*
+	Collect the text of a bracketed paste from the input up to its end
+	marker, ESC [ 201 ~. A terminal that never sends the marker ends the
+	paste with a second of quiet. Returns the text, *len bytes of it.
+*/
+char *editorReadPaste(size_t *len){
 
-      }
+	static const char end[] = "\x1b[201~";
+	size_t cap = 4096;
+	char *buf = malloc(cap);
+	size_t n = 0;
 
-    }
+	while(1){
 
-    if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+		unsigned int i = 0;
+		int c;
 
-      if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || (c == '.' && prev_hl == HL_NUMBER)) {
+		while(i < sizeof(end) - 1 && (c = editorInputPeek(i)) == end[i])
+			i++;
 
-        row->hl[i] = HL_NUMBER;
-        i++;
-        prev_sep = 0;
-        continue;
+		if(i == sizeof(end) - 1){
 
-      }
+			E.in_tail += i;
+			break;
+		}
 
-    }
+		// Input ran out, maybe part way through the marker
+		if(c == -1 && editorInputFill(EDITOR_PASTE_TIMEOUT) > 0)
+			continue;
 
-    if (prev_sep) {
+		if(n + E.in_head - E.in_tail + 1 > cap){
 
-      int j;
-      for (j = 0; keywords[j]; j++) {
+			while(n + E.in_head - E.in_tail + 1 > cap)
+				cap *= 2;
 
-        int klen = strlen(keywords[j]);
-        int kw2 = keywords[j][klen - 1] == '|';
-        if (kw2) klen--;
+			buf = realloc(buf, cap);
+		}
 
-        if (!strncmp(&row->render[i], keywords[j], klen) && is_separator(row->render[i + klen])) {
+		if(c == -1){
 
-          memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-          i += klen;
-          break;
+			while(E.in_tail != E.in_head)
+				buf[n++] = E.in[E.in_tail++ & (EDITOR_INPUT_RING - 1)];
+			break;
+		}
 
-        }
+		buf[n++] = editorInputPeek(0);
+		E.in_tail++;
+	}
 
-      }
-      if (keywords[j] != NULL) {
+	*len = n;
+	return buf;
+}
 
-        prev_sep = 0;
-        continue;
-      }
+// Whether a key has been read and not handled yet, after taking what input is waiting
+int editorInputPending(){
 
-    }
-    prev_sep = is_separator(c);
-    i++;
+	// Keys of a trace are drawn one at a time
+	if(E.headless)
+		return 0;
 
-  }
+	if(E.in_head == E.in_tail)
+		editorInputFill(0);
+
+	return E.in_head != E.in_tail;
+}
 
-  int changed = (row->hl_open_comment != in_comment);
-  row->hl_open_comment = in_comment;
+// Seconds on a clock that only goes forward
+double editorNow(){
 
-  if (changed && row->idx + 1 < E.numrows)
-    editorUpdateSyntax(&E.row[row->idx + 1]);
+	struct timespec ts;
 
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
+void editorReplayMark();
 
-int editorSyntaxToColor(int hl){
+// Manage low level terminal input 
+int editorReadKey(){
 
-	switch(hl){
+	int key, used;
 
-		case HL_COMMENT:
+	if(E.headless)
+		editorReplayMark();
 
-		case HL_MLCOMMENT: return 36;
+	// Keep indexing the open file while no key is waiting
+	if(!E.scan_done && E.in_head == E.in_tail){
 
-		case HL_KEYWORD1: return 33;
+		while(!E.scan_done){
 
-		case HL_KEYWORD2: return 32;
+			int got = editorInputWait(0, 1);
 
-		case HL_STRING: return 35;
+			if(got & INPUT_RESIZED){
 
-		case HL_NUMBER: return 31; // Foreground red
+				editorResize();
+				editorRefreshScreen();
+			}
 
-		case HL_MATCH: return 34; // Foreground blue
+			if(got & INPUT_READY)
+				break;
 
-		default: return 37; // Foreground white
+			editorScanChunk(EDITOR_SCAN_CHUNK);
+		}
 
+		if(E.scan_done)
+			editorRefreshScreen();
 	}
 
-}
+	while((used = editorInputDecode(&key)) == 0){
 
-void editorSelectSyntaxHighlight() {
+		// The rest of a sequence split across reads follows at once, a lone Escape does not
+		if(E.in_head != E.in_tail){
 
-  E.syntax = NULL;
+			if(editorInputFill(EDITOR_ESC_TIMEOUT) == 0){
 
-  if (E.filename == NULL)
-  		return;
+				key = '\x1b';
+				used = 1;
+				break;
+			}
+			continue;
+		}
 
-  char *ext = strrchr(E.filename, '.');
+		// A used up trace cancels whatever asks for more
+		if(E.replay.eof){
 
-  for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+			key = '\x1b';
+			break;
+		}
 
-    struct editorSyntax *s = &HLDB[j];
-    unsigned int i = 0;
+		// Sleep until a key or a resize, waking to redraw as the match index fills in
+		editorInputFill(E.match.query && !E.match.done ? 100 : -1);
 
-    while (s->filematch[i]) {
+		if(E.match.query && editorMatchProgress() != E.match.shown)
+			editorRefreshScreen();
+	}
 
-      int is_ext = (s->filematch[i][0] == '.');
+	E.in_tail += used;
 
-      if ((is_ext && ext && !strcmp(ext, s->filematch[i])) || (!is_ext && strstr(E.filename, s->filematch[i]))) {
+	if(E.headless && !E.replay.eof)
+		E.replay.taken = editorNow();
 
-        E.syntax = s;
-        int filerow;
+	return key;
+}
 
-        for (filerow = 0; filerow < E.numrows; filerow++)
-        	editorUpdateSyntax(&E.row[filerow]);
-        
-        return;
-        
-      }
+int getCursorPosition(int *rows,int *cols){
 
-      i++;
+	char buf[32];
+	unsigned int i = 0; 
 
-    }
 
-  }
 
-}
+	if(write(STDOUT_FILENO, "\x1b[6n",4) != 4)
+		return -1;
 
+	while(i < sizeof(buf) - 1){
 
+		struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
 
-void editorUpdateRow(erow *row){
+		if(poll(&pfd, 1, 100) != 1 || read(STDIN_FILENO, &buf[i],1) != 1)
+			break;
 
-	int tabs = 0;
-	int j;
+		if(buf[i] == 'R')
+			break;
 
-	for(j = 0; j < row->size; j++)
-		if(row->chars[j] == '\t')
-			tabs++;
+		i++;	
 
-	free(row->render);
-	row->render = malloc(row->size + tabs * (EDITOR_TAB_STOP - 1) + 1);
+	}
+	buf[i] = '\0';
+	if (buf[0] != '\x1b' || buf[1] != '[') 
+		return -1;
 
-	int idx = 0;
+  	if (sscanf(&buf[2], "%d;%d", rows, cols) != 2)
+  		return -1;
 
-	for(j = 0; j < row->size; j++){
+  	return 0;
+}
 
-		if(row->chars[j] == '\t'){
+// Utility function to get size of window
+int getWindowSize(int *rows, int *cols){
+	struct winsize ws;
 
-			row->render[idx++] = ' ';
-			while(idx % EDITOR_TAB_STOP != 0)
-				row->render[idx++] = ' ';
-		}
-		else
-			row->render[idx++] = row->chars[j];
-	}
+	// ioctl syscall 
+	if(ioctl(STDOUT_FILENO,TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0){
 
-	row->render[idx] = '\0';
-	row->rsize = idx;
+		// Escape sequence to send cursor move to right and then down (999 px)
+		if(write(STDOUT_FILENO, "\x1b[999C\xb[999B",12) != 12)
+			return -1;
 
-	editorUpdateSyntax(row);
+		return getCursorPosition(rows,cols);
+	}
+	else{
 
+		*cols = ws.ws_col;
+		*rows = ws.ws_row;
+		return 0;
+	}
 }
 
+// Row buffer memory
 
-void editorRowDelChar(erow *row, int at) {
+// Map 'size' bytes at a chunk boundary
+rowChunk *rowChunkMap(int kind, size_t size){
 
-  if (at < 0 || at >= row->size)
-  		return;
+	size_t page = sysconf(_SC_PAGESIZE);
 
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+	// Sizes near the top of the address space would wrap round below
+	if(size > SIZE_MAX - page - ROWMEM_CHUNK){
 
-  row->size--;
+		errno = ENOMEM;
+		die("mmap");
+	}
 
-  editorUpdateRow(row);
+	// Mapped with a chunk to spare, then the ends are cut to align it
+	size = (size + page - 1) & ~(page - 1);
 
-  E.dirty++;
-}
+	char *p = mmap(NULL, size + ROWMEM_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-// Function renaming
-void editorInsertRow(int at, char *s, size_t len){
+	if(p == MAP_FAILED)
+		die("mmap");
 
-	// Adding enter key functionality
+	char *start = (char *)(((uintptr_t)p + ROWMEM_CHUNK - 1) & ~(uintptr_t)(ROWMEM_CHUNK - 1));
 
-	if(at < 0 || at >  E.numrows)
-		return;
+	if(start > p)
+		munmap(p, start - p);
 
-	E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-	memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+	munmap(start + size, ROWMEM_CHUNK - (start - p));
 
-	E.row[at].idx = at;
+	rowChunk *c = (rowChunk *)start;
 
-	E.row[at].size = len;
-	E.row[at].chars = malloc(len + 1);
-	memcpy(E.row[at].chars, s, len);
-	
-	E.row[at].chars[len] = '\0';
-	E.row[at].rsize = 0;
-	E.row[at].render = NULL;
-	E.row[at].hl = NULL;
-	E.row[at].hl_open_comment = 0;
+	c->kind = kind;
+	c->cls = 0;
+	c->live = 0;
+	c->size = size;
+	c->free = NULL;
+	c->bump = start + ROWMEM_HEADER;
+	c->prev = c->next = NULL;
 
-	editorUpdateRow(&E.row[at]);
+	E.mem.chunks[kind]++;
+	E.mem.mapped += size;
 
-	E.numrows++;
-	E.dirty++;
+	return c;
 }
 
-void editorFreeRow(erow *row){
+void rowChunkUnmap(rowChunk *c){
 
-	free(row->render);
-	free(row->chars);
-	free(row->hl);
+	E.mem.chunks[c->kind]--;
+	E.mem.mapped -= c->size;
+	munmap(c, c->size);
 }
 
-void editorDelRow(int at){
+rowChunk *rowMemChunk(void *p){
 
-	if(at < 0 || at >= E.numrows)
-		return;
+	return (rowChunk *)((uintptr_t)p & ~(uintptr_t)(ROWMEM_CHUNK - 1));
+}
 
-	editorFreeRow(&E.row[at]);
-	memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
+// Size class for 'n' bytes, ROWMEM_CLASSES if too large for a slab
+int rowMemClass(size_t n){
 
-	for(int j = at; j < E.numrows - 1; j++)
-		E.row[j].idx--;
+	int cls = 0;
 
-	E.numrows--;
-	E.dirty++;
+	while(cls < ROWMEM_CLASSES && ((size_t)16 << cls) < n)
+		cls++;
 
+	return cls;
 }
 
-void editorOpen(char *filename){
+// Bytes the buffer at 'p' can hold
+size_t rowMemCapacity(void *p){
 
-	free(E.filename);
-	E.filename = strdup(filename);
+	rowChunk *c = rowMemChunk(p);
 
-	// Enable syntax highlighting
-	editorSelectSyntaxHighlight();
+	if(c->kind == ROWMEM_SLAB)
+		return (size_t)16 << c->cls;
 
-	FILE *fp = fopen(filename, "r");
-	if(!fp) 
-		die("fopen");
+	if(c->kind == ROWMEM_LARGE)
+		return c->size - ROWMEM_HEADER;
 
-	char *line = NULL;
-	size_t linecap = 0;
-	ssize_t linelen;
+	return 0; // Arena buffers are as long as their line, never more
+}
 
-	// File reader read multiple lines
+// Whether a slab has a buffer left to hand out
+int rowMemRoom(rowChunk *c){
 
-	while((linelen = getline(&line, &linecap, fp)) != -1){
+	return c->free || c->bump + ((size_t)16 << c->cls) <= (char *)c + ROWMEM_CHUNK;
+}
 
-			// Strip carriage return and newline characters
-			while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-				linelen--;
+void rowMemLink(rowChunk *c){
 
-			editorInsertRow(E.numrows, line, linelen);
-	}
+	c->prev = NULL;
+	c->next = E.mem.partial[c->cls];
 
-	free(line);
-	fclose(fp);
-	E.dirty = 0; // Prevent from showing "modified" when file is opened initially
+	if(c->next)
+		c->next->prev = c;
 
+	E.mem.partial[c->cls] = c;
 }
 
-// Save to rows to disk 
-char* editorRowsToString(int *buflen){
+void rowMemUnlink(rowChunk *c){
 
-	int totlen = 0;
-	int j;
+	if(c->prev)
+		c->prev->next = c->next;
+	else
+		E.mem.partial[c->cls] = c->next;
 
-	for(j = 0; j < E.numrows; j++)
-		totlen += E.row[j].size + 1;
+	if(c->next)
+		c->next->prev = c->prev;
 
-	*buflen = totlen;
+	c->prev = c->next = NULL;
+}
 
-	char *buf = malloc(totlen);
-	char *p = buf;
+void *rowMemAlloc(size_t n){
 
-	for(j = 0; j < E.numrows; j++){
+	int cls = rowMemClass(n);
+	char *p;
 
-		memcpy(p, E.row[j].chars, E.row[j].size);
-		p += E.row[j].size;
-		*p = '\n';
-		p++;
-	}
+	E.mem.buffers++;
 
-	return buf;
+	if(cls == ROWMEM_CLASSES){
 
-}
+		rowChunk *c = rowChunkMap(ROWMEM_LARGE, ROWMEM_HEADER + n);
 
+		c->live = 1;
+		return (char *)c + ROWMEM_HEADER;
+	}
 
-// Write to disk 
-void editorSave(){
+	rowChunk *c = E.mem.partial[cls];
 
+	if(c == NULL){
 
-	if(E.filename == NULL){
+		c = rowChunkMap(ROWMEM_SLAB, ROWMEM_CHUNK);
+		c->cls = cls;
+		rowMemLink(c);
+	}
 
-		E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-		// Activate if user presses ESC
-		if(E.filename == NULL){
+	if(c->free){
 
-			editorSetStatusMessage("Save aborted");
-			return;
-		}
-		editorSelectSyntaxHighlight();
+		p = c->free;
+		memcpy(&c->free, p, sizeof(char *));
 	}
+	else{
 
+		p = c->bump;
+		c->bump += (size_t)16 << cls;
+	}
 
-	int len; 
-	char *buf = editorRowsToString(&len);
-
-	int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+	c->live++;
 
-	// Error handling 
-	if(fd != -1){
-		if(ftruncate(fd,len) != -1){
-			if(write(fd, buf, len) == len){
-				close(fd);
-				free(buf);
-				E.dirty = 0;
-				editorSetStatusMessage("%d bytes written to disk",len);
-				return;
-			}
-		
-		}
+	// A full slab leaves the list until a buffer in it is freed
+	if(!rowMemRoom(c))
+		rowMemUnlink(c);
 
-		close(fd);
-	}
+	return p;
+}
 
-	free(buf);
-	editorSetStatusMessage("Cannot save! I/O error: %s", strerror(errno));
+void rowMemFree(void *p){
 
-}
-// Save as prompt when new file is created 
-char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+	if(p == NULL)
+		return;
 
-  size_t bufsize = 128;
-  char *buf = malloc(bufsize);
-  size_t buflen = 0;
-  buf[0] = '\0';
+	rowChunk *c = rowMemChunk(p);
 
-  while (1) {
+	E.mem.buffers--;
+	c->live--;
 
-    editorSetStatusMessage(prompt, buf);
-    editorRefreshScreen();
+	if(c->kind == ROWMEM_LARGE){
 
-    int c = editorReadKey();
+		rowChunkUnmap(c);
+		return;
+	}
 
+	if(c->kind == ROWMEM_ARENA){
 
-    if(c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE){
+		if(c->live == 0 && c != E.mem.arena)
+			rowChunkUnmap(c);
+		return;
+	}
 
-    	if(buflen != 0)
-    		buf[--buflen] = '\0';
-    }
-    // ESC key to cancel Save As
-    else if(c == '\x1b'){
+	int had_room = rowMemRoom(c);
 
-    	editorSetStatusMessage("");
+	memcpy(p, &c->free, sizeof(char *));
+	c->free = p;
 
-    	if (callback)
-    		callback(buf, c);
+	if(!had_room)
+		rowMemLink(c);
 
-    	free(buf);
-    	return NULL;
+	// An empty slab is unmapped unless it is the last of its class with room
+	if(c->live == 0 && (c->prev || c->next)){
 
-    }
-    else if (c == '\r') {
+		rowMemUnlink(c);
+		rowChunkUnmap(c);
+	}
+}
 
-      if (buflen != 0) {
+// Unmap the chunks kept for reuse, once every buffer in them is freed
+void rowMemRelease(){
 
-        editorSetStatusMessage("");
+	int cls;
 
-        if (callback)
-        	callback(buf, c);
-        
-        return buf;
+	for(cls = 0; cls < ROWMEM_CLASSES; cls++){
 
-      }
+		while(E.mem.partial[cls]){
 
-    } 
-    else if (!iscntrl(c) && c < 128) {
+			rowChunk *c = E.mem.partial[cls];
 
-      if (buflen == bufsize - 1) {
+			rowMemUnlink(c);
+			rowChunkUnmap(c);
+		}
+	}
 
-        bufsize *= 2;
-        buf = realloc(buf, bufsize);
+	if(E.mem.arena)
+		rowChunkUnmap(E.mem.arena);
 
-      }
-      buf[buflen++] = c;
-      buf[buflen] = '\0';
+	E.mem.arena = NULL;
+}
 
-    }
+/*
+	Make the buffer at 'p', of which 'used' bytes are kept, hold 'n'
+	bytes. Slab sizes double, so a row typed a character at a time only
+	moves when it outgrows its class.
+*/
+void *rowMemResize(void *p, size_t used, size_t n){
 
-    if (callback)
-    	callback(buf, c);
+	if(p && rowMemCapacity(p) >= n)
+		return p;
 
-  }
+	// Large buffers double too
+	size_t want = n;
 
-}
-void editorRowInsertChar(erow *row, int at, int c){
+	if(n > ((size_t)16 << (ROWMEM_CLASSES - 1)) && p && rowMemCapacity(p) * 2 > n)
+		want = rowMemCapacity(p) * 2;
 
-	if(at < 0 || at > row->size)
-		at = row->size;
+	char *q = rowMemAlloc(want);
 
-	row->chars = realloc(row->chars,row->size + 2);
-	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-	row->size++;
-	row->chars[at] = c;
+	if(p){
 
-	editorUpdateRow(row);
-	E.dirty++;
+		memcpy(q, p, used);
+		rowMemFree(p);
+	}
 
+	return q;
 }
 
-// Handles Enter Keystrokes
-void editorInsertNewline(){
+// A buffer of 'n' bytes for a line loaded from the file, cut from the arena
+char *rowMemArena(size_t n){
 
-	if(E.cx == 0)
-		editorInsertRow(E.cy, "", 0);
+	rowChunk *c = E.mem.arena;
 
-	else{
+	if(n > ROWMEM_ARENA_MAX)
+		return rowMemAlloc(n);
 
-		erow *row = &E.row[E.cy];
-		editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-		row = &E.row[E.cy];
-		row->size = E.cx;
-		row->chars[row->size] = '\0';
-		editorUpdateRow(row);
+	if(c == NULL || c->bump + n > (char *)c + ROWMEM_CHUNK){
 
+		// The old arena goes once its last line does
+		if(c && c->live == 0)
+			rowChunkUnmap(c);
+
+		c = E.mem.arena = rowChunkMap(ROWMEM_ARENA, ROWMEM_CHUNK);
 	}
-	E.cy++;
-	E.cx = 0;
-}
 
-void editorRowAppendString(erow *row, char *s, size_t len){
+	char *p = c->bump;
 
-	row->chars = realloc(row->chars, row->size + len + 1);
-	memcpy(&row->chars[row->size], s, len);
-	row->size += len;
-	row->chars[row->size] = '\0';
-	editorUpdateRow(row);
-	E.dirty++;
+	c->bump += n;
+	c->live++;
+	E.mem.buffers++;
 
+	return p;
 }
 
+// Row storage
 
-void editorDelChar(){
-
-	if(E.cy == E.numrows)
-		return;
-
-	if(E.cx == 0 && E.cy == 0)
-		return;
+rowNode *rowNodeNew(int kind){
 
-	erow * row = &E.row[E.cy];
+	size_t size = sizeof(rowInner);
 
-	if(E.cx > 0){
-		
-		editorRowDelChar(row, E.cx - 1);
-		E.cx--;
+	if(kind == ROW_LEAF)
+		size = sizeof(rowLeaf);
+	else if(kind == ROW_LAZY)
+		size = sizeof(rowLazy);
 
-	}
-	else{
+	rowNode *node = calloc(1, size);
 
-		E.cx = E.row[E.cy - 1].size;
-		editorRowAppendString(&E.row[E.cy - 1],row->chars, row->size);
-		editorDelRow(E.cy);	
-		E.cy--;
+	if(node == NULL)
+		die("calloc");
 
-	}
-	
+	node->kind = kind;
+	return node;
 }
 
-void editorInsertChar(int c){
+// Position of a node among its parent's children
+int rowNodeIndex(rowNode *node){
 
-	// Cursor on tilde line after end of file
-	if(E.cy == E.numrows)
-		editorInsertRow(E.numrows, "", 0);
+	rowInner *p = (rowInner *)node->parent;
+	int i = 0;
 
-	editorRowInsertChar(&E.row[E.cy], E.cx, c);
-	E.cx++;
+	while(p->child[i] != node)
+		i++;
 
+	return i;
 }
-// Append buffer to limit write() syscalls
-struct abuf{
 
-	char *b;
-	int len;
+// Put 'node' where 'old' was in the tree
+void rowNodeReplace(rowNode *old, rowNode *node){
 
-};
+	node->parent = old->parent;
 
-void abAppend(struct abuf *ab, const char *s,int len){
+	if(old->parent)
+		((rowInner *)old->parent)->child[rowNodeIndex(old)] = node;
+	else
+		E.rows = node;
+}
 
-	char *new = realloc(ab->b, ab->len + len);
+// Set up 'row' with a copy of s in 'buf', which has room for it and a NUL
+void editorFillRow(erow *row, char *buf, char *s, size_t len){
 
-	if(new == NULL)
-		return;
+	row->size = len;
+	row->chars = buf;
+	memcpy(row->chars, s, len);
+	
+	row->chars[len] = '\0';
+	row->rsize = 0;
+	row->cache = NULL;
+	row->hl_open_comment = 0;
+	row->hl_start = HL_STATE_STALE;
+	row->flags = 0;
+	row->segs = 0;
+}
 
-	memcpy(&new[ab->len],s,len);
+void editorInitRow(erow *row, char *s, size_t len){
 
-	ab->b = new;
-	ab->len += len;
+	editorFillRow(row, rowMemAlloc(len + 1), s, len);
 }
 
-void abFree(struct abuf *ab){
-
-	// Free allocated buffer
-	free(ab->b);
+// Screen lines a row adds past its first when wrapped
+long rowWraps(erow *row){
 
+	return row->segs > 1 ? row->segs - 1 : 0;
 }
 
-int editorRowCxToRx(erow *row, int cx){
+// Length of the mapped line at 'p', *next receives the start of the line after it
+size_t editorMapLine(char *p, char *end, char **next){
 
-	int rx = 0;
-	int j;
+	char *nl = memchr(p, '\n', end - p);
+	size_t linelen = (nl ? nl : end) - p;
 
-	for(j = 0; j < cx; j++){
+	// Strip carriage return like the line by line reader does
+	while(linelen > 0 && p[linelen - 1] == '\r')
+		linelen--;
 
-		if(row->chars[j] == '\t')
-			rx += (EDITOR_TAB_STOP - 1) - (rx % EDITOR_TAB_STOP);
+	*next = nl ? nl + 1 : end;
+	return linelen;
+}
 
-		rx++;
-	}
+// Turn a lazy node into a leaf by copying its lines out of the mapping
+rowLeaf *rowLazyLoad(rowLazy *lz, long base){
 
-	return rx;
-}
+	rowLeaf *leaf = (rowLeaf *)rowNodeNew(ROW_LEAF);
+	char *p = E.map + lz->start;
+	char *end = E.map + lz->end;
+	int state = lz->hl_start;
+	int j;
 
-//  Convert the render index into a chars index
-int editorRowRxToCx(erow *row, int rx) {
+	for(j = 0; j < lz->h.n; j++){
 
-  int cur_rx = 0;
+		erow *row = &leaf->rows[j];
+		char *line = p;
+		size_t linelen = editorMapLine(line, end, &p);
 
-  int cx;
+		editorFillRow(row, rowMemArena(linelen + 1), line, linelen);
 
-  for (cx = 0; cx < row->size; cx++) {
+		// Rows inherit the checkpoint so the lines need not be scanned again
+		if(state != HL_STATE_STALE){
 
-    if (row->chars[cx] == '\t')
-      cur_rx += (EDITOR_TAB_STOP - 1) - (cur_rx % EDITOR_TAB_STOP);
+			row->hl_start = state;
+			state = row->hl_open_comment = editorSyntaxScan(row->chars, row->size, NULL, state);
+		}
+	}
 
-    cur_rx++;
+	leaf->h.n = leaf->h.count = lz->h.n;
+	leaf->h.bytes = lz->h.bytes;
+	rowNodeReplace(&lz->h, &leaf->h);
+	free(lz);
 
-    if (cur_rx > rx)
-    	return cx;
+	E.rowcache = leaf;
+	E.rowcache_base = base;
 
-  }
-  return cx;
+	return leaf;
 }
 
-// Incremental search 
-void editorFindCallback(char *query, int key){
+/*
+	Walk down to the leaf level node holding row 'at', *slot receives its
+	position in the node and *base the line number of its first row.
+*/
+rowNode *rowTreeFind(long at, int *slot, long *base){
 
+	rowLeaf *leaf = E.rowcache;
 
- // Searching in forward and backward direction
-	static int last_match = - 1;
-	static int direction = 1;
+	if(leaf && at >= E.rowcache_base && at < E.rowcache_base + leaf->h.n){
 
+		*slot = at - E.rowcache_base;
+		*base = E.rowcache_base;
+		return &leaf->h;
+	}
+
+	rowNode *node = E.rows;
+	*base = 0;
 
-	// Restore syntax highlighting after search
-	static int saved_hl_line;
-	static char *saved_hl = NULL;
+	while(node->kind == ROW_INNER){
 
-	if(saved_hl){
+		rowInner *in = (rowInner *)node;
+		int i;
 
-		memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-		free(saved_hl);
-		saved_hl = NULL;
+		for(i = 0; i < node->n - 1 && at >= in->child[i]->count; i++){
 
+			at -= in->child[i]->count;
+			*base += in->child[i]->count;
+		}
+		node = in->child[i];
 	}
 
-	if (key == '\r' || key == '\x1b'){
+	if(node->kind == ROW_LEAF){
 
-		last_match = -1;
-		direction = 1;
-    	return;
+		E.rowcache = (rowLeaf *)node;
+		E.rowcache_base = *base;
+	}
+
+	*slot = at;
+	return node;
+}
+
+// Leaf holding row 'at', loading it from the file if needed
+rowLeaf *rowTreeLeaf(long at, int *slot){
+
+	long base;
+	rowNode *node = rowTreeFind(at, slot, &base);
+
+	if(node->kind == ROW_LAZY)
+		return rowLazyLoad((rowLazy *)node, base);
+
+	return (rowLeaf *)node;
+}
+
+erow *editorRowAt(long at){
+
+	if(at < 0 || at >= E.rows->count)
+		return NULL;
+
+	int slot;
+	rowLeaf *leaf = rowTreeLeaf(at, &slot);
+
+	return &leaf->rows[slot];
+}
+
+// Like editorRowAt, but returns NULL instead of loading rows from the file
+erow *editorRowPeek(long at){
+
+	if(at < 0 || at >= E.rows->count)
+		return NULL;
+
+	int slot;
+	long base;
+	rowNode *node = rowTreeFind(at, &slot, &base);
+
+	if(node->kind == ROW_LAZY)
+		return NULL;
+
+	return &((rowLeaf *)node)->rows[slot];
+}
+
+// Byte offset of row 'at' in the text as saved, the total past the last row
+off_t rowTreeOffset(long at){
+
+	rowNode *node = E.rows;
+	off_t off = 0;
+	int j;
+
+	if(at >= node->count)
+		return node->bytes;
+
+	while(node->kind == ROW_INNER){
+
+		rowInner *in = (rowInner *)node;
+
+		for(j = 0; j < node->n - 1 && at >= in->child[j]->count; j++){
+
+			at -= in->child[j]->count;
+			off += in->child[j]->bytes;
+		}
+		node = in->child[j];
 	}
-	else if(key == ARROW_RIGHT || key == ARROW_DOWN)
-		direction = 1;
 
-	else if(key == ARROW_LEFT  || key == ARROW_UP)
-		direction = -1;
+	if(node->kind == ROW_LAZY){
+
+		rowLazy *lz = (rowLazy *)node;
+		char *p = E.map + lz->start;
 
+		for(j = 0; j < at; j++)
+			off += editorMapLine(p, E.map + lz->end, &p) + 1;
+	}
 	else{
 
-		last_match = -1;
-		direction =  1;
+		for(j = 0; j < at; j++)
+			off += ((rowLeaf *)node)->rows[j].size + 1;
 	}
 
-	if(last_match == -1)
-		direction = 1;
+	return off;
+}
+
+/*
+	Row holding byte 'off' of the text as saved, *col receives its column
+	there. Offsets past the end give the end of the last row.
+*/
+long rowTreeLine(off_t off, long *col){
 
-	int current = last_match;
-	int i;
+	rowNode *node = E.rows;
+	long row = 0, size = 0;
+	int j;
+
+	*col = 0;
+
+	if(node->count == 0)
+		return 0;
+
+	while(node->kind == ROW_INNER){
+
+		rowInner *in = (rowInner *)node;
+
+		for(j = 0; j < node->n - 1 && off >= in->child[j]->bytes; j++){
+
+			off -= in->child[j]->bytes;
+			row += in->child[j]->count;
+		}
+		node = in->child[j];
+	}
+
+	if(node->kind == ROW_LAZY){
+
+		rowLazy *lz = (rowLazy *)node;
+		char *p = E.map + lz->start;
+
+		for(j = 0; j < node->n; j++){
+
+			char *end = E.map + lz->end;
+
+			// The last line runs to the end of the node, a long line is always the last
+			if(j == node->n - 1){
+
+				char *q = (end > p && end[-1] == '\n') ? end - 1 : end;
+
+				while(q > p && q[-1] == '\r')
+					q--;
+
+				size = q - p;
+				break;
+			}
+
+			size = editorMapLine(p, end, &p);
 
-	for (i = 0; i < E.numrows; i++) {
+			if(off <= size)
+				break;
 
-		current += direction;
-		if(current == -1)
-			current = E.numrows - 1;
+			off -= size + 1;
+		}
+	}
+	else{
+
+		for(j = 0; j < node->n; j++){
+
+			size = ((rowLeaf *)node)->rows[j].size;
+
+			if(off <= size || j == node->n - 1)
+				break;
+
+			off -= size + 1;
+		}
+	}
+
+	*col = off < size ? off : size;
+	return row + j;
+}
+
+// Screen line of row 'at' when long lines wrap, the total past the last row
+long rowTreeWrapLine(long at){
 
-		else if(current == E.numrows)
-			current = 0;
+	rowNode *node = E.rows;
+	long line = 0;
+	int j;
+
+	if(at >= node->count)
+		return node->count + node->wraps;
 
-	    erow *row = &E.row[current];
-	    char *match = strstr(row->render, query);
+	while(node->kind == ROW_INNER){
 
-	    if (match) {
+		rowInner *in = (rowInner *)node;
 
-	      last_match = current;
-	      E.cy = current;
-	      E.cx = editorRowRxToCx(row, match - row->render);
-	      E.rowoff = E.numrows;
+		for(j = 0; j < node->n - 1 && at >= in->child[j]->count; j++){
+
+			at -= in->child[j]->count;
+			line += in->child[j]->count + in->child[j]->wraps;
+		}
+		node = in->child[j];
+	}
 
-	      saved_hl_line = current;
-	      
-	      saved_hl = malloc(row->rsize);
-	      memcpy(saved_hl, row->hl, row->rsize);
-	      memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-	      break;
+	// Rows of a lazy node are not laid out, a line each
+	line += at;
 
-	    }
+	if(node->kind == ROW_LEAF){
 
-	}	
+		for(j = 0; j < at; j++)
+			line += rowWraps(&((rowLeaf *)node)->rows[j]);
+	}
 
+	return line;
 }
-// Search utility function
-void editorFind(){
 
-// Restore cursor position when search is cancelled
+/*
+	Row holding screen line 'line' when long lines wrap, *seg receives
+	which of its lines it is. Lines past the last row give the row count,
+	and how far past it they are.
+*/
+long rowTreeWrapRow(long line, long *seg){
+
+	rowNode *node = E.rows;
+	long row = 0;
+	int j;
+
+	*seg = 0;
+
+	if(line >= node->count + node->wraps){
+
+		*seg = line - node->count - node->wraps;
+		return node->count;
+	}
+
+	while(node->kind == ROW_INNER){
+
+		rowInner *in = (rowInner *)node;
+
+		for(j = 0; j < node->n - 1 && line >= in->child[j]->count + in->child[j]->wraps; j++){
+
+			line -= in->child[j]->count + in->child[j]->wraps;
+			row += in->child[j]->count;
+		}
+		node = in->child[j];
+	}
+
+	if(node->kind == ROW_LAZY)
+		return row + line;
+
+	for(j = 0; j < node->n - 1; j++){
+
+		long lines = 1 + rowWraps(&((rowLeaf *)node)->rows[j]);
+
+		if(line < lines)
+			break;
+
+		line -= lines;
+	}
+
+	*seg = line;
+	return row + j;
+}
+
+void rowNodeAdjust(rowNode *node, long rows, off_t bytes){
+
+	for(; node; node = node->parent){
+
+		node->count += rows;
+		node->bytes += bytes;
+	}
+}
+
+void rowNodeWraps(rowNode *node, long lines){
+
+	for(; node; node = node->parent)
+		node->wraps += lines;
+}
+
+// Forget the layout of the rows of a leaf, they are laid out again for 'cols' as needed
+void rowLeafUnwrap(rowLeaf *leaf, int cols){
+
+	int j;
+
+	rowNodeWraps(&leaf->h, -leaf->h.wraps);
+
+	for(j = 0; j < leaf->h.n; j++)
+		leaf->rows[j].segs = 0;
+
+	leaf->wrap_cols = cols;
+}
+
+// Row 'at' grew by 'delta' bytes, or shrank
+void rowTreeResize(long at, long delta){
+
+	int slot;
+	long base;
+
+	rowNodeAdjust(rowTreeFind(at, &slot, &base), 0, delta);
+}
+
+// Link 'right' in as the next sibling of 'left', splitting full parents on the way up
+void rowNodeAttach(rowNode *left, rowNode *right){
+
+	rowInner *p = (rowInner *)left->parent;
+
+	if(p == NULL){
+
+		p = (rowInner *)rowNodeNew(ROW_INNER);
+		p->h.n = 1;
+		p->h.count = left->count + right->count;
+		p->h.bytes = left->bytes + right->bytes;
+		p->h.wraps = left->wraps + right->wraps;
+		p->child[0] = left;
+		left->parent = &p->h;
+		E.rows = &p->h;
+	}
+
+	int i = rowNodeIndex(left);
+
+	memmove(&p->child[i + 2], &p->child[i + 1], sizeof(rowNode *) * (p->h.n - i - 1));
+	p->child[i + 1] = right;
+	right->parent = &p->h;
+	p->h.n++;
+
+	if(p->h.n > ROW_NODE_MAX){
+
+		rowInner *q = (rowInner *)rowNodeNew(ROW_INNER);
+		int half = p->h.n / 2;
+		int j;
+
+		q->h.n = p->h.n - half;
+		memcpy(q->child, &p->child[half], sizeof(rowNode *) * q->h.n);
+
+		for(j = 0; j < q->h.n; j++){
+
+			q->child[j]->parent = &q->h;
+			q->h.count += q->child[j]->count;
+			q->h.bytes += q->child[j]->bytes;
+			q->h.wraps += q->child[j]->wraps;
+		}
+
+		p->h.n = half;
+		p->h.count -= q->h.count;
+		p->h.bytes -= q->h.bytes;
+		p->h.wraps -= q->h.wraps;
+		rowNodeAttach(&p->h, &q->h);
+	}
+}
+
+// Add a leaf level node after the last row of the tree
+void rowTreeAppend(rowNode *node){
+
+	rowNode *last = E.rows;
+
+	// An empty root leaf is simply replaced
+	if(last->kind == ROW_LEAF && last->count == 0){
+
+		free(last);
+		E.rows = node;
+		E.rowcache = NULL;
+		return;
+	}
+
+	while(last->kind == ROW_INNER)
+		last = ((rowInner *)last)->child[last->n - 1];
+
+	if(last->parent){
+
+		rowNodeAdjust(last->parent, node->count, node->bytes);
+		rowNodeWraps(last->parent, node->wraps);
+	}
+
+	rowNodeAttach(last, node);
+}
+
+// Unlink a node from its parent and free it, dropping parents left empty
+void rowNodeRemove(rowNode *node){
+
+	rowInner *p = (rowInner *)node->parent;
+	int i = rowNodeIndex(node);
+
+	memmove(&p->child[i], &p->child[i + 1], sizeof(rowNode *) * (p->h.n - i - 1));
+	p->h.n--;
+	free(node);
+
+	if(p->h.n == 0)
+		rowNodeRemove(&p->h);
+
+	// A root with a single child is just a taller tree
+	while(E.rows->kind == ROW_INNER && E.rows->n == 1){
+
+		rowNode *root = ((rowInner *)E.rows)->child[0];
+		free(E.rows);
+		root->parent = NULL;
+		E.rows = root;
+	}
+}
+
+// Make room for a row of 'size' bytes at 'at' and return the uninitialized slot
+erow *rowTreeInsert(long at, long size){
+
+	int slot, j;
+	rowLeaf *leaf = rowTreeLeaf(at, &slot);
+
+	if(leaf->h.n == ROW_LEAF_MAX){
+
+		rowLeaf *right = (rowLeaf *)rowNodeNew(ROW_LEAF);
+		int half = leaf->h.n / 2;
+
+		right->h.n = right->h.count = leaf->h.n - half;
+		memcpy(right->rows, &leaf->rows[half], sizeof(erow) * right->h.n);
+		leaf->h.n = leaf->h.count = half;
+
+		for(j = 0; j < right->h.n; j++){
+
+			right->h.bytes += right->rows[j].size + 1;
+			right->h.wraps += rowWraps(&right->rows[j]);
+		}
+
+		leaf->h.bytes -= right->h.bytes;
+		leaf->h.wraps -= right->h.wraps;
+		right->wrap_cols = leaf->wrap_cols;
+
+		rowNodeAttach(&leaf->h, &right->h);
+
+		if(slot > half){
+
+			slot -= half;
+			leaf = right;
+		}
+	}
+
+	memmove(&leaf->rows[slot + 1], &leaf->rows[slot], sizeof(erow) * (leaf->h.n - slot));
+	leaf->h.n++;
+	rowNodeAdjust(&leaf->h, 1, size + 1);
+
+	E.rowcache = NULL;
+	return &leaf->rows[slot];
+}
+
+// Drop the row at 'at' from the tree, the caller frees its contents
+void rowTreeDelete(long at){
+
+	int slot;
+	rowLeaf *leaf = rowTreeLeaf(at, &slot);
+	off_t bytes = leaf->rows[slot].size + 1;
+
+	rowNodeWraps(&leaf->h, -rowWraps(&leaf->rows[slot]));
+	memmove(&leaf->rows[slot], &leaf->rows[slot + 1], sizeof(erow) * (leaf->h.n - slot - 1));
+	leaf->h.n--;
+	rowNodeAdjust(&leaf->h, -1, -bytes);
+
+	E.rowcache = NULL;
+
+	// Fold underfull leaves into a neighbour so the tree stays shallow
+	rowInner *p = (rowInner *)leaf->h.parent;
+
+	if(p == NULL || leaf->h.n >= ROW_LEAF_MAX / 4)
+		return;
+
+	int i = rowNodeIndex(&leaf->h);
+	rowLeaf *prev = (i > 0) ? (rowLeaf *)p->child[i - 1] : NULL;
+	rowLeaf *next = (i + 1 < p->h.n) ? (rowLeaf *)p->child[i + 1] : NULL;
+
+	// Rows laid out for another width than the neighbour's are laid out again
+	if(prev && prev->h.kind == ROW_LEAF && prev->h.n + leaf->h.n <= ROW_LEAF_MAX){
+
+		if(prev->wrap_cols != leaf->wrap_cols)
+			rowLeafUnwrap(leaf, prev->wrap_cols);
+
+		memcpy(&prev->rows[prev->h.n], leaf->rows, sizeof(erow) * leaf->h.n);
+		prev->h.n += leaf->h.n;
+		prev->h.count += leaf->h.n;
+		prev->h.bytes += leaf->h.bytes;
+		prev->h.wraps += leaf->h.wraps;
+	}
+	else if(next && next->h.kind == ROW_LEAF && next->h.n + leaf->h.n <= ROW_LEAF_MAX){
+
+		if(next->wrap_cols != leaf->wrap_cols)
+			rowLeafUnwrap(leaf, next->wrap_cols);
+
+		memmove(&next->rows[leaf->h.n], next->rows, sizeof(erow) * next->h.n);
+		memcpy(next->rows, leaf->rows, sizeof(erow) * leaf->h.n);
+		next->h.n += leaf->h.n;
+		next->h.count += leaf->h.n;
+		next->h.bytes += leaf->h.bytes;
+		next->h.wraps += leaf->h.wraps;
+	}
+	else if(leaf->h.n > 0)
+		return;
+
+	rowNodeRemove(&leaf->h);
+}
+
+// Hand the lines scanned so far to a new lazy node
+void editorScanFlush(){
+
+	if(E.scan_lines == 0)
+		return;
+
+	rowLazy *lz = (rowLazy *)rowNodeNew(ROW_LAZY);
+
+	lz->h.n = lz->h.count = E.scan_lines;
+	lz->h.bytes = E.scan_bytes;
+	lz->start = E.scan_start;
+	lz->end = E.scan_off;
+	lz->hl_start = lz->hl_end = HL_STATE_STALE;
+	rowTreeAppend(&lz->h);
+
+	E.numrows += E.scan_lines;
+	E.hl_dirty_end = E.numrows;
+	E.scan_start = E.scan_off;
+	E.scan_lines = 0;
+	E.scan_bytes = 0;
+}
+
+// Carriage returns editorMapLine strips from the line ending at 'p'
+off_t editorScanStripped(char *p){
+
+	char *q = p;
+
+	while(q > E.map && q[-1] == '\r')
+		q--;
+
+	return p - q;
+}
+
+// Index up to 'bytes' more of the mapped file
+void editorScanChunk(off_t bytes){
+
+	off_t limit = E.scan_off + bytes;
+
+	if(limit > E.maplen)
+		limit = E.maplen;
+
+	while(E.scan_off < limit){
+
+		char *p = E.map + E.scan_off;
+		char *nl = memchr(p, '\n', limit - E.scan_off);
+
+		if(nl == NULL){
+
+			E.scan_bytes += limit - E.scan_off;
+			E.scan_off = limit;
+			break;
+		}
+
+		E.scan_off += nl - p + 1;
+		E.scan_bytes += nl - p + 1 - editorScanStripped(nl);
+
+		// Lines in a lazy node are found by walking it, long lines end one early
+		if(++E.scan_lines == ROW_LEAF_MAX || E.scan_off - E.scan_start >= EDITOR_SCAN_CHUNK)
+			editorScanFlush();
+	}
+
+	if(E.scan_off == E.maplen){
+
+		// Last line without a trailing newline, saved with one
+		if(E.map[E.maplen - 1] != '\n'){
+
+			E.scan_lines++;
+			E.scan_bytes += 1 - editorScanStripped(E.map + E.maplen);
+		}
+
+		editorScanFlush();
+		E.scan_done = 1;
+	}
+}
+
+// Make sure rows up to 'line' are known, or the whole file is
+void editorScanTo(long line){
+
+	while(!E.scan_done && E.numrows <= line)
+		editorScanChunk(EDITOR_SCAN_CHUNK);
+}
+
+// Make sure rows up to byte 'off' of the text are known, or the whole file is
+void editorScanToOffset(off_t off){
+
+	while(!E.scan_done && E.rows->bytes <= off)
+		editorScanChunk(EDITOR_SCAN_CHUNK);
+}
+
+void editorScanFinish(){
+
+	while(!E.scan_done)
+		editorScanChunk(EDITOR_SCAN_CHUNK * 64);
+}
+
+/*
+	UTF-8. Rows are bytes; columns on screen come from decoding them,
+	a character at a time, and looking its width up in a table of the
+	code points that are not one column wide: combining marks and format
+	characters take none, East Asian wide and fullwidth ones take two.
+	Rows found to be all ASCII skip the decoding.
+*/
+struct editorWidthRange {
+
+	uint32_t first;
+	uint32_t last;
+	unsigned char width;
+
+};
+
+// Unicode 14.0, merged over unassigned code points, sorted
+const struct editorWidthRange CHAR_WIDTHS[] = {
+	{0x0300, 0x036f, 0}, {0x0483, 0x0489, 0}, {0x0591, 0x05bd, 0}, {0x05bf, 0x05bf, 0},
+	{0x05c1, 0x05c2, 0}, {0x05c4, 0x05c5, 0}, {0x05c7, 0x05c7, 0}, {0x0600, 0x0605, 0},
+	{0x0610, 0x061a, 0}, {0x061c, 0x061c, 0}, {0x064b, 0x065f, 0}, {0x0670, 0x0670, 0},
+	{0x06d6, 0x06dd, 0}, {0x06df, 0x06e4, 0}, {0x06e7, 0x06e8, 0}, {0x06ea, 0x06ed, 0},
+	{0x070f, 0x070f, 0}, {0x0711, 0x0711, 0}, {0x0730, 0x074a, 0}, {0x07a6, 0x07b0, 0},
+	{0x07eb, 0x07f3, 0}, {0x07fd, 0x07fd, 0}, {0x0816, 0x0819, 0}, {0x081b, 0x0823, 0},
+	{0x0825, 0x0827, 0}, {0x0829, 0x082d, 0}, {0x0859, 0x085b, 0}, {0x0890, 0x089f, 0},
+	{0x08ca, 0x0902, 0}, {0x093a, 0x093a, 0}, {0x093c, 0x093c, 0}, {0x0941, 0x0948, 0},
+	{0x094d, 0x094d, 0}, {0x0951, 0x0957, 0}, {0x0962, 0x0963, 0}, {0x0981, 0x0981, 0},
+	{0x09bc, 0x09bc, 0}, {0x09c1, 0x09c4, 0}, {0x09cd, 0x09cd, 0}, {0x09e2, 0x09e3, 0},
+	{0x09fe, 0x0a02, 0}, {0x0a3c, 0x0a3c, 0}, {0x0a41, 0x0a51, 0}, {0x0a70, 0x0a71, 0},
+	{0x0a75, 0x0a75, 0}, {0x0a81, 0x0a82, 0}, {0x0abc, 0x0abc, 0}, {0x0ac1, 0x0ac8, 0},
+	{0x0acd, 0x0acd, 0}, {0x0ae2, 0x0ae3, 0}, {0x0afa, 0x0b01, 0}, {0x0b3c, 0x0b3c, 0},
+	{0x0b3f, 0x0b3f, 0}, {0x0b41, 0x0b44, 0}, {0x0b4d, 0x0b56, 0}, {0x0b62, 0x0b63, 0},
+	{0x0b82, 0x0b82, 0}, {0x0bc0, 0x0bc0, 0}, {0x0bcd, 0x0bcd, 0}, {0x0c00, 0x0c00, 0},
+	{0x0c04, 0x0c04, 0}, {0x0c3c, 0x0c3c, 0}, {0x0c3e, 0x0c40, 0}, {0x0c46, 0x0c56, 0},
+	{0x0c62, 0x0c63, 0}, {0x0c81, 0x0c81, 0}, {0x0cbc, 0x0cbc, 0}, {0x0cbf, 0x0cbf, 0},
+	{0x0cc6, 0x0cc6, 0}, {0x0ccc, 0x0ccd, 0}, {0x0ce2, 0x0ce3, 0}, {0x0d00, 0x0d01, 0},
+	{0x0d3b, 0x0d3c, 0}, {0x0d41, 0x0d44, 0}, {0x0d4d, 0x0d4d, 0}, {0x0d62, 0x0d63, 0},
+	{0x0d81, 0x0d81, 0}, {0x0dca, 0x0dca, 0}, {0x0dd2, 0x0dd6, 0}, {0x0e31, 0x0e31, 0},
+	{0x0e34, 0x0e3a, 0}, {0x0e47, 0x0e4e, 0}, {0x0eb1, 0x0eb1, 0}, {0x0eb4, 0x0ebc, 0},
+	{0x0ec8, 0x0ecd, 0}, {0x0f18, 0x0f19, 0}, {0x0f35, 0x0f35, 0}, {0x0f37, 0x0f37, 0},
+	{0x0f39, 0x0f39, 0}, {0x0f71, 0x0f7e, 0}, {0x0f80, 0x0f84, 0}, {0x0f86, 0x0f87, 0},
+	{0x0f8d, 0x0fbc, 0}, {0x0fc6, 0x0fc6, 0}, {0x102d, 0x1030, 0}, {0x1032, 0x1037, 0},
+	{0x1039, 0x103a, 0}, {0x103d, 0x103e, 0}, {0x1058, 0x1059, 0}, {0x105e, 0x1060, 0},
+	{0x1071, 0x1074, 0}, {0x1082, 0x1082, 0}, {0x1085, 0x1086, 0}, {0x108d, 0x108d, 0},
+	{0x109d, 0x109d, 0}, {0x1100, 0x115f, 2}, {0x1160, 0x11ff, 0}, {0x135d, 0x135f, 0},
+	{0x1712, 0x1714, 0}, {0x1732, 0x1733, 0}, {0x1752, 0x1753, 0}, {0x1772, 0x1773, 0},
+	{0x17b4, 0x17b5, 0}, {0x17b7, 0x17bd, 0}, {0x17c6, 0x17c6, 0}, {0x17c9, 0x17d3, 0},
+	{0x17dd, 0x17dd, 0}, {0x180b, 0x180f, 0}, {0x1885, 0x1886, 0}, {0x18a9, 0x18a9, 0},
+	{0x1920, 0x1922, 0}, {0x1927, 0x1928, 0}, {0x1932, 0x1932, 0}, {0x1939, 0x193b, 0},
+	{0x1a17, 0x1a18, 0}, {0x1a1b, 0x1a1b, 0}, {0x1a56, 0x1a56, 0}, {0x1a58, 0x1a60, 0},
+	{0x1a62, 0x1a62, 0}, {0x1a65, 0x1a6c, 0}, {0x1a73, 0x1a7f, 0}, {0x1ab0, 0x1b03, 0},
+	{0x1b34, 0x1b34, 0}, {0x1b36, 0x1b3a, 0}, {0x1b3c, 0x1b3c, 0}, {0x1b42, 0x1b42, 0},
+	{0x1b6b, 0x1b73, 0}, {0x1b80, 0x1b81, 0}, {0x1ba2, 0x1ba5, 0}, {0x1ba8, 0x1ba9, 0},
+	{0x1bab, 0x1bad, 0}, {0x1be6, 0x1be6, 0}, {0x1be8, 0x1be9, 0}, {0x1bed, 0x1bed, 0},
+	{0x1bef, 0x1bf1, 0}, {0x1c2c, 0x1c33, 0}, {0x1c36, 0x1c37, 0}, {0x1cd0, 0x1cd2, 0},
+	{0x1cd4, 0x1ce0, 0}, {0x1ce2, 0x1ce8, 0}, {0x1ced, 0x1ced, 0}, {0x1cf4, 0x1cf4, 0},
+	{0x1cf8, 0x1cf9, 0}, {0x1dc0, 0x1dff, 0}, {0x200b, 0x200f, 0}, {0x202a, 0x202e, 0},
+	{0x2060, 0x206f, 0}, {0x20d0, 0x20f0, 0}, {0x231a, 0x231b, 2}, {0x2329, 0x232a, 2},
+	{0x23e9, 0x23ec, 2}, {0x23f0, 0x23f0, 2}, {0x23f3, 0x23f3, 2}, {0x25fd, 0x25fe, 2},
+	{0x2614, 0x2615, 2}, {0x2648, 0x2653, 2}, {0x267f, 0x267f, 2}, {0x2693, 0x2693, 2},
+	{0x26a1, 0x26a1, 2}, {0x26aa, 0x26ab, 2}, {0x26bd, 0x26be, 2}, {0x26c4, 0x26c5, 2},
+	{0x26ce, 0x26ce, 2}, {0x26d4, 0x26d4, 2}, {0x26ea, 0x26ea, 2}, {0x26f2, 0x26f3, 2},
+	{0x26f5, 0x26f5, 2}, {0x26fa, 0x26fa, 2}, {0x26fd, 0x26fd, 2}, {0x2705, 0x2705, 2},
+	{0x270a, 0x270b, 2}, {0x2728, 0x2728, 2}, {0x274c, 0x274c, 2}, {0x274e, 0x274e, 2},
+	{0x2753, 0x2755, 2}, {0x2757, 0x2757, 2}, {0x2795, 0x2797, 2}, {0x27b0, 0x27b0, 2},
+	{0x27bf, 0x27bf, 2}, {0x2b1b, 0x2b1c, 2}, {0x2b50, 0x2b50, 2}, {0x2b55, 0x2b55, 2},
+	{0x2cef, 0x2cf1, 0}, {0x2d7f, 0x2d7f, 0}, {0x2de0, 0x2dff, 0}, {0x2e80, 0x3029, 2},
+	{0x302a, 0x302d, 0}, {0x302e, 0x303e, 2}, {0x3041, 0x3096, 2}, {0x3099, 0x309a, 0},
+	{0x309b, 0x3247, 2}, {0x3250, 0x4dbf, 2}, {0x4e00, 0xa4c6, 2}, {0xa66f, 0xa672, 0},
+	{0xa674, 0xa67d, 0}, {0xa69e, 0xa69f, 0}, {0xa6f0, 0xa6f1, 0}, {0xa802, 0xa802, 0},
+	{0xa806, 0xa806, 0}, {0xa80b, 0xa80b, 0}, {0xa825, 0xa826, 0}, {0xa82c, 0xa82c, 0},
+	{0xa8c4, 0xa8c5, 0}, {0xa8e0, 0xa8f1, 0}, {0xa8ff, 0xa8ff, 0}, {0xa926, 0xa92d, 0},
+	{0xa947, 0xa951, 0}, {0xa960, 0xa97c, 2}, {0xa980, 0xa982, 0}, {0xa9b3, 0xa9b3, 0},
+	{0xa9b6, 0xa9b9, 0}, {0xa9bc, 0xa9bd, 0}, {0xa9e5, 0xa9e5, 0}, {0xaa29, 0xaa2e, 0},
+	{0xaa31, 0xaa32, 0}, {0xaa35, 0xaa36, 0}, {0xaa43, 0xaa43, 0}, {0xaa4c, 0xaa4c, 0},
+	{0xaa7c, 0xaa7c, 0}, {0xaab0, 0xaab0, 0}, {0xaab2, 0xaab4, 0}, {0xaab7, 0xaab8, 0},
+	{0xaabe, 0xaabf, 0}, {0xaac1, 0xaac1, 0}, {0xaaec, 0xaaed, 0}, {0xaaf6, 0xaaf6, 0},
+	{0xabe5, 0xabe5, 0}, {0xabe8, 0xabe8, 0}, {0xabed, 0xabed, 0}, {0xac00, 0xd7a3, 2},
+	{0xf900, 0xfad9, 2}, {0xfb1e, 0xfb1e, 0}, {0xfe00, 0xfe0f, 0}, {0xfe10, 0xfe19, 2},
+	{0xfe20, 0xfe2f, 0}, {0xfe30, 0xfe6b, 2}, {0xfeff, 0xfeff, 0}, {0xff01, 0xff60, 2},
+	{0xffe0, 0xffe6, 2}, {0xfff9, 0xfffb, 0}, {0x101fd, 0x101fd, 0}, {0x102e0, 0x102e0, 0},
+	{0x10376, 0x1037a, 0}, {0x10a01, 0x10a0f, 0}, {0x10a38, 0x10a3f, 0}, {0x10ae5, 0x10ae6, 0},
+	{0x10d24, 0x10d27, 0}, {0x10eab, 0x10eac, 0}, {0x10f46, 0x10f50, 0}, {0x10f82, 0x10f85, 0},
+	{0x11001, 0x11001, 0}, {0x11038, 0x11046, 0}, {0x11070, 0x11070, 0}, {0x11073, 0x11074, 0},
+	{0x1107f, 0x11081, 0}, {0x110b3, 0x110b6, 0}, {0x110b9, 0x110ba, 0}, {0x110bd, 0x110bd, 0},
+	{0x110c2, 0x110cd, 0}, {0x11100, 0x11102, 0}, {0x11127, 0x1112b, 0}, {0x1112d, 0x11134, 0},
+	{0x11173, 0x11173, 0}, {0x11180, 0x11181, 0}, {0x111b6, 0x111be, 0}, {0x111c9, 0x111cc, 0},
+	{0x111cf, 0x111cf, 0}, {0x1122f, 0x11231, 0}, {0x11234, 0x11234, 0}, {0x11236, 0x11237, 0},
+	{0x1123e, 0x1123e, 0}, {0x112df, 0x112df, 0}, {0x112e3, 0x112ea, 0}, {0x11300, 0x11301, 0},
+	{0x1133b, 0x1133c, 0}, {0x11340, 0x11340, 0}, {0x11366, 0x11374, 0}, {0x11438, 0x1143f, 0},
+	{0x11442, 0x11444, 0}, {0x11446, 0x11446, 0}, {0x1145e, 0x1145e, 0}, {0x114b3, 0x114b8, 0},
+	{0x114ba, 0x114ba, 0}, {0x114bf, 0x114c0, 0}, {0x114c2, 0x114c3, 0}, {0x115b2, 0x115b5, 0},
+	{0x115bc, 0x115bd, 0}, {0x115bf, 0x115c0, 0}, {0x115dc, 0x115dd, 0}, {0x11633, 0x1163a, 0},
+	{0x1163d, 0x1163d, 0}, {0x1163f, 0x11640, 0}, {0x116ab, 0x116ab, 0}, {0x116ad, 0x116ad, 0},
+	{0x116b0, 0x116b5, 0}, {0x116b7, 0x116b7, 0}, {0x1171d, 0x1171f, 0}, {0x11722, 0x11725, 0},
+	{0x11727, 0x1172b, 0}, {0x1182f, 0x11837, 0}, {0x11839, 0x1183a, 0}, {0x1193b, 0x1193c, 0},
+	{0x1193e, 0x1193e, 0}, {0x11943, 0x11943, 0}, {0x119d4, 0x119db, 0}, {0x119e0, 0x119e0, 0},
+	{0x11a01, 0x11a0a, 0}, {0x11a33, 0x11a38, 0}, {0x11a3b, 0x11a3e, 0}, {0x11a47, 0x11a47, 0},
+	{0x11a51, 0x11a56, 0}, {0x11a59, 0x11a5b, 0}, {0x11a8a, 0x11a96, 0}, {0x11a98, 0x11a99, 0},
+	{0x11c30, 0x11c3d, 0}, {0x11c3f, 0x11c3f, 0}, {0x11c92, 0x11ca7, 0}, {0x11caa, 0x11cb0, 0},
+	{0x11cb2, 0x11cb3, 0}, {0x11cb5, 0x11cb6, 0}, {0x11d31, 0x11d45, 0}, {0x11d47, 0x11d47, 0},
+	{0x11d90, 0x11d91, 0}, {0x11d95, 0x11d95, 0}, {0x11d97, 0x11d97, 0}, {0x11ef3, 0x11ef4, 0},
+	{0x13430, 0x13438, 0}, {0x16af0, 0x16af4, 0}, {0x16b30, 0x16b36, 0}, {0x16f4f, 0x16f4f, 0},
+	{0x16f8f, 0x16f92, 0}, {0x16fe0, 0x16fe3, 2}, {0x16fe4, 0x16fe4, 0}, {0x16ff0, 0x1b2fb, 2},
+	{0x1bc9d, 0x1bc9e, 0}, {0x1bca0, 0x1cf46, 0}, {0x1d167, 0x1d169, 0}, {0x1d173, 0x1d182, 0},
+	{0x1d185, 0x1d18b, 0}, {0x1d1aa, 0x1d1ad, 0}, {0x1d242, 0x1d244, 0}, {0x1da00, 0x1da36, 0},
+	{0x1da3b, 0x1da6c, 0}, {0x1da75, 0x1da75, 0}, {0x1da84, 0x1da84, 0}, {0x1da9b, 0x1daaf, 0},
+	{0x1e000, 0x1e02a, 0}, {0x1e130, 0x1e136, 0}, {0x1e2ae, 0x1e2ae, 0}, {0x1e2ec, 0x1e2ef, 0},
+	{0x1e8d0, 0x1e8d6, 0}, {0x1e944, 0x1e94a, 0}, {0x1f004, 0x1f004, 2}, {0x1f0cf, 0x1f0cf, 2},
+	{0x1f18e, 0x1f18e, 2}, {0x1f191, 0x1f19a, 2}, {0x1f200, 0x1f320, 2}, {0x1f32d, 0x1f335, 2},
+	{0x1f337, 0x1f37c, 2}, {0x1f37e, 0x1f393, 2}, {0x1f3a0, 0x1f3ca, 2}, {0x1f3cf, 0x1f3d3, 2},
+	{0x1f3e0, 0x1f3f0, 2}, {0x1f3f4, 0x1f3f4, 2}, {0x1f3f8, 0x1f43e, 2}, {0x1f440, 0x1f440, 2},
+	{0x1f442, 0x1f4fc, 2}, {0x1f4ff, 0x1f53d, 2}, {0x1f54b, 0x1f54e, 2}, {0x1f550, 0x1f567, 2},
+	{0x1f57a, 0x1f57a, 2}, {0x1f595, 0x1f596, 2}, {0x1f5a4, 0x1f5a4, 2}, {0x1f5fb, 0x1f64f, 2},
+	{0x1f680, 0x1f6c5, 2}, {0x1f6cc, 0x1f6cc, 2}, {0x1f6d0, 0x1f6d2, 2}, {0x1f6d5, 0x1f6df, 2},
+	{0x1f6eb, 0x1f6ec, 2}, {0x1f6f4, 0x1f6fc, 2}, {0x1f7e0, 0x1f7f0, 2}, {0x1f90c, 0x1f93a, 2},
+	{0x1f93c, 0x1f945, 2}, {0x1f947, 0x1f9ff, 2}, {0x1fa70, 0x1faf6, 2}, {0x20000, 0x3fffd, 2},
+	{0xe0001, 0xe01ef, 0}
+};
+
+/*
+	Widths in the Basic Multilingual Plane, unpacked from the ranges on
+	first use into two bits a code point: 0 for one column, 2 for two and
+	3 for none.
+*/
+unsigned char CHAR_WIDTH_BMP[0x10000 / 4];
+int char_width_bmp_ready;
+
+void editorCharWidthInit(){
+
+	size_t i;
+	uint32_t cp;
+
+	for(i = 0; i < sizeof(CHAR_WIDTHS) / sizeof(CHAR_WIDTHS[0]) && CHAR_WIDTHS[i].first < 0x10000; i++){
+
+		for(cp = CHAR_WIDTHS[i].first; cp <= CHAR_WIDTHS[i].last && cp < 0x10000; cp++)
+			CHAR_WIDTH_BMP[cp >> 2] |= (CHAR_WIDTHS[i].width == 0 ? 3 : 2) << ((cp & 3) * 2);
+	}
+
+	char_width_bmp_ready = 1;
+}
+
+// Columns a code point takes, controls and malformed bytes are drawn in one
+int editorCharWidth(uint32_t cp){
 
-	int saved_cx = E.cx;
-  	int saved_cy = E.cy;
-  	int saved_coloff = E.coloff;
-  	int saved_rowoff = E.rowoff;
+	int lo = 0, hi = sizeof(CHAR_WIDTHS) / sizeof(CHAR_WIDTHS[0]) - 1;
 
-	char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+	if(cp < CHAR_WIDTHS[0].first)
+		return 1;
+
+	if(cp < 0x10000){
+
+		if(!char_width_bmp_ready)
+			editorCharWidthInit();
+
+		int w = (CHAR_WIDTH_BMP[cp >> 2] >> ((cp & 3) * 2)) & 3;
+
+		return w == 0 ? 1 : w == 3 ? 0 : w;
+	}
+
+	while(lo <= hi){
+
+		int mid = (lo + hi) / 2;
+
+		if(cp < CHAR_WIDTHS[mid].first)
+			hi = mid - 1;
+		else if(cp > CHAR_WIDTHS[mid].last)
+			lo = mid + 1;
+		else
+			return CHAR_WIDTHS[mid].width;
+	}
+
+	return 1;
+}
+
+/*
+	Decode the character at 's', at most 'len' bytes, into *cp and return
+	its length. A malformed or cut sequence is one byte long and decodes
+	to U+FFFD.
+*/
+int editorUtf8Decode(const char *s, long len, uint32_t *cp){
+
+	const unsigned char *u = (const unsigned char *)s;
+	int n, j;
+
+	if(u[0] < 0x80){
+
+		*cp = u[0];
+		return 1;
+	}
+
+	if(u[0] >= 0xC2 && u[0] <= 0xDF)
+		n = 2;
+	else if(u[0] >= 0xE0 && u[0] <= 0xEF)
+		n = 3;
+	else if(u[0] >= 0xF0 && u[0] <= 0xF4)
+		n = 4;
+	else
+		n = 0;
+
+	if(n == 0 || n > len){
+
+		*cp = 0xFFFD;
+		return 1;
+	}
+
+	*cp = u[0] & (0x7F >> n);
+
+	for(j = 1; j < n; j++){
+
+		if((u[j] & 0xC0) != 0x80){
+
+			*cp = 0xFFFD;
+			return 1;
+		}
+
+		*cp = (*cp << 6) | (u[j] & 0x3F);
+	}
+
+	// Overlong forms, surrogates and code points past U+10FFFF
+	if((n == 3 && *cp < 0x800) || (n == 4 && (*cp < 0x10000 || *cp > 0x10FFFF)) || (*cp >= 0xD800 && *cp <= 0xDFFF)){
+
+		*cp = 0xFFFD;
+		return 1;
+	}
+
+	return n;
+}
+
+// Whether a decoded character is drawn as a symbol, controls and bytes that are not UTF-8 are
+int editorCharControl(uint32_t cp, int len){
+
+	return cp < 0x20 || (cp >= 0x7F && cp < 0xA0) || (cp == 0xFFFD && len == 1);
+}
+
+// Screen columns of the character at 's', its length goes to *bytes
+int editorCharColumns(const char *s, long len, int *bytes){
+
+	uint32_t cp;
+
+	if((unsigned char)s[0] < 0x80){
+
+		*bytes = 1;
+		return 1;
+	}
+
+	*bytes = editorUtf8Decode(s, len, &cp);
+	return editorCharControl(cp, *bytes) ? 1 : editorCharWidth(cp);
+}
+
+// Whether 'len' bytes at 's' are all ASCII, 16 at a time on x86-64 and 8 elsewhere
+int editorTextAscii(const char *s, long len){
+
+	long j = 0;
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	__m128i high = _mm_setzero_si128();
+
+	for(; j + 16 <= len; j += 16)
+		high = _mm_or_si128(high, _mm_loadu_si128((const __m128i *)(s + j)));
+
+	if(_mm_movemask_epi8(high))
+		return 0;
+#else
+	uint64_t high = 0, word;
+
+	for(; j + 8 <= len; j += 8){
+
+		memcpy(&word, s + j, 8);
+		high |= word;
+	}
+
+	if(high & 0x8080808080808080ULL)
+		return 0;
+#endif
+
+	for(; j < len; j++){
+
+		if((unsigned char)s[j] >= 0x80)
+			return 0;
+	}
+
+	return 1;
+}
+
+// Column past the character at 'cx' and the combining marks on it
+long editorRowNextChar(erow *row, long cx){
+
+	uint32_t cp;
+
+	if(cx >= row->size)
+		return row->size;
+
+	cx += editorUtf8Decode(&row->chars[cx], row->size - cx, &cp);
+
+	while(cx < row->size && (unsigned char)row->chars[cx] >= 0x80){
+
+		int len = editorUtf8Decode(&row->chars[cx], row->size - cx, &cp);
+
+		if(editorCharWidth(cp) != 0)
+			break;
+
+		cx += len;
+	}
+
+	return cx;
+}
+
+// Column of the character before 'cx', back over the combining marks on it
+long editorRowPrevChar(erow *row, long cx){
+
+	uint32_t cp = 0;
+
+	while(cx > 0){
+
+		long start = cx - 1;
+
+		// Back over continuation bytes to the start of a sequence that ends at 'cx'
+		while(start > 0 && cx - start < 4 && ((unsigned char)row->chars[start] & 0xC0) == 0x80)
+			start--;
+
+		if(start + editorUtf8Decode(&row->chars[start], row->size - start, &cp) != cx){
+
+			start = cx - 1;
+			cp = 0xFFFD;
+		}
+
+		cx = start;
+
+		if(editorCharWidth(cp) != 0)
+			break;
+	}
+
+	return cx;
+}
+
+// Render and highlight caches
+
+/*
+	Tab map of a row with ROW_TABMAP, aligned after the render text: the
+	number of tabs, then the column of each and the render column it
+	starts at.
+*/
+size_t editorRowTabMapOffset(erow *row){
+
+	return (2 * (size_t)row->rsize + sizeof(long)) & ~(sizeof(long) - 1);
+}
+
+long *editorRowTabMap(erow *row){
+
+	return (long *)&row->cache[editorRowTabMapOffset(row)];
+}
+
+// Bytes of the cache buffer of a rendered row
+size_t editorRowCacheSize(erow *row){
+
+	if(row->flags & ROW_TABMAP)
+		return editorRowTabMapOffset(row) + sizeof(long) * (1 + 2 * editorRowTabMap(row)[0]);
+
+	return (row->flags & ROW_EXPANDED) ? 2 * (size_t)row->rsize + 1 : (size_t)row->rsize;
+}
+
+// The buffer is kept, highlighting is scanned into it again when next drawn
+void editorRowDropHighlight(erow *row){
+
+	row->flags &= ~ROW_HIGHLIGHTED;
+}
+
+void editorRowDropCache(erow *row){
+
+	if(!(row->flags & ROW_RENDERED))
+		return;
+
+	E.cache_bytes -= editorRowCacheSize(row);
+	rowMemFree(row->cache);
+	row->cache = NULL;
+	row->flags = 0;
+}
+
+// Render text and highlighting of a row returned by editorRowRender
+char *editorRowRenderText(erow *row){
+
+	return (row->flags & ROW_EXPANDED) ? (char *)&row->cache[row->rsize] : row->chars;
+}
+
+unsigned char *editorRowHighlight(erow *row){
+
+	return row->cache;
+}
+
+// Free caches of rows off screen, oldest sweep position first, until well under budget
+void editorCacheTrim(){
+
+	if(E.cache_bytes <= E.cache_budget)
+		return;
+
+	size_t target = E.cache_budget / 4 * 3;
+	long at = E.cache_hand;
+	long visited = 0;
+
+	while(E.cache_bytes > target && visited < E.numrows){
+
+		if(at >= E.numrows)
+			at = 0;
+
+		int slot, j;
+		long base;
+		rowNode *node = rowTreeFind(at, &slot, &base);
+
+		if(node->kind == ROW_LEAF){
+
+			rowLeaf *leaf = (rowLeaf *)node;
+
+			for(j = slot; j < leaf->h.n; j++){
+
+				if(base + j < E.rowoff || base + j >= E.rowoff + E.screenrows)
+					editorRowDropCache(&leaf->rows[j]);
+			}
+		}
+
+		visited += node->n - slot;
+		at = base + node->n;
+	}
+
+	E.cache_hand = at;
+}
+
+// returns true if separator character
+int is_separator(int c){
+
+	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+
+}
+
+unsigned int editorKeywordHash(const char *s, int len, unsigned int seed){
+
+	unsigned int h = seed ^ (unsigned int)len;
+	int i;
+
+	for(i = 0; i < len; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619u;
+
+	return h ^ (h >> 15);
+}
+
+/*
+	Build the character class table and keyword hash of a syntax entry.
+	The keyword table is grown and reseeded until no two keywords share a
+	slot, so a lookup is one hash and at most one compare. Past
+	EDITOR_KEYWORD_SLOTS slots the table stops growing and words that
+	collide are left out. The lexer, the table and the words are one
+	block holding offsets, which the syntax cache stores as it is.
+*/
+struct editorLexer *editorSyntaxCompile(struct editorSyntax *syntax){
+
+	struct editorLexer lx;
+	const char *quotes = syntax->quotes ? syntax->quotes : "\"'";
+	int c, j, n = 0;
+	size_t words = 0;
+
+	memset(&lx, 0, sizeof(lx));
+
+	lx.scs_len = syntax->singleline_comment_start ? strlen(syntax->singleline_comment_start) : 0;
+	lx.mcs_len = syntax->multiline_comment_start ? strlen(syntax->multiline_comment_start) : 0;
+	lx.mce_len = syntax->multiline_comment_end ? strlen(syntax->multiline_comment_end) : 0;
+
+	if(!lx.mcs_len || !lx.mce_len)
+		lx.mcs_len = lx.mce_len = 0;
+
+	for(c = 0; c < 256; c++){
+
+		if(is_separator(c))
+			lx.cls[c] |= CC_SEP;
+
+		if(isdigit(c))
+			lx.cls[c] |= CC_DIGIT;
+
+		if(c && strchr(quotes, c) && (syntax->flags & HL_HIGHLIGHT_STRINGS))
+			lx.cls[c] |= CC_QUOTE;
+	}
+
+	if(lx.scs_len)
+		lx.cls[(unsigned char)syntax->singleline_comment_start[0]] |= CC_COMMENT;
+
+	if(lx.mcs_len)
+		lx.cls[(unsigned char)syntax->multiline_comment_start[0]] |= CC_COMMENT;
+
+	for(c = 0; c < 256; c++)
+		if(!(lx.cls[c] & (CC_SEP | CC_QUOTE | CC_COMMENT)))
+			lx.cls[c] |= CC_WORD;
+
+	while(syntax->keywords && syntax->keywords[n])
+		words += strlen(syntax->keywords[n++]) + 1;
+
+	// Slots hold the index of their keyword plus one while a seed is tried
+	unsigned int size = 8, seed = 1;
+	int *slots = NULL;
+
+	while(size < 2 * (unsigned int)n && size < EDITOR_KEYWORD_SLOTS)
+		size *= 2;
+
+	for(;; size *= 2){
+
+		if((slots = realloc(slots, size * sizeof(int))) == NULL)
+			die("realloc");
+
+		for(seed = 1; seed <= 256; seed++){
+
+			memset(slots, 0, size * sizeof(int));
+
+			for(j = 0; j < n; j++){
+
+				const char *word = syntax->keywords[j];
+				int klen = strlen(word) - (word[strlen(word) - 1] == '|');
+				int *slot = &slots[editorKeywordHash(word, klen, seed) & (size - 1)];
+
+				// At the largest table a word that collides is left out instead
+				if(*slot && size < EDITOR_KEYWORD_SLOTS)
+					break;
+
+				if(*slot)
+					continue;
+
+				*slot = j + 1;
+			}
+
+			if(j == n)
+				break;
+		}
+
+		if(j == n)
+			break;
+	}
+
+	lx.keywords = sizeof(lx);
+	lx.kwmask = size - 1;
+	lx.kwseed = seed;
+	lx.size = sizeof(lx) + size * sizeof(struct editorKeyword) + words;
+
+	struct editorLexer *block = calloc(1, lx.size);
+
+	if(block == NULL)
+		die("calloc");
+
+	memcpy(block, &lx, sizeof(lx));
+
+	struct editorKeyword *table = (struct editorKeyword *)((char *)block + block->keywords);
+	uint32_t at = sizeof(lx) + size * sizeof(struct editorKeyword);
+
+	for(j = 0; j < (int)size; j++){
+
+		if(slots[j] == 0)
+			continue;
+
+		const char *word = syntax->keywords[slots[j] - 1];
+		int klen = strlen(word);
+		int kw2 = word[klen - 1] == '|';
+
+		if(kw2)
+			klen--;
+
+		memcpy((char *)block + at, word, klen);
+		table[j].word = at;
+		table[j].len = klen;
+		table[j].hl = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+		at += klen + 1;
+
+		if(klen > block->kwmaxlen)
+			block->kwmaxlen = klen;
+	}
+
+	free(slots);
+	syntax->lexer = block;
+	return block;
+}
+
+// Highlight class of the word s[0..len), or HL_NORMAL if it is no keyword
+int editorKeywordLookup(struct editorLexer *lx, const char *s, long len){
+
+	if(len > lx->kwmaxlen)
+		return HL_NORMAL;
+
+	struct editorKeyword *kw = (struct editorKeyword *)((char *)lx + lx->keywords);
+
+	kw += editorKeywordHash(s, len, lx->kwseed) & lx->kwmask;
+
+	if(kw->word && kw->len == len && !memcmp((char *)lx + kw->word, s, len))
+		return kw->hl;
+
+	return HL_NORMAL;
+}
+
+/*
+	Highlight 'len' bytes of text that start inside a multi-line comment if
+	'in_comment' is set, and return whether the comment is still open at the
+	end. With hl == NULL only the comment state is tracked, which is all the
+	rows below need from a line.
+
+	The lexer is driven by the class table of the current syntax: comments
+	and strings are skipped with memchr or a tight loop, and words are
+	looked up in the keyword hash as a whole.
+*/
+int editorSyntaxScan(char *s, long len, unsigned char *hl, int in_comment) {
+
+  if (hl)
+    memset(hl, HL_NORMAL, len);
+
+  if (E.syntax == NULL)
+  	return 0;
+
+  if (E.syntax->lexer == NULL)
+    editorSyntaxCompile(E.syntax);
+
+  struct editorLexer *lx = E.syntax->lexer;
+  const unsigned char *cls = lx->cls;
+
+  char *scs = E.syntax->singleline_comment_start;
+  char *mcs = E.syntax->multiline_comment_start;
+  char *mce = E.syntax->multiline_comment_end;
+
+  int numbers = E.syntax->flags & HL_HIGHLIGHT_NUMBERS;
+  int prev_sep = 1;
+  long i = 0;
+
+  while (i < len) {
+
+    if (in_comment) {
+
+      long start = i;
+      char *end;
+
+      // Jump from one possible comment end to the next
+      while ((end = memchr(&s[i], mce[0], len - i)) != NULL) {
+
+        i = end - s;
+
+        if (i + lx->mce_len <= len && !memcmp(end, mce, lx->mce_len))
+          break;
+
+        i++;
+
+      }
+
+      if (end == NULL) {
+
+        if (hl)
+          memset(&hl[start], HL_MLCOMMENT, len - start);
+        break;
+
+      }
+
+      i += lx->mce_len;
+      if (hl)
+        memset(&hl[start], HL_MLCOMMENT, i - start);
+      in_comment = 0;
+      prev_sep = 1;
+      continue;
+
+    }
+
+    unsigned char c = s[i];
+    unsigned char cc = cls[c];
+
+    // A block start may begin with the line comment, as --[[ does with --
+    if (cc & CC_COMMENT) {
+
+      if (lx->mcs_len && i + lx->mcs_len <= len && !memcmp(&s[i], mcs, lx->mcs_len)) {
+
+        if (hl)
+          memset(&hl[i], HL_MLCOMMENT, lx->mcs_len);
+        i += lx->mcs_len;
+        in_comment = 1;
+        continue;
+
+      }
+
+      if (lx->scs_len && i + lx->scs_len <= len && !memcmp(&s[i], scs, lx->scs_len)) {
+
+        if (hl)
+          memset(&hl[i], HL_COMMENT, len - i);
+        break;
+
+      }
+
+    }
+
+    if (cc & CC_QUOTE) {
+
+      long start = i++;
+
+      while (i < len) {
+
+        if (s[i] == '\\' && i + 1 < len) {
+
+          i += 2;
+          continue;
+
+        }
+
+        if ((unsigned char)s[i++] == c)
+          break;
+
+      }
+
+      if (hl)
+        memset(&hl[start], HL_STRING, i - start);
+      prev_sep = 1;
+      continue;
+
+    }
+
+    // Numbers and keywords never change the comment state
+    if (hl == NULL) {
+
+      i++;
+      while (i < len && !(cls[(unsigned char)s[i]] & (CC_COMMENT | CC_QUOTE)))
+        i++;
+      continue;
+
+    }
+
+    if (numbers && (cc & CC_DIGIT) && prev_sep) {
+
+      while (i < len && ((cls[(unsigned char)s[i]] & CC_DIGIT) || s[i] == '.'))
+        hl[i++] = HL_NUMBER;
+
+      prev_sep = 0;
+      continue;
+
+    }
+
+    if (cc & CC_SEP) {
+
+      prev_sep = 1;
+      i++;
+      continue;
+
+    }
+
+    // A word is looked up as a whole, the rest of it is never a token start
+    long start = i++;
+
+    while (i < len && (cls[(unsigned char)s[i]] & CC_WORD))
+      i++;
+
+    if (prev_sep && (i == len || (cls[(unsigned char)s[i]] & CC_SEP))) {
+
+      int kw = editorKeywordLookup(lx, &s[start], i - start);
+
+      if (kw != HL_NORMAL)
+        memset(&hl[start], kw, i - start);
+
+    }
+
+    prev_sep = 0;
+
+  }
+
+  return in_comment;
+
+}
+
+/*
+	Lexer state engine. Every row keeps the state it was scanned from and
+	the state it ends in. Rows above hl_front are known to be up to date,
+	and rows from hl_dirty_end on were scanned one after another, so once
+	the front reaches them with a matching start state everything below is
+	current too. Nothing is scanned until a row is actually drawn.
+*/
+
+// Only multi-line comments carry state from one row to the next
+int editorSyntaxStateful(){
+
+  return E.syntax && E.syntax->multiline_comment_start && E.syntax->multiline_comment_end;
+
+}
+
+// 'shift' rows were inserted (1), deleted (-1) or changed (0) at 'at'
+void editorSyntaxInvalidate(long at, long shift) {
+
+  if (E.hl_dirty_end > at)
+    E.hl_dirty_end += shift;
+
+  // The row after the change has a new neighbour or a new start state
+  if (E.hl_dirty_end < at + 1 + (shift > 0 ? shift : 0))
+    E.hl_dirty_end = at + 1 + (shift > 0 ? shift : 0);
+
+  if (E.hl_front > at)
+    E.hl_front = at;
+
+}
+
+// Scan the lines of a lazy node straight out of the mapping
+int editorSyntaxScanLazy(rowLazy *lz, int state) {
+
+  char *p = E.map + lz->start;
+  char *end = E.map + lz->end;
+  int j;
+
+  for (j = 0; j < lz->h.n; j++) {
+
+    char *line = p;
+    size_t linelen = editorMapLine(line, end, &p);
+
+    state = editorSyntaxScan(line, linelen, NULL, state);
+
+  }
+
+  return state;
+
+}
+
+// Bring lexer states up to date for every row above 'to'
+void editorSyntaxAdvance(long to) {
+
+  if (to > E.numrows)
+    to = E.numrows;
+
+  if (E.hl_front >= to)
+    return;
+
+  int state = 0;
+
+  // The row before the front is current, so its end state can be trusted
+  if (E.hl_front > 0) {
+
+    int slot;
+    long base;
+    rowNode *node = rowTreeFind(E.hl_front - 1, &slot, &base);
+
+    if (node->kind == ROW_LAZY)
+      state = ((rowLazy *)node)->hl_end;
+    else
+      state = ((rowLeaf *)node)->rows[slot].hl_open_comment;
+
+  }
+
+  while (E.hl_front < to) {
+
+    int slot, j;
+    long base;
+    rowNode *node = rowTreeFind(E.hl_front, &slot, &base);
+
+    if (node->kind == ROW_LAZY) {
+
+      rowLazy *lz = (rowLazy *)node;
+
+      if (lz->hl_start == state && base >= E.hl_dirty_end)
+        break;
+
+      if (lz->hl_start != state) {
+
+        lz->hl_start = state;
+        lz->hl_end = editorSyntaxScanLazy(lz, state);
+
+      }
+
+      state = lz->hl_end;
+      E.hl_front = base + node->n;
+      continue;
+
+    }
+
+    rowLeaf *leaf = (rowLeaf *)node;
+
+    for (j = slot; j < leaf->h.n && E.hl_front < to; j++) {
+
+      erow *row = &leaf->rows[j];
+
+      // Converged with the states from the previous pass
+      if (row->hl_start == state && E.hl_front >= E.hl_dirty_end)
+        break;
+
+      if (row->hl_start != state) {
+
+        editorRowDropHighlight(row);
+        row->hl_start = state;
+        row->hl_open_comment = editorSyntaxScan(row->chars, row->size, NULL, state);
+
+      }
+
+      state = row->hl_open_comment;
+      E.hl_front++;
+
+    }
+
+    if (j < leaf->h.n && E.hl_front < to)
+      break;
+
+  }
+
+  if (E.hl_front >= E.hl_dirty_end && E.hl_front < to) {
+
+    E.hl_front = E.numrows;
+    E.hl_dirty_end = 0;
+
+  }
+  else if (E.hl_front == E.numrows)
+    E.hl_dirty_end = 0;
+
+}
+
+/*
+	Lexer state at the start of a row. Advancing the front also drops the
+	highlighting of any row whose start state turned out to have changed.
+*/
+int editorRowStartState(long filerow) {
+
+  if (!editorSyntaxStateful())
+    return 0;
+
+  editorSyntaxAdvance(filerow + 1);
+
+  return editorRowAt(filerow)->hl_start;
+
+}
+
+
+int editorSyntaxToColor(int hl){
+
+	switch(hl){
+
+		case HL_COMMENT:
+
+		case HL_MLCOMMENT: return 36;
+
+		case HL_KEYWORD1: return 33;
+
+		case HL_KEYWORD2: return 32;
+
+		case HL_STRING: return 35;
+
+		case HL_NUMBER: return 31; // Foreground red
+
+		case HL_MATCH: return 34; // Foreground blue
+
+		default: return 37; // Foreground white
+
+	}
+
+}
+
+// Add the words of the rest of the strtok'd line to a NULL terminated list, with 'suffix' after each
+int editorSyntaxWords(char ***list, int *n, const char *suffix){
+
+	char *word;
+
+	while((word = strtok(NULL, " \t\r\n")) != NULL){
+
+		char **grown = realloc(*list, sizeof(char *) * (*n + 2));
+		char *copy = malloc(strlen(word) + strlen(suffix) + 1);
+
+		if(grown == NULL || copy == NULL)
+			die("realloc");
+
+		if(strlen(word) > 255){
+
+			free(copy);
+			*list = grown;
+			return -1;
+		}
+
+		sprintf(copy, "%s%s", word, suffix);
+		*list = grown;
+		(*list)[(*n)++] = copy;
+		(*list)[*n] = NULL;
+	}
+
+	return 0;
+}
+
+struct syntaxWord {
+
+	const char *word;
+	int len; // Without the | of a type
+	int at; // In the list
+
+};
+
+int editorSyntaxWordCmp(const void *a, const void *b){
+
+	const struct syntaxWord *x = a, *y = b;
+	int c = memcmp(x->word, y->word, x->len < y->len ? x->len : y->len);
+
+	if(c == 0)
+		c = x->len != y->len ? x->len - y->len : x->at - y->at;
+
+	return c;
+}
+
+/*
+	Drop the words listed more than once, as keyword or type, keeping the
+	first. No keyword table could hold two of the same word. Sorted, so a
+	long list costs no more than compiling it. Returns the words left.
+*/
+int editorSyntaxUnique(char **list, int n){
+
+	struct syntaxWord *sorted = malloc(sizeof(struct syntaxWord) * (n ? n : 1));
+	int j, first, kept = 0;
+
+	if(sorted == NULL)
+		die("malloc");
+
+	for(j = 0; j < n; j++){
+
+		sorted[j].word = list[j];
+		sorted[j].len = strlen(list[j]) - (list[j][strlen(list[j]) - 1] == '|');
+		sorted[j].at = j;
+	}
+
+	qsort(sorted, n, sizeof(struct syntaxWord), editorSyntaxWordCmp);
+
+	// The first of a run of the same word is the one listed first
+	for(j = 1, first = 0; j < n; j++){
+
+		if(sorted[j].len != sorted[first].len || memcmp(sorted[j].word, sorted[first].word, sorted[j].len)){
+
+			first = j;
+			continue;
+		}
+
+		free(list[sorted[j].at]);
+		list[sorted[j].at] = NULL;
+	}
+
+	for(j = 0; j < n; j++)
+		if(list[j])
+			list[kept++] = list[j];
+
+	if(list)
+		list[kept] = NULL;
+
+	free(sorted);
+	return kept;
+}
+
+// Free a definition read by editorSyntaxParse
+void editorSyntaxFree(struct editorSyntax *def){
+
+	int j;
+
+	for(j = 0; def->filematch && def->filematch[j]; j++)
+		free(def->filematch[j]);
+
+	for(j = 0; def->keywords && def->keywords[j]; j++)
+		free(def->keywords[j]);
+
+	free(def->filematch);
+	free(def->keywords);
+	free(def->filetype);
+	free(def->singleline_comment_start);
+	free(def->multiline_comment_start);
+	free(def->multiline_comment_end);
+	free(def->quotes);
+	free(def->lexer);
+	free(def);
+}
+
+/*
+	Read a syntax definition, one setting per line:
+
+		filetype c
+		match .c .h .cpp
+		keywords if else while for return
+		types int char void
+		comment //
+		strings " '
+		numbers
+
+	Names to match that start with a dot are extensions, others whole file
+	names. Types are highlighted apart from keywords, 'block' takes the
+	start and the end of a multi-line comment, and 'strings' lists the
+	characters that open a string. Lines starting with # are ignored. NULL
+	if the file cannot be read, or with a message if it is not valid.
+*/
+struct editorSyntax *editorSyntaxParse(const char *path, const char *name){
+
+	FILE *fp = fopen(path, "r");
+	struct editorSyntax *def;
+	char *line = NULL, *error = NULL;
+	size_t cap = 0;
+	int lineno = 0, nmatch = 0, nkeywords = 0;
+
+	if(fp == NULL)
+		return NULL;
+
+	if((def = calloc(1, sizeof(*def))) == NULL)
+		die("calloc");
+
+	while(error == NULL && getline(&line, &cap, fp) != -1){
+
+		char *key = strtok(line, " \t\r\n"), *arg;
+
+		lineno++;
+
+		if(key == NULL || key[0] == '#')
+			continue;
+
+		if(!strcmp(key, "match")){
+
+			if(editorSyntaxWords(&def->filematch, &nmatch, "") == -1)
+				error = "name too long";
+		}
+		else if(!strcmp(key, "keywords") || !strcmp(key, "types")){
+
+			if(editorSyntaxWords(&def->keywords, &nkeywords, key[0] == 't' ? "|" : "") == -1)
+				error = "keyword too long";
+		}
+		else if(!strcmp(key, "numbers")){
+
+			def->flags |= HL_HIGHLIGHT_NUMBERS;
+		}
+		else if(!strcmp(key, "strings")){
+
+			char quotes[256] = "";
+
+			while((arg = strtok(NULL, " \t\r\n")) != NULL && strlen(quotes) + strlen(arg) < sizeof(quotes))
+				strcat(quotes, arg);
+
+			free(def->quotes);
+			def->quotes = strdup(quotes[0] ? quotes : "\"'");
+			def->flags |= HL_HIGHLIGHT_STRINGS;
+		}
+		else if((arg = strtok(NULL, " \t\r\n")) == NULL){
+
+			error = "missing value";
+		}
+		else if(!strcmp(key, "filetype")){
+
+			free(def->filetype);
+			def->filetype = strdup(arg);
+		}
+		else if(!strcmp(key, "comment")){
+
+			free(def->singleline_comment_start);
+			def->singleline_comment_start = strdup(arg);
+		}
+		else if(!strcmp(key, "block")){
+
+			char *end = strtok(NULL, " \t\r\n");
+
+			if(end == NULL){
+
+				error = "block needs a start and an end";
+				continue;
+			}
+
+			free(def->multiline_comment_start);
+			free(def->multiline_comment_end);
+			def->multiline_comment_start = strdup(arg);
+			def->multiline_comment_end = strdup(end);
+		}
+		else{
+
+			error = "unknown setting";
+		}
+	}
+
+	free(line);
+	fclose(fp);
+
+	nkeywords = editorSyntaxUnique(def->keywords, nkeywords);
+
+	if(error == NULL && nmatch == 0){
+
+		error = "no files to match";
+		lineno = 0;
+	}
+
+	if(error){
+
+		editorSetStatusMessage("%s:%d: %s", path, lineno, error);
+		editorSyntaxFree(def);
+		return NULL;
+	}
+
+	// The file name without .syntax unless it says otherwise
+	if(def->filetype == NULL)
+		def->filetype = strndup(name, strlen(name) - strlen(".syntax"));
+
+	return def;
+}
+
+// Append to the cache being built, 8 byte aligned, and return the offset
+uint32_t editorSyntaxPut(struct abuf *ab, const void *p, size_t len){
+
+	static const char pad[8];
+	uint32_t at;
+
+	if(p == NULL)
+		return 0;
+
+	abAppend(ab, pad, -ab->len & 7);
+	at = ab->len;
+	abAppend(ab, p, len);
+
+	return at;
+}
+
+// Offset of a string in the cache being built, 0 for NULL
+uint32_t editorSyntaxPutString(struct abuf *ab, const char *s){
+
+	return s ? editorSyntaxPut(ab, s, strlen(s) + 1) : 0;
+}
+
+// Compile definitions into the cache, of a directory stamped by editorSyntaxStamp if not NULL
+char *editorSyntaxBuild(struct editorSyntax **defs, int n, struct syntaxHeader *stamp, size_t *len){
+
+	struct abuf ab = ABUF_INIT;
+	struct syntaxHeader h;
+	int j, k, names = 0;
+
+	for(j = 0; j < n; j++)
+		for(k = 0; defs[j]->filematch[k]; k++)
+			names++;
+
+	unsigned int size = 8;
+
+	while(size < 2 * (unsigned int)names)
+		size *= 2;
+
+	struct syntaxRecord *records = calloc(n ? n : 1, sizeof(struct syntaxRecord));
+	struct syntaxName *table = calloc(size, sizeof(struct syntaxName));
+
+	if(records == NULL || table == NULL)
+		die("calloc");
+
+	memset(&h, 0, sizeof(h));
+	abAppend(&ab, (char *)&h, sizeof(h));
+
+	for(j = 0; j < n; j++){
+
+		struct editorSyntax *def = defs[j];
+		struct editorLexer *lx = def->lexer ? def->lexer : editorSyntaxCompile(def);
+
+		records[j].filetype = editorSyntaxPutString(&ab, def->filetype);
+		records[j].singleline_comment_start = editorSyntaxPutString(&ab, def->singleline_comment_start);
+		records[j].multiline_comment_start = editorSyntaxPutString(&ab, def->multiline_comment_start);
+		records[j].multiline_comment_end = editorSyntaxPutString(&ab, def->multiline_comment_end);
+		records[j].flags = def->flags;
+		records[j].lexer = editorSyntaxPut(&ab, lx, lx->size);
+
+		// Open addressing, the first definition to name a file keeps it
+		for(k = 0; def->filematch[k]; k++){
+
+			const char *name = def->filematch[k];
+			unsigned int slot = editorKeywordHash(name, strlen(name), 0) & (size - 1);
+
+			while(table[slot].name && strcmp(&ab.b[table[slot].name], name))
+				slot = (slot + 1) & (size - 1);
+
+			if(table[slot].name == 0){
+
+				table[slot].name = editorSyntaxPutString(&ab, name);
+				table[slot].syntax = j;
+			}
+		}
+	}
+
+	memcpy(h.magic, SYNTAX_MAGIC, sizeof(h.magic));
+
+	if(stamp){
+
+		h.mtime = stamp->mtime;
+		h.bytes = stamp->bytes;
+		h.files = stamp->files;
+		h.ino = stamp->ino;
+		h.dev = stamp->dev;
+	}
+
+	h.nsyntax = n;
+	h.syntaxes = editorSyntaxPut(&ab, records, n * sizeof(struct syntaxRecord));
+	h.names = editorSyntaxPut(&ab, table, size * sizeof(struct syntaxName));
+	h.namemask = size - 1;
+	h.size = ab.len;
+
+	free(records);
+	free(table);
+
+	if(ab.b == NULL || ab.len != (int)h.size)
+		die("editorSyntaxBuild");
+
+	memcpy(ab.b, &h, sizeof(h));
+	*len = ab.len;
+
+	return ab.b;
+}
+
+int editorSyntaxNameCmp(const void *a, const void *b){
+
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// A definition file by its name, *.syntax and not hidden
+int editorSyntaxIsDefinition(const char *name){
+
+	size_t len = strlen(name);
+
+	return name[0] != '.' && len > strlen(".syntax") && !strcmp(&name[len - strlen(".syntax")], ".syntax");
+}
+
+/*
+	What the cache of 'dir' has to match: the newest mtime of the
+	directory and of its definitions, their size and their number, so a
+	definition edited in place is seen as well as one added or removed.
+	-1 if 'dir' is no directory.
+*/
+int editorSyntaxStamp(const char *dir, struct syntaxHeader *stamp){
+
+	struct stat st;
+	struct dirent *ent;
+	DIR *d;
+
+	if(stat(dir, &st) == -1 || !S_ISDIR(st.st_mode) || (d = opendir(dir)) == NULL)
+		return -1;
+
+	memset(stamp, 0, sizeof(*stamp));
+	stamp->mtime = st.st_mtime;
+	stamp->ino = st.st_ino;
+	stamp->dev = st.st_dev;
+
+	while((ent = readdir(d)) != NULL){
+
+		char *path;
+
+		if(!editorSyntaxIsDefinition(ent->d_name))
+			continue;
+
+		path = malloc(strlen(dir) + strlen(ent->d_name) + 2);
+		sprintf(path, "%s/%s", dir, ent->d_name);
+
+		if(stat(path, &st) == 0){
+
+			stamp->files++;
+			stamp->bytes += st.st_size;
+
+			if(st.st_mtime > stamp->mtime)
+				stamp->mtime = st.st_mtime;
+		}
+
+		free(path);
+	}
+
+	closedir(d);
+	return 0;
+}
+
+/*
+	Compile every *.syntax file of 'dir' in name order, then the built in
+	definitions of filetypes none of them has. With dir NULL only the
+	built in ones. 'failed' counts the files that could not be used.
+*/
+char *editorSyntaxCompileDir(const char *dir, struct syntaxHeader *stamp, size_t *len, int *failed){
+
+	struct editorSyntax **defs = NULL;
+	char **names = NULL;
+	int n = 0, nnames = 0, j, k;
+	DIR *d = dir ? opendir(dir) : NULL;
+	struct dirent *ent;
+
+	while(d && (ent = readdir(d)) != NULL){
+
+		if(!editorSyntaxIsDefinition(ent->d_name))
+			continue;
+
+		if((names = realloc(names, sizeof(char *) * (nnames + 1))) == NULL)
+			die("realloc");
+
+		names[nnames++] = strdup(ent->d_name);
+	}
+
+	if(d)
+		closedir(d);
+
+	if(nnames)
+		qsort(names, nnames, sizeof(char *), editorSyntaxNameCmp);
+
+	if((defs = malloc(sizeof(struct editorSyntax *) * (nnames + HLDB_ENTRIES))) == NULL)
+		die("malloc");
+
+	for(j = 0; j < nnames; j++){
+
+		char *path = malloc(strlen(dir) + strlen(names[j]) + 2);
+
+		sprintf(path, "%s/%s", dir, names[j]);
+
+		if((defs[n] = editorSyntaxParse(path, names[j])) != NULL)
+			n++;
+		else
+			(*failed)++;
+
+		free(path);
+		free(names[j]);
+	}
+
+	int parsed = n;
+
+	for(j = 0; j < (int)HLDB_ENTRIES; j++){
+
+		for(k = 0; k < parsed && strcmp(defs[k]->filetype, HLDB[j].filetype); k++)
+			;
+
+		if(k == parsed)
+			defs[n++] = &HLDB[j];
+	}
+
+	char *cache = editorSyntaxBuild(defs, n, stamp, len);
+
+	for(j = 0; j < parsed; j++)
+		editorSyntaxFree(defs[j]);
+
+	free(defs);
+	free(names);
+
+	return cache;
+}
+
+// Length of the string at 'off' of the cache, -1 if its NUL is past the end
+long editorSyntaxStrlen(const char *base, size_t len, uint32_t off){
+
+	const char *nul = off < len ? memchr(base + off, '\0', len - off) : NULL;
+
+	return nul ? nul - (base + off) : -1;
+}
+
+// A comment delimiter at 'off', of the 'n' bytes its lexer compares
+int editorSyntaxDelimiter(const char *base, size_t len, uint32_t off, int n){
+
+	long slen = off ? editorSyntaxStrlen(base, len, off) : 0;
+
+	return n >= 0 && slen >= 0 && (n == 0 || (off && slen == n));
+}
+
+// The strings of a record and its lexer, keywords and words lie whole in the cache
+int editorSyntaxRecordValid(const char *base, size_t len, const struct syntaxRecord *r){
+
+	const struct editorLexer *lx = (const struct editorLexer *)(base + r->lexer);
+	const struct editorKeyword *kw;
+	size_t j;
+
+	if(r->lexer == 0 || (r->lexer & 7) || r->lexer + sizeof(*lx) > len ||
+		lx->size < sizeof(*lx) || r->lexer + (size_t)lx->size > len ||
+		(lx->keywords & 3) || lx->keywords < sizeof(*lx) ||
+		lx->keywords + ((size_t)lx->kwmask + 1) * sizeof(*kw) > lx->size)
+		return 0;
+
+	kw = (const struct editorKeyword *)((const char *)lx + lx->keywords);
+
+	for(j = 0; j <= lx->kwmask; j++){
+
+		if(kw[j].word && (size_t)kw[j].word + kw[j].len > lx->size)
+			return 0;
+	}
+
+	return (r->filetype == 0 || editorSyntaxStrlen(base, len, r->filetype) >= 0) &&
+		editorSyntaxDelimiter(base, len, r->singleline_comment_start, lx->scs_len) &&
+		editorSyntaxDelimiter(base, len, r->multiline_comment_start, lx->mcs_len) &&
+		editorSyntaxDelimiter(base, len, r->multiline_comment_end, lx->mce_len);
+}
+
+/*
+	A cache compiled from the directory as it is now, and whole: every
+	offset in it is checked once here, as lexers are used where they lie.
+*/
+int editorSyntaxValid(const char *base, size_t len, struct syntaxHeader *stamp){
+
+	const struct syntaxHeader *h = (const struct syntaxHeader *)base;
+	uint32_t j;
+
+	if(!(len >= sizeof(*h) && !memcmp(h->magic, SYNTAX_MAGIC, sizeof(h->magic)) && h->size == len &&
+		h->mtime == stamp->mtime && h->bytes == stamp->bytes && h->files == stamp->files &&
+		h->ino == stamp->ino && h->dev == stamp->dev &&
+		(h->namemask & (h->namemask + 1)) == 0 && !(h->syntaxes & 7) && !(h->names & 7) &&
+		h->syntaxes + (size_t)h->nsyntax * sizeof(struct syntaxRecord) <= len &&
+		h->names + ((size_t)h->namemask + 1) * sizeof(struct syntaxName) <= len))
+		return 0;
+
+	for(j = 0; j < h->nsyntax; j++){
+
+		if(!editorSyntaxRecordValid(base, len, (const struct syntaxRecord *)(base + h->syntaxes) + j))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+	Map the syntax cache, or compile the definitions and write it when the
+	directory or a definition changed since. It is only written once the
+	newest of them is at least a second old, as a change within the second
+	it was compiled in would leave the same mtime, and while no definition
+	has errors, so they are reported again on the next start.
+*/
+void editorSyntaxLoad(){
+
+	struct editorSyntaxDb *db = &E.syntaxdb;
+	char *dir = getenv("CEDIT_SYNTAX_DIR"), *home = getenv("HOME");
+	char *path = NULL, *cache = NULL;
+	struct syntaxHeader stamp;
+
+	if(dir == NULL && home){
+
+		path = malloc(strlen(home) + strlen(EDITOR_SYNTAX_DIR) + 2);
+		sprintf(path, "%s/%s", home, EDITOR_SYNTAX_DIR);
+		dir = path;
+	}
+
+	if(dir && editorSyntaxStamp(dir, &stamp) == 0){
+
+		int dirlen = strlen(dir), fd;
+
+		while(dirlen > 1 && dir[dirlen - 1] == '/')
+			dirlen--;
+
+		cache = malloc(dirlen + 16);
+		sprintf(cache, "%.*s.cache", dirlen, dir);
+
+		if((fd = open(cache, O_RDONLY)) != -1){
+
+			struct stat cst;
+
+			if(fstat(fd, &cst) == 0 && cst.st_size > 0 && cst.st_size < UINT32_MAX){
+
+				char *map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+				if(map != MAP_FAILED && editorSyntaxValid(map, cst.st_size, &stamp)){
+
+					db->base = map;
+					db->len = cst.st_size;
+					db->mapped = 1;
+				}
+				else if(map != MAP_FAILED){
+
+					munmap(map, cst.st_size);
+				}
+			}
+
+			close(fd);
+		}
+	}
+	else{
+
+		dir = NULL;
+	}
+
+	if(db->base == NULL){
+
+		int failed = 0;
+
+		db->base = editorSyntaxCompileDir(dir, dir ? &stamp : NULL, &db->len, &failed);
+		db->mapped = 0;
+
+		// A failed write only costs the next start a compile
+		if(dir && !failed && stamp.mtime < time(NULL)){
+
+			char *tmp = malloc(strlen(cache) + 8);
+			int fd;
+
+			strcat(strcpy(tmp, cache), ".XXXXXX");
+
+			if((fd = mkstemp(tmp)) != -1){
+
+				int ok = write(fd, db->base, db->len) == (ssize_t)db->len;
+
+				if(close(fd) == -1 || !ok || rename(tmp, cache) == -1)
+					unlink(tmp);
+			}
+
+			free(tmp);
+		}
+	}
+
+	const struct syntaxHeader *h = (const struct syntaxHeader *)db->base;
+
+	if((db->loaded = calloc(h->nsyntax ? h->nsyntax : 1, sizeof(struct editorSyntax))) == NULL)
+		die("calloc");
+
+	free(cache);
+	free(path);
+}
+
+// Definition that matches an extension or a file name, found by hash
+struct editorSyntax *editorSyntaxFind(const char *name){
+
+	struct editorSyntaxDb *db = &E.syntaxdb;
+	const struct syntaxHeader *h = (const struct syntaxHeader *)db->base;
+	const struct syntaxName *table = (const struct syntaxName *)(db->base + h->names);
+	size_t len = strlen(name) + 1;
+	unsigned int slot = editorKeywordHash(name, len - 1, 0) & h->namemask, probes;
+
+	for(probes = 0; probes <= h->namemask && table[slot].name; probes++){
+
+		if(table[slot].name + len <= db->len && !memcmp(db->base + table[slot].name, name, len))
+			break;
+
+		slot = (slot + 1) & h->namemask;
+	}
+
+	if(probes > h->namemask || table[slot].name == 0 || table[slot].syntax >= h->nsyntax)
+		return NULL;
+
+	struct editorSyntax *s = &db->loaded[table[slot].syntax];
+
+	// Filled in from its record the first time, the lexer is used where it lies
+	if(s->lexer == NULL){
+
+		const struct syntaxRecord *r = (const struct syntaxRecord *)(db->base + h->syntaxes) + table[slot].syntax;
+
+		s->filetype = r->filetype ? db->base + r->filetype : "";
+		s->singleline_comment_start = r->singleline_comment_start ? db->base + r->singleline_comment_start : NULL;
+		s->multiline_comment_start = r->multiline_comment_start ? db->base + r->multiline_comment_start : NULL;
+		s->multiline_comment_end = r->multiline_comment_end ? db->base + r->multiline_comment_end : NULL;
+		s->flags = r->flags;
+		s->lexer = (struct editorLexer *)(db->base + r->lexer);
+	}
+
+	return s;
+}
+
+void editorSelectSyntaxHighlight() {
+
+  E.syntax = NULL;
+
+  if (E.filename == NULL)
+  		return;
+
+  if (E.syntaxdb.base == NULL)
+    editorSyntaxLoad();
+
+  // A whole file name is more specific than its extension
+  char *name = strrchr(E.filename, '/');
+  name = name ? name + 1 : E.filename;
+  char *ext = strrchr(name, '.');
+
+  E.syntax = editorSyntaxFind(name);
+
+  if (E.syntax == NULL && ext)
+    E.syntax = editorSyntaxFind(ext);
+
+  // Every row has to be scanned again, but only once it is drawn
+  long at = 0;
+
+  while (at < E.numrows) {
+
+    int slot, j;
+    long base;
+    rowNode *node = rowTreeFind(at, &slot, &base);
+
+    if (node->kind == ROW_LAZY) {
+
+      ((rowLazy *)node)->hl_start = HL_STATE_STALE;
+
+    }
+    else {
+
+      rowLeaf *leaf = (rowLeaf *)node;
+
+      for (j = 0; j < leaf->h.n; j++) {
+
+        editorRowDropHighlight(&leaf->rows[j]);
+        leaf->rows[j].hl_start = HL_STATE_STALE;
+
+      }
+
+    }
+
+    at = base + node->n;
+
+  }
+
+  E.hl_front = 0;
+  E.hl_dirty_end = E.numrows;
+
+}
+
+// Row text changed, its render, highlighting and wrapping are redone when next needed
+void editorUpdateRow(long filerow){
+
+	int slot;
+	rowLeaf *leaf = rowTreeLeaf(filerow, &slot);
+	erow *row = &leaf->rows[slot];
+
+	editorRowDropCache(row);
+	rowNodeWraps(&leaf->h, -rowWraps(row));
+	row->segs = 0;
+	row->hl_start = HL_STATE_STALE;
+	editorSyntaxInvalidate(filerow, 0);
+
+}
+
+// Return the row with its render and highlight caches filled in
+erow *editorRowRender(long filerow){
+
+	int start = editorRowStartState(filerow);
+	erow *row = editorRowAt(filerow);
+	long j;
+
+	if(!(row->flags & ROW_RENDERED)){
+
+		long tabs = 0, width = 0;
+		int tabstop = E.tabstop;
+		int utf8 = !editorTextAscii(row->chars, row->size);
+
+		// Tabs widen a row up to a tab stop per byte, the cache is twice that and a tab map entry more
+		if(row->size > LONG_MAX / (2 * tabstop + 2 * (long)sizeof(long)) - 1){
+
+			errno = EOVERFLOW;
+			die("editorRowRender");
+		}
+
+		row->rsize = 0;
+
+		if(!utf8){
+
+			for(j = 0; j < row->size; j++){
+
+				if(row->chars[j] == '\t'){
+
+					row->rsize += tabstop - row->rsize % tabstop;
+					tabs++;
+				}
+				else
+					row->rsize++;
+			}
+		}
+		else{
+
+			// Tabs stop at screen columns, which 'width' counts
+			for(j = 0; j < row->size; j++){
+
+				int len = 1;
+
+				if(row->chars[j] == '\t'){
+
+					row->rsize += tabstop - width % tabstop;
+					width += tabstop - width % tabstop;
+					tabs++;
+					continue;
+				}
+
+				width += editorCharColumns(&row->chars[j], row->size - j, &len);
+				row->rsize += len;
+				j += len - 1;
+			}
+		}
+
+		row->flags = ROW_RENDERED | (utf8 ? ROW_UTF8 : 0);
+
+		if(tabs){
+
+			row->flags |= ROW_EXPANDED;
+
+			if(tabs >= EDITOR_TAB_MAP_MIN && !utf8){
+
+				row->flags |= ROW_TABMAP;
+				row->cache = rowMemAlloc(editorRowTabMapOffset(row) + sizeof(long) * (1 + 2 * tabs));
+				editorRowTabMap(row)[0] = tabs;
+			}
+			else
+				row->cache = rowMemAlloc(editorRowCacheSize(row));
+
+			char *render = editorRowRenderText(row);
+			long *map = (row->flags & ROW_TABMAP) ? &editorRowTabMap(row)[1] : NULL;
+			long idx = 0;
+
+			for(j = 0; j < row->size && !utf8; j++){
+
+				if(row->chars[j] == '\t'){
+
+					if(map){
+
+						*map++ = j;
+						*map++ = idx;
+					}
+
+					render[idx++] = ' ';
+					while(idx % tabstop != 0)
+						render[idx++] = ' ';
+				}
+				else
+					render[idx++] = row->chars[j];
+			}
+
+			for(j = 0, width = 0; j < row->size && utf8; j++){
+
+				int len = 1;
+
+				if(row->chars[j] == '\t'){
+
+					do{
+						render[idx++] = ' ';
+					}while(++width % tabstop != 0);
+					continue;
+				}
+
+				width += editorCharColumns(&row->chars[j], row->size - j, &len);
+				memcpy(&render[idx], &row->chars[j], len);
+				idx += len;
+				j += len - 1;
+			}
+
+			render[idx] = '\0';
+		}
+		else
+			row->cache = row->rsize ? rowMemAlloc(row->rsize) : NULL;
+
+		E.cache_bytes += editorRowCacheSize(row);
+	}
+
+	if(!(row->flags & ROW_HIGHLIGHTED)){
+
+		editorSyntaxScan(editorRowRenderText(row), row->rsize, row->cache, start);
+		row->flags |= ROW_HIGHLIGHTED;
+	}
+
+	return row;
+
+}
+
+
+// Undo log
+
+struct undoRecord *editorUndoAt(int i){
+
+	return &E.undo.rec[(E.undo.head + i) % E.undo.rec_cap];
+}
+
+void editorUndoClear(){
+
+	E.undo.count = E.undo.applied = 0;
+	E.undo.head = 0;
+}
+
+// Forget the oldest key's records
+void editorUndoDropOldest(){
+
+	struct editorUndo *u = &E.undo;
+	unsigned int step = editorUndoAt(0)->step;
+
+	while(u->count && editorUndoAt(0)->step == step){
+
+		u->head = (u->head + 1) % u->rec_cap;
+		u->count--;
+
+		if(u->applied)
+			u->applied--;
+	}
+}
+
+// Move the record text into a ring of 'cap' bytes, in order from its start
+void editorUndoGrow(size_t cap){
+
+	struct editorUndo *u = &E.undo;
+	char *ring = malloc(cap);
+	size_t off = 0;
+	int i;
+
+	for(i = 0; i < u->count; i++){
+
+		struct undoRecord *r = editorUndoAt(i);
+
+		memcpy(&ring[off], &u->ring[r->off], r->len);
+		r->off = off;
+		off += r->len;
+	}
+
+	free(u->ring);
+	u->ring = ring;
+	u->cap = cap;
+}
+
+// Bytes free in the ring right after the newest record
+size_t editorUndoSpare(){
+
+	struct editorUndo *u = &E.undo;
+
+	if(u->count == 0)
+		return u->cap;
+
+	struct undoRecord *first = editorUndoAt(0);
+	struct undoRecord *last = editorUndoAt(u->count - 1);
+	size_t end = last->off + last->len;
+
+	return last->off >= first->off ? u->cap - end : first->off - end;
+}
+
+/*
+	Offset of 'n' free bytes of ring after the newest record, wrapping
+	round to the start if need be. The ring grows while under the
+	limit, then the oldest edits go. Returns -1 if 'n' cannot fit at all.
+*/
+long editorUndoReserve(size_t n){
+
+	struct editorUndo *u = &E.undo;
+
+	while(1){
+
+		if(u->count == 0 && n <= u->cap)
+			return 0;
+
+		if(u->count){
+
+			struct undoRecord *first = editorUndoAt(0);
+			struct undoRecord *last = editorUndoAt(u->count - 1);
+
+			if(editorUndoSpare() >= n)
+				return last->off + last->len;
+
+			if(last->off >= first->off && first->off >= n)
+				return 0;
+		}
+
+		size_t room = u->limit - u->rec_cap * sizeof(struct undoRecord);
+		size_t cap = u->cap ? u->cap * 2 : 65536;
+
+		while(cap < n)
+			cap *= 2;
+
+		if(cap > room)
+			cap = room;
+
+		if(cap > u->cap && cap >= n){
+
+			editorUndoGrow(cap);
+			continue;
+		}
+
+		// The key's own records stay whole or not at all
+		if(u->count == 0 || editorUndoAt(0)->step == u->step)
+			return -1;
+
+		editorUndoDropOldest();
+	}
+}
+
+/*
+	A new record with 'len' bytes of ring for its text. Whatever was
+	undone can no longer be redone. An edit too large for the log
+	empties it, NULL is returned for it and the rest of its key.
+*/
+struct undoRecord *editorUndoAdd(int kind, long row, long col, size_t len){
+
+	struct editorUndo *u = &E.undo;
+	long off;
+
+	u->count = u->applied;
+
+	if(u->lost_step == u->step)
+		return NULL;
+
+	if(u->count == u->rec_cap){
+
+		int rec_cap = u->rec_cap ? u->rec_cap * 2 : 16;
+
+		if(u->cap + rec_cap * sizeof(struct undoRecord) <= u->limit){
+
+			struct undoRecord *rec = malloc(rec_cap * sizeof(struct undoRecord));
+			int i;
+
+			for(i = 0; i < u->count; i++)
+				rec[i] = *editorUndoAt(i);
+
+			free(u->rec);
+			u->rec = rec;
+			u->rec_cap = rec_cap;
+			u->head = 0;
+		}
+		else if(u->count && editorUndoAt(0)->step != u->step)
+			editorUndoDropOldest();
+	}
+
+	if(u->count == u->rec_cap || (off = editorUndoReserve(len)) < 0){
+
+		// Earlier records of the key went too, undoing part of it would be wrong
+		editorUndoClear();
+		u->lost_step = u->step;
+		editorSetStatusMessage("Edit too large to undo, CEDIT_UNDO_KB raises the limit");
+		return NULL;
+	}
+
+	struct undoRecord *r = editorUndoAt(u->count);
+
+	r->kind = kind;
+	r->step = u->step;
+	r->row = row;
+	r->col = col;
+	r->rows = 0;
+	r->off = off;
+	r->len = len;
+	r->cx = r->after_cx = u->cx;
+	r->cy = r->after_cy = u->cy;
+
+	u->count++;
+	u->applied++;
+	return r;
+}
+
+// Record text inserted at or deleted from (row, col)
+void editorUndoText(int kind, long row, long col, const char *s, size_t len){
+
+	struct editorUndo *u = &E.undo;
+
+	if(u->step == 0 || u->replaying || len == 0)
+		return;
+
+	struct undoRecord *r = editorUndoAdd(kind, row, col, len);
+
+	if(r)
+		memcpy(&u->ring[r->off], s, len);
+}
+
+/*
+	A key that typed or deleted a single character next to the run of
+	the key before joins that run, so a word is undone in one go.
+*/
+void editorUndoCoalesce(){
+
+	struct editorUndo *u = &E.undo;
+
+	if(u->applied < 2 || u->applied != u->count)
+		return;
+
+	struct undoRecord *r = editorUndoAt(u->applied - 1);
+	struct undoRecord *run = editorUndoAt(u->applied - 2);
+	char *text = &u->ring[run->off];
+
+	if(r->step != u->step || run->step + 1 != u->step || r->kind != run->kind || r->kind > UNDO_DELETE_TEXT)
+		return;
+
+	if(r->row != run->row || r->off != run->off + run->len || r->len > 4)
+		return;
+
+	// One character, a byte or a whole UTF-8 sequence
+	uint32_t cp;
+
+	if(editorUtf8Decode(&text[run->len], r->len, &cp) != (int)r->len)
+		return;
+
+	// Typed or deleted after the run, the text already follows it in the ring
+	if((r->kind == UNDO_INSERT_TEXT && r->col == run->col + (long)run->len) || (r->kind == UNDO_DELETE_TEXT && r->col == run->col))
+		;
+	else if(r->kind == UNDO_DELETE_TEXT && r->col + (long)r->len == run->col){
+
+		char c[4];
+
+		memcpy(c, &text[run->len], r->len);
+		memmove(&text[r->len], text, run->len);
+		memcpy(text, c, r->len);
+		run->col = r->col;
+	}
+	else
+		return;
+
+	run->len += r->len;
+	run->step = u->step;
+	u->count--;
+	u->applied--;
+}
+
+// Bytes of 'n' rows from 'at' as the undo log and the journal keep them
+size_t editorRowsDataSize(long at, long n){
+
+	size_t len = 0;
+	long j;
+
+	for(j = 0; j < n; j++)
+		len += sizeof(long) + editorRowAt(at + j)->size;
+
+	return len;
+}
+
+// Each row as its length then its bytes
+void editorRowsData(char *p, long at, long n){
+
+	long j;
+
+	for(j = 0; j < n; j++){
+
+		erow *row = editorRowAt(at + j);
+
+		memcpy(p, &row->size, sizeof(long));
+		memcpy(p + sizeof(long), row->chars, row->size);
+		p += sizeof(long) + row->size;
+	}
+}
+
+// Record 'n' rows from 'at' as inserted or about to be deleted
+void editorUndoRows(int kind, long at, long n){
+
+	struct editorUndo *u = &E.undo;
+
+	if(u->step == 0 || u->replaying || n == 0)
+		return;
+
+	struct undoRecord *r = editorUndoAdd(kind, at, 0, editorRowsDataSize(at, n));
+
+	if(r == NULL)
+		return;
+
+	r->rows = n;
+	editorRowsData(&u->ring[r->off], at, n);
+}
+
+// Swap file journal
+
+// FNV-1a, enough to tell a whole record from a torn one
+uint32_t editorJournalSum(uint32_t h, const void *p, size_t len){
+
+	const unsigned char *s = p;
+	size_t i;
+
+	for(i = 0; i < len; i++)
+		h = (h ^ s[i]) * 16777619u;
+
+	return h;
+}
+
+uint32_t editorJournalRecordSum(struct journalRecord *r, const char *data){
+
+	struct journalRecord h = *r;
+
+	h.sum = 0;
+	return editorJournalSum(editorJournalSum(2166136261u, &h, sizeof(h)), data, r->len);
+}
+
+// Write 'len' bytes, picking up after short writes
+int editorJournalWrite(int fd, const char *p, size_t len){
+
+	while(len > 0){
+
+		ssize_t w = write(fd, p, len);
+
+		if(w == -1){
+
+			if(errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		p += w;
+		len -= w;
+	}
+
+	return 0;
+}
+
+struct editorJournal *editorJournalNew(){
+
+	struct editorJournal *j = calloc(1, sizeof(struct editorJournal));
+
+	if(j == NULL)
+		die("calloc");
+
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->wake, NULL);
+	pthread_cond_init(&j->idle, NULL);
+	j->fd = -1;
+	j->enabled = 1;
+
+	return j;
+}
+
+void editorJournalFree(struct editorJournal *j){
+
+	pthread_mutex_destroy(&j->lock);
+	pthread_cond_destroy(&j->wake);
+	pthread_cond_destroy(&j->idle);
+	free(j->buf);
+	free(j);
+}
+
+/*
+	Writer thread. It sleeps until records come in, lets the burst they
+	belong to pile up for EDITOR_JOURNAL_SYNC ms, then swaps buffers with
+	the main thread, creating the swap file the first time, and writes
+	and syncs the batch without the lock.
+*/
+void *editorJournalWriter(void *arg){
+
+	struct editorJournal *j = arg;
+	struct timespec pause = { EDITOR_JOURNAL_SYNC / 1000, (EDITOR_JOURNAL_SYNC % 1000) * 1000000L };
+	char *batch = NULL;
+	size_t batch_cap = 0;
+
+	pthread_mutex_lock(&j->lock);
+
+	while(1){
+
+		while(j->len == 0 && !j->closed)
+			pthread_cond_wait(&j->wake, &j->lock);
+
+		if(j->closed)
+			break;
+
+		pthread_mutex_unlock(&j->lock);
+		nanosleep(&pause, NULL);
+		pthread_mutex_lock(&j->lock);
+
+		// Saving may have dropped the records meanwhile
+		if(j->len == 0 || j->path == NULL)
+			continue;
+
+		char *full = j->buf;
+		size_t len = j->len, cap = j->cap;
+		struct journalHeader header = j->header;
+		char *path = strdup(j->path);
+		int fd = j->fd;
+		int error = 0;
+
+		j->buf = batch;
+		j->cap = batch_cap;
+		j->len = 0;
+		j->writing = 1;
+		batch = full;
+		batch_cap = cap;
+
+		pthread_mutex_unlock(&j->lock);
+
+		if(fd == -1){
+
+			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+			if(fd == -1 || editorJournalWrite(fd, (char *)&header, sizeof(header)) == -1)
+				error = errno;
+		}
+
+		if(!error && (editorJournalWrite(fd, batch, len) == -1 || fsync(fd) == -1))
+			error = errno;
+
+		free(path);
+		pthread_mutex_lock(&j->lock);
+
+		j->fd = fd;
+		j->writing = 0;
+
+		if(error && !j->error)
+			j->error = error;
+
+		pthread_cond_broadcast(&j->idle);
+	}
+
+	// The buffer was closed, nothing else holds the journal
+	pthread_mutex_unlock(&j->lock);
+	editorJournalFree(j);
+	free(batch);
+
+	return NULL;
+}
+
+/*
+	Room for a record with 'len' bytes of data, returned with the lock
+	held for editorJournalCommit to finish it, or NULL when edits are
+	not journaled.
+*/
+char *editorJournalAdd(int kind, long row, long col, long n, size_t len){
+
+	struct editorJournal *j = E.journal;
+	struct journalRecord r;
+
+	if(j == NULL || j->path == NULL || j->replaying)
+		return NULL;
+
+	pthread_mutex_lock(&j->lock);
+
+	size_t need = j->len + sizeof(r) + len;
+
+	if(need > j->cap){
+
+		size_t cap = j->cap ? j->cap : 4096;
+
+		while(cap < need)
+			cap *= 2;
+
+		char *buf = realloc(j->buf, cap);
+
+		if(buf == NULL)
+			die("realloc");
+
+		j->buf = buf;
+		j->cap = cap;
+	}
+
+	r.kind = kind;
+	r.sum = 0;
+	r.row = row;
+	r.col = col;
+	r.n = n;
+	r.len = len;
+	memcpy(&j->buf[j->len], &r, sizeof(r));
+
+	return &j->buf[j->len + sizeof(r)];
+}
+
+void editorJournalCommit(){
+
+	struct editorJournal *j = E.journal;
+	struct journalRecord r;
+	char *data = &j->buf[j->len + sizeof(r)];
+
+	memcpy(&r, &j->buf[j->len], sizeof(r));
+	r.sum = editorJournalRecordSum(&r, data);
+	memcpy(&j->buf[j->len], &r, sizeof(r));
+	j->len += sizeof(r) + r.len;
+
+	if(!j->running && pthread_create(&j->thread, NULL, editorJournalWriter, j) == 0){
+
+		pthread_detach(j->thread);
+		j->running = 1;
+	}
+
+	pthread_cond_signal(&j->wake);
+
+	// A failed write is reported once, until the next save starts a new journal
+	int error = j->error > 0 ? j->error : 0;
+
+	if(error)
+		j->error = -1;
+
+	pthread_mutex_unlock(&j->lock);
+
+	if(error)
+		editorSetStatusMessage("Swap file not written: %s", strerror(error));
+}
+
+// Text inserted at or about to be deleted from (row, col), only inserted text is kept
+void editorJournalText(int kind, long row, long col, const char *s, size_t len){
+
+	size_t data = kind == UNDO_INSERT_TEXT ? len : 0;
+	char *p = editorJournalAdd(kind, row, col, len, data);
+
+	if(p == NULL)
+		return;
+
+	memcpy(p, s, data);
+	editorJournalCommit();
+}
+
+// Rows from 'at' inserted, or about to be deleted
+void editorJournalRows(int kind, long at, long n){
+
+	if(E.journal == NULL || E.journal->path == NULL || E.journal->replaying)
+		return;
+
+	size_t data = kind == UNDO_INSERT_ROWS ? editorRowsDataSize(at, n) : 0;
+	char *p = editorJournalAdd(kind, at, 0, n, data);
+
+	if(data)
+		editorRowsData(p, at, n);
+
+	editorJournalCommit();
+}
+
+// Swap file of 'filename', hidden next to it
+char *editorJournalPath(const char *filename){
+
+	const char *slash = strrchr(filename, '/');
+	int dirlen = slash ? slash - filename + 1 : 0;
+	char *path = malloc(strlen(filename) + 16);
+
+	sprintf(path, "%.*s.%s.cedit-swap", dirlen, filename, &filename[dirlen]);
+	return path;
+}
+
+/*
+	Journal the edits to 'filename' from now on, made against the file as
+	'st' describes it. Records not yet written are dropped with the swap
+	file, as the file itself has them after a save. With 'st' NULL, edits
+	stop being journaled.
+*/
+void editorJournalStart(const char *filename, struct stat *st){
+
+	struct editorJournal *j = E.journal;
+
+	if(j == NULL || !j->enabled)
+		return;
+
+	pthread_mutex_lock(&j->lock);
+
+	while(j->writing)
+		pthread_cond_wait(&j->idle, &j->lock);
+
+	j->len = 0;
+	j->error = 0;
+
+	if(j->fd != -1){
+
+		close(j->fd);
+		unlink(j->path);
+		j->fd = -1;
+	}
+
+	free(j->path);
+	j->path = NULL;
+
+	if(st){
+
+		memcpy(j->header.magic, JOURNAL_MAGIC, sizeof(j->header.magic));
+		j->header.size = st->st_size;
+		j->header.mtime = st->st_mtime;
+		j->header.ino = st->st_ino;
+		j->header.pid = getpid();
+		j->path = editorJournalPath(filename);
+	}
+
+	pthread_mutex_unlock(&j->lock);
+}
+
+// Delete 'len' bytes of the row from 'at'
+void editorRowDelText(long filerow, long at, size_t len) {
+
+  erow *row = editorRowAt(filerow);
+
+  if (at < 0 || at >= row->size || len == 0)
+  		return;
+
+  if (len > (size_t)(row->size - at))
+    len = row->size - at;
+
+  editorUndoText(UNDO_DELETE_TEXT, filerow, at, &row->chars[at], len);
+  editorJournalText(UNDO_DELETE_TEXT, filerow, at, &row->chars[at], len);
+  memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+
+  row->size -= len;
+  rowTreeResize(filerow, -(long)len);
+
+  editorUpdateRow(filerow);
+
+  E.dirty++;
+}
+
+void editorRowDelChar(long filerow, long at) {
+
+  editorRowDelText(filerow, at, 1);
+}
+
+// Function renaming
+void editorInsertRow(long at, char *s, size_t len){
+
+	// Adding enter key functionality
+
+	if(at < 0 || at >  E.numrows)
+		return;
+
+	editorInitRow(rowTreeInsert(at, len), s, len);
+	editorSyntaxInvalidate(at, 1);
+
+	E.numrows++;
+	E.dirty++;
+	editorUndoRows(UNDO_INSERT_ROWS, at, 1);
+	editorJournalRows(UNDO_INSERT_ROWS, at, 1);
+}
+
+void editorFreeRow(erow *row){
+
+	editorRowDropCache(row);
+	rowMemFree(row->chars);
+}
+
+// Delete 'n' rows from 'at' in one go
+void editorDelRows(long at, long n){
+
+	long j;
+
+	if(at < 0 || n <= 0 || at + n > E.numrows)
+		return;
+
+	editorUndoRows(UNDO_DELETE_ROWS, at, n);
+	editorJournalRows(UNDO_DELETE_ROWS, at, n);
+
+	for(j = 0; j < n; j++){
+
+		editorFreeRow(editorRowAt(at));
+		rowTreeDelete(at);
+	}
+
+	editorSyntaxInvalidate(at, -n);
+
+	E.numrows -= n;
+	E.dirty++;
+}
+
+void editorDelRow(long at){
+
+	editorDelRows(at, 1);
+}
+
+// Free the rows below 'node' and the node itself
+void editorFreeNode(rowNode *node){
+
+	int j;
+
+	if(node->kind == ROW_INNER){
+
+		for(j = 0; j < node->n; j++)
+			editorFreeNode(((rowInner *)node)->child[j]);
+	}
+	else if(node->kind == ROW_LEAF){
+
+		for(j = 0; j < node->n; j++)
+			editorFreeRow(&((rowLeaf *)node)->rows[j]);
+	}
+
+	free(node);
+}
+
+void editorOpen(char *filename){
+
+	free(E.filename);
+	E.filename = strdup(filename);
+
+	// Enable syntax highlighting
+	editorSelectSyntaxHighlight();
+
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1)
+		die("open");
+
+	/*
+		Regular files are mapped and indexed a chunk at a time, rows are
+		only copied out when they are shown or edited.
+	*/
+	struct stat st;
+	char *map = MAP_FAILED;
+	int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+	// A file larger than the address space is read line by line, and fails there
+	if(regular && st.st_size > 0 && (off_t)(size_t)st.st_size == st.st_size)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if(map != MAP_FAILED){
+
+		close(fd);
+		E.map = map;
+		E.maplen = st.st_size;
+		E.scan_off = E.scan_start = 0;
+		E.scan_lines = 0;
+		E.scan_bytes = 0;
+		E.scan_done = 0;
+	}
+	else{
+
+		FILE *fp = fdopen(fd, "r");
+		if(!fp) 
+			die("fdopen");
+
+		char *line = NULL;
+		size_t linecap = 0;
+		ssize_t linelen;
+
+		// File reader read multiple lines
+
+		while((linelen = getline(&line, &linecap, fp)) != -1){
+
+				// Strip carriage return and newline characters
+				while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+					linelen--;
+
+				editorInsertRow(E.numrows, line, linelen);
+		}
+
+		free(line);
+		fclose(fp);
+	}
+
+	E.dirty = 0; // Prevent from showing "modified" when file is opened initially
+
+	// Edits are journaled against the file as it was opened
+	if(regular){
+
+		editorJournalStart(filename, &st);
+		editorJournalRecover();
+	}
+
+}
+
+/*
+	Rows are saved straight from their buffers, and lines still only in
+	the mapped file straight from the mapping, a batch of iovecs per
+	writev, so saving needs no copy of the file in memory.
+*/
+struct editorSaveBatch {
+
+	int fd;
+	int n;
+	off_t written;
+	struct iovec iov[EDITOR_SAVE_IOVS];
+
+};
+
+// Write out the batch, picking up where a short write stopped
+int editorSaveFlush(struct editorSaveBatch *b){
+
+	struct iovec *iov = b->iov;
+	int n = b->n;
+
+	while(n > 0){
+
+		ssize_t w = writev(b->fd, iov, n);
+
+		if(w == -1){
+
+			if(errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		b->written += w;
+
+		while(n > 0 && (size_t)w >= iov->iov_len){
+
+			w -= iov->iov_len;
+			iov++;
+			n--;
+		}
+
+		if(n > 0){
+
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+
+	b->n = 0;
+	return 0;
+}
+
+int editorSaveAdd(struct editorSaveBatch *b, const char *s, size_t len){
+
+	if(len == 0)
+		return 0;
+
+	// Lines that follow each other in the mapping go out as one piece
+	if(b->n > 0 && (char *)b->iov[b->n - 1].iov_base + b->iov[b->n - 1].iov_len == s){
+
+		b->iov[b->n - 1].iov_len += len;
+		return 0;
+	}
+
+	if(b->n == EDITOR_SAVE_IOVS && editorSaveFlush(b) == -1)
+		return -1;
+
+	b->iov[b->n].iov_base = (void *)s;
+	b->iov[b->n].iov_len = len;
+	b->n++;
+	return 0;
+}
+
+int editorSaveRows(struct editorSaveBatch *b){
+
+	long row = 0;
+	int slot, j;
+	long base;
+
+	while(row < E.numrows){
+
+		rowNode *node = rowTreeFind(row, &slot, &base);
+
+		if(node->kind == ROW_LAZY){
+
+			rowLazy *lz = (rowLazy *)node;
+			char *p = E.map + lz->start;
+			char *end = E.map + lz->end;
+
+			for(j = 0; j < node->n; j++){
+
+				char *line = p;
+				size_t linelen = editorMapLine(line, end, &p);
+
+				// The newline of the mapping unless a carriage return was stripped before it
+				char *nl = (line + linelen < end && line[linelen] == '\n') ? &line[linelen] : "\n";
+
+				if(editorSaveAdd(b, line, linelen) == -1 || editorSaveAdd(b, nl, 1) == -1)
+					return -1;
+			}
+		}
+		else{
+
+			rowLeaf *leaf = (rowLeaf *)node;
+
+			for(j = 0; j < node->n; j++){
+
+				if(editorSaveAdd(b, leaf->rows[j].chars, leaf->rows[j].size) == -1 || editorSaveAdd(b, "\n", 1) == -1)
+					return -1;
+			}
+		}
+
+		row = base + node->n;
+	}
+
+	return editorSaveFlush(b);
+}
+
+/*
+	Write to disk. The rows go to a temporary file next to the one saved,
+	which is synced and renamed over it, so a crash leaves either the old
+	file or the new one. Symbolic links are followed, and the new file
+	keeps the mode and owner of the old one.
+*/
+void editorSave(){
+
+
+	if(E.filename == NULL){
+
+		E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+		// Activate if user presses ESC
+		if(E.filename == NULL){
+
+			editorSetStatusMessage("Save aborted");
+			return;
+		}
+		editorSelectSyntaxHighlight();
+	}
+
+
+	editorScanFinish();
+
+	char *target = realpath(E.filename, NULL);
+
+	if(target == NULL)
+		target = strdup(E.filename);
+
+	char *slash = strrchr(target, '/');
+	int dirlen = slash ? slash - target + 1 : 0;
+	char *tmp = malloc(strlen(target) + 16);
+	struct editorSaveBatch b;
+	struct stat st, saved;
+	int error;
+
+	sprintf(tmp, "%.*s.%s.XXXXXX", dirlen, target, &target[dirlen]);
+
+	b.fd = mkstemp(tmp);
+	b.n = 0;
+	b.written = 0;
+
+	// Error handling 
+	if(b.fd != -1){
+
+		if(stat(target, &st) == 0){
+
+			// Only root may give the file to another owner, set-id bits stay only with it
+			if(fchown(b.fd, st.st_uid, st.st_gid) == -1)
+				st.st_mode &= ~(S_ISUID | S_ISGID);
+		}
+		else{
+
+			mode_t mask = umask(0);
+
+			umask(mask);
+			st.st_mode = 0644 & ~mask;
+		}
+
+		if(fchmod(b.fd, st.st_mode & 07777) != -1 && editorSaveRows(&b) != -1 && fsync(b.fd) != -1){
+
+			if(fstat(b.fd, &saved) != -1 && close(b.fd) != -1 && rename(tmp, target) != -1){
+
+				// The rename itself is on disk once the directory is
+				if(dirlen)
+					target[dirlen > 1 ? dirlen - 1 : 1] = '\0';
+
+				int dir = open(dirlen ? target : ".", O_RDONLY);
+
+				if(dir != -1){
+
+					fsync(dir);
+					close(dir);
+				}
+
+				free(tmp);
+				free(target);
+				E.dirty = 0;
+				editorJournalStart(E.filename, &saved);
+				editorSetStatusMessage("%lld bytes written to disk", (long long)b.written);
+				return;
+			}
+
+			b.fd = -1;
+		}
+
+		error = errno;
+
+		if(b.fd != -1)
+			close(b.fd);
+
+		unlink(tmp);
+		errno = error;
+	}
+
+	free(tmp);
+	free(target);
+	editorSetStatusMessage("Cannot save! I/O error: %s", strerror(errno));
+
+}
+// Save as prompt when new file is created 
+char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+
+  size_t bufsize = 128;
+  char *buf = malloc(bufsize);
+  size_t buflen = 0;
+  buf[0] = '\0';
+
+  while (1) {
+
+    editorSetStatusMessage(prompt, buf);
+    editorRefreshScreen();
+
+    int c = editorReadKey();
+
+
+    if(c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE){
+
+    	// The continuation bytes of a UTF-8 sequence go with its first byte
+    	while(buflen != 0 && ((unsigned char)buf[--buflen] & 0xC0) == 0x80)
+    		;
+    	buf[buflen] = '\0';
+    }
+    // ESC key to cancel Save As
+    else if(c == '\x1b'){
+
+    	editorSetStatusMessage("");
+
+    	if (callback)
+    		callback(buf, c);
+
+    	free(buf);
+    	return NULL;
+
+    }
+    else if (c == '\r') {
+
+      if (buflen != 0) {
+
+        editorSetStatusMessage("");
+
+        if (callback)
+        	callback(buf, c);
+        
+        return buf;
+
+      }
+
+    } 
+    // A paste adds its first line, tabs and other controls left out
+    else if (c == PASTE_START) {
+
+      size_t len, j;
+      char *text = editorReadPaste(&len);
+
+      for (j = 0; j < len && text[j] != '\r' && text[j] != '\n'; j++) {
+
+        if (iscntrl((unsigned char)text[j]))
+          continue;
+
+        if (buflen == bufsize - 1) {
+
+          bufsize *= 2;
+          buf = realloc(buf, bufsize);
+
+        }
+        buf[buflen++] = text[j];
+      }
+
+      buf[buflen] = '\0';
+      free(text);
+
+    }
+    else if (!iscntrl(c) && c < 256) {
+
+      if (buflen == bufsize - 1) {
+
+        bufsize *= 2;
+        buf = realloc(buf, bufsize);
+
+      }
+      buf[buflen++] = c;
+      buf[buflen] = '\0';
+
+    }
+
+    if (callback)
+    	callback(buf, c);
+
+  }
+
+}
+// Size of the row once 'len' bytes are added, which has to fit a long
+long editorRowGrow(erow *row, size_t len){
+
+	if(len > (size_t)(LONG_MAX - 1 - row->size)){
+
+		errno = EOVERFLOW;
+		die("editorRowGrow");
+	}
+
+	return row->size + len;
+}
+
+// Insert 'len' bytes of 's' into the row at 'at'
+void editorRowInsertText(long filerow, long at, const char *s, size_t len){
+
+	erow *row = editorRowAt(filerow);
+	long size = editorRowGrow(row, len);
+
+	if(at < 0 || at > row->size)
+		at = row->size;
+
+	editorUndoText(UNDO_INSERT_TEXT, filerow, at, s, len);
+	editorJournalText(UNDO_INSERT_TEXT, filerow, at, s, len);
+	row->chars = rowMemResize(row->chars, row->size + 1, size + 1);
+	memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+	memcpy(&row->chars[at], s, len);
+	row->size = size;
+	rowTreeResize(filerow, len);
+
+	editorUpdateRow(filerow);
+	E.dirty++;
+
+}
+
+void editorRowInsertChar(long filerow, long at, int c){
+
+	char ch = c;
+
+	editorRowInsertText(filerow, at, &ch, 1);
+}
+
+// Handles Enter Keystrokes
+void editorInsertNewline(){
+
+	if(E.cx == 0)
+		editorInsertRow(E.cy, "", 0);
+
+	else{
+
+		erow *row = editorRowAt(E.cy);
+		editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+		editorRowDelText(E.cy, E.cx, editorRowAt(E.cy)->size - E.cx);
+
+	}
+	E.cy++;
+	E.cx = 0;
+}
+
+void editorRowAppendString(long filerow, char *s, size_t len){
+
+	editorRowInsertText(filerow, editorRowAt(filerow)->size, s, len);
+
+}
+
+
+void editorDelChar(){
+
+	if(E.cy == E.numrows)
+		return;
+
+	if(E.cx == 0 && E.cy == 0)
+		return;
+
+	erow * row = editorRowAt(E.cy);
+
+	// The whole character before the cursor, with the marks on it
+	if(E.cx > 0){
+
+		long at = editorRowPrevChar(row, E.cx);
+
+		editorRowDelText(E.cy, at, E.cx - at);
+		E.cx = at;
+
+	}
+	else{
+
+		E.cx = editorRowAt(E.cy - 1)->size;
+		editorRowAppendString(E.cy - 1, row->chars, row->size);
+		editorDelRow(E.cy);	
+		E.cy--;
+
+	}
+	
+}
+
+void editorInsertChar(int c){
+
+	// Cursor on tilde line after end of file
+	if(E.cy == E.numrows)
+		editorInsertRow(E.numrows, "", 0);
+
+	editorRowInsertChar(E.cy, E.cx, c);
+	E.cx++;
+
+}
+
+// End of the line at 's', its \r or \n or 'end'
+const char *editorTextEol(const char *s, const char *end){
+
+	while(s < end && *s != '\r' && *s != '\n')
+		s++;
+
+	return s;
+}
+
+/*
+	Splice 'len' bytes of text, lines ended by \r, \n or \r\n, in at the
+	cursor as one edit. The cursor row is cut around the text and the
+	lines between become rows of their own, copied to file arenas like
+	the lines of an opened file. Rows are rehighlighted once, when drawn.
+*/
+void editorInsertText(const char *s, size_t len){
+
+	const char *end = s + len;
+	const char *eol = editorTextEol(s, end);
+
+	if(len == 0)
+		return;
+
+	if(E.cy == E.numrows)
+		editorInsertRow(E.numrows, "", 0);
+
+	erow *row = editorRowAt(E.cy);
+
+	if(eol == end){
+
+		editorRowInsertText(E.cy, E.cx, s, len);
+		E.cx += len;
+		return;
+	}
+
+	// The rest of the cursor row goes after the last line
+	size_t tail = row->size - E.cx;
+	char *saved = malloc(tail + 1);
+
+	memcpy(saved, &row->chars[E.cx], tail);
+	editorRowDelText(E.cy, E.cx, tail);
+	editorRowInsertText(E.cy, E.cx, s, eol - s);
+
+	long at = E.cy + 1;
+	const char *p = eol;
+
+	while(1){
+
+		p += (p[0] == '\r' && p + 1 < end && p[1] == '\n') ? 2 : 1;
+		eol = editorTextEol(p, end);
+
+		if(eol == end)
+			break;
+
+		editorFillRow(rowTreeInsert(at++, eol - p), rowMemArena(eol - p + 1), (char *)p, eol - p);
+		E.numrows++;
+		p = eol;
+	}
+
+	row = rowTreeInsert(at, end - p + tail);
+	row->size = end - p;
+	editorFillRow(row, rowMemAlloc(editorRowGrow(row, tail) + 1), (char *)p, end - p);
+	memcpy(&row->chars[row->size], saved, tail);
+	row->size += tail;
+	row->chars[row->size] = '\0';
+	E.numrows++;
+	free(saved);
+
+	editorSyntaxInvalidate(E.cy + 1, at - E.cy);
+	editorUndoRows(UNDO_INSERT_ROWS, E.cy + 1, at - E.cy);
+	editorJournalRows(UNDO_INSERT_ROWS, E.cy + 1, at - E.cy);
+
+	E.cy = at;
+	E.cx = end - p;
+	E.dirty++;
+}
+
+// Insert 'n' rows kept as editorRowsData leaves them at 'at', all at once like a paste
+void editorInsertRowsData(long at, long n, const char *p){
+
+	long j, len;
+
+	for(j = 0; j < n; j++){
+
+		memcpy(&len, p, sizeof(long));
+		editorFillRow(rowTreeInsert(at + j, len), rowMemArena(len + 1), (char *)p + sizeof(long), len);
+		p += sizeof(long) + len;
+	}
+
+	E.numrows += n;
+	editorSyntaxInvalidate(at, n);
+	E.dirty++;
+	editorUndoRows(UNDO_INSERT_ROWS, at, n);
+	editorJournalRows(UNDO_INSERT_ROWS, at, n);
+}
+
+// Apply a record, or its opposite to undo it
+void editorUndoApply(struct undoRecord *r, int redo){
+
+	int insert = (r->kind == UNDO_INSERT_TEXT || r->kind == UNDO_INSERT_ROWS) == redo;
+
+	if(r->kind == UNDO_INSERT_TEXT || r->kind == UNDO_DELETE_TEXT){
+
+		if(insert)
+			editorRowInsertText(r->row, r->col, &E.undo.ring[r->off], r->len);
+		else
+			editorRowDelText(r->row, r->col, r->len);
+	}
+	else if(insert)
+		editorInsertRowsData(r->row, r->rows, &E.undo.ring[r->off]);
+	else
+		editorDelRows(r->row, r->rows);
+}
+
+// Undo the records of the last key done, or redo those of the first undone
+void editorUndoStep(int redo){
+
+	struct editorUndo *u = &E.undo;
+	struct undoRecord *r, *done = NULL;
+
+	if(redo ? u->applied == u->count : u->applied == 0){
+
+		editorSetStatusMessage(redo ? "Nothing to redo" : "Nothing to undo");
+		return;
+	}
+
+	unsigned int step = editorUndoAt(redo ? u->applied : u->applied - 1)->step;
+
+	u->replaying = 1;
+
+	if(redo){
+
+		while(u->applied < u->count && (r = editorUndoAt(u->applied))->step == step){
+
+			editorUndoApply(r, 1);
+			u->applied++;
+			done = r;
+		}
+
+		E.cx = done->after_cx;
+		E.cy = done->after_cy;
+	}
+	else{
+
+		while(u->applied > 0 && (r = editorUndoAt(u->applied - 1))->step == step){
+
+			editorUndoApply(r, 0);
+			u->applied--;
+			done = r;
+		}
+
+		E.cx = done->cx;
+		E.cy = done->cy;
+	}
+
+	u->replaying = 0;
+}
+
+// Rows data of 'n' rows that takes exactly 'len' bytes
+int editorJournalRowsFit(const char *p, size_t len, long n){
+
+	long j, size;
+
+	for(j = 0; j < n; j++){
+
+		if(len < sizeof(long))
+			return 0;
+
+		memcpy(&size, p, sizeof(long));
+
+		if(size < 0 || (size_t)size > len - sizeof(long))
+			return 0;
+
+		p += sizeof(long) + size;
+		len -= sizeof(long) + size;
+	}
+
+	return len == 0;
+}
+
+/*
+	Apply the whole records of a swap file in order, up to the first
+	torn one or one that does not fit the rows as they are. Returns the
+	bytes of records applied, and their number in 'count'.
+*/
+size_t editorJournalReplay(const char *start, size_t len, long *count){
+
+	const char *p = start;
+	const char *end = start + len;
+	struct journalRecord r;
+
+	*count = 0;
+
+	while((size_t)(end - p) >= sizeof(r)){
+
+		memcpy(&r, p, sizeof(r));
+
+		const char *data = p + sizeof(r);
+
+		if(r.len < 0 || r.len > end - data || r.sum != editorJournalRecordSum(&r, data) || r.row < 0 || r.col < 0 || r.n < 0)
+			break;
+
+		editorScanTo(r.row + r.n + 1);
+
+		if(r.kind == UNDO_INSERT_TEXT && r.row < E.numrows && r.len == r.n)
+			editorRowInsertText(r.row, r.col, data, r.n);
+		else if(r.kind == UNDO_DELETE_TEXT && r.row < E.numrows)
+			editorRowDelText(r.row, r.col, r.n);
+		else if(r.kind == UNDO_INSERT_ROWS && r.row <= E.numrows && editorJournalRowsFit(data, r.len, r.n))
+			editorInsertRowsData(r.row, r.n, data);
+		else if(r.kind == UNDO_DELETE_ROWS && r.row + r.n <= E.numrows)
+			editorDelRows(r.row, r.n);
+		else
+			break;
+
+		p = data + r.len;
+		(*count)++;
+	}
+
+	return p - start;
+}
+
+/*
+	Offer the edits in a swap file left by an editor that did not get to
+	exit, if they were made against the file as it is now. Replayed, they
+	stay in the swap file, and the edits that follow are appended to them.
+*/
+void editorJournalRecover(){
+
+	struct editorJournal *j = E.journal;
+	struct journalHeader header;
+	struct stat st;
+
+	if(j == NULL || j->path == NULL)
+		return;
+
+	int fd = open(j->path, O_RDWR);
+
+	if(fd == -1)
+		return;
+
+	if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(header) || (off_t)(size_t)st.st_size != st.st_size ||
+		pread(fd, &header, sizeof(header), 0) != sizeof(header)){
+
+		// Cut short before its first write, nothing in it
+		close(fd);
+		unlink(j->path);
+		return;
+	}
+
+	// Not ours, or another editor still has the file open: leave it to them
+	if(memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+		(header.pid != getpid() && (kill(header.pid, 0) == 0 || errno == EPERM))){
+
+		close(fd);
+		editorSetStatusMessage("%s is in use, edits are not journaled", j->path);
+		editorJournalStart(NULL, NULL);
+		j->enabled = 0;
+		return;
+	}
+
+	// Made against another version of the file, the edits would land in the wrong places
+	if(header.size != j->header.size || header.mtime != j->header.mtime || header.ino != j->header.ino){
+
+		char *old = malloc(strlen(j->path) + 5);
+
+		sprintf(old, "%s.old", j->path);
+		rename(j->path, old);
+		editorSetStatusMessage("The file changed since %s was written, moved it to %s", j->path, old);
+		free(old);
+		close(fd);
+		return;
+	}
+
+	// Claimed before asking, so an editor opening the file meanwhile leaves it alone
+	header.pid = getpid();
+
+	char *map = pwrite(fd, &header, sizeof(header), 0) == sizeof(header) ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	int c;
+
+	if(map == MAP_FAILED){
+
+		editorSetStatusMessage("Cannot read %s: %s", j->path, strerror(errno));
+		editorJournalStart(NULL, NULL);
+		j->enabled = 0;
+		close(fd);
+		return;
+	}
+
+	editorSetStatusMessage("Unsaved edits found in %s. Recover them? (y/n)", j->path);
+	editorRefreshScreen();
+
+	do
+		c = editorReadKey();
+	while(c != 'y' && c != 'Y' && c != 'n' && c != 'N' && c != '\x1b');
+
+	if(c == 'y' || c == 'Y'){
+
+		long count;
+
+		j->replaying = 1;
+		size_t len = editorJournalReplay(map + sizeof(header), st.st_size - sizeof(header), &count);
+		j->replaying = 0;
+
+		// Whatever followed the last whole record goes, and new edits are appended
+		if(ftruncate(fd, sizeof(header) + len) == -1 || lseek(fd, 0, SEEK_END) == -1){
+
+			editorSetStatusMessage("Recovered %ld edits, swap file not written: %s", count, strerror(errno));
+			close(fd);
+		}
+		else{
+
+			editorSetStatusMessage("Recovered %ld edits from %s", count, j->path);
+			j->fd = fd;
+		}
+	}
+	else{
+
+		editorSetStatusMessage("Unsaved edits in %s dropped", j->path);
+		close(fd);
+		unlink(j->path);
+	}
+
+	munmap(map, st.st_size);
+}
+
+void editorPaste(){
+
+	size_t len;
+	char *text = editorReadPaste(&len);
+
+	editorInsertText(text, len);
+	free(text);
+}
+void abAppend(struct abuf *ab, const char *s,int len){
+
+	// Capacity doubles, a buffer reused across frames soon stops growing
+	if(ab->len + len > ab->cap){
+
+		int cap = ab->cap ? ab->cap : 4096;
+
+		while(cap < ab->len + len)
+			cap *= 2;
+
+		char *new = realloc(ab->b, cap);
+
+		if(new == NULL)
+			return;
+
+		ab->b = new;
+		ab->cap = cap;
+	}
+
+	memcpy(&ab->b[ab->len],s,len);
+	ab->len += len;
+}
+
+void abFree(struct abuf *ab){
+
+	// Free allocated buffer
+	free(ab->b);
+
+}
+
+void editorFrameResize(struct editorFrame *f, int rows, int cols){
+
+	if(f->rows == rows && f->cols == cols)
+		return;
+
+	f->rows = rows;
+	f->cols = cols;
+	f->chars = realloc(f->chars, rows * cols);
+	f->attrs = realloc(f->attrs, rows * cols);
+	f->glyphs = realloc(f->glyphs, (size_t)rows * cols * FRAME_GLYPH);
+	f->multi = realloc(f->multi, rows);
+	f->used = realloc(f->used, sizeof(int) * rows);
+}
+
+// Blank row y
+void editorFrameClearRow(struct editorFrame *f, int y){
+
+	memset(&f->chars[y * f->cols], ' ', f->cols);
+	memset(&f->attrs[y * f->cols], 0, f->cols);
+	f->multi[y] = 0;
+	f->used[y] = 0;
+}
+
+char *editorFrameGlyph(struct editorFrame *f, int y, int x){
+
+	return &f->glyphs[((size_t)y * f->cols + x) * FRAME_GLYPH];
+}
+
+/*
+	Put a character of 'len' bytes and 'width' columns at column x of row
+	y and return the columns it took. One of no width joins the cell
+	before it, as long as the glyph has room; a wide one that does not fit
+	before the right edge is drawn as a blank.
+*/
+int editorFramePutChar(struct editorFrame *f, int y, int x, const char *s, int len, int width, unsigned char attr){
+
+	char *cell = &f->chars[y * f->cols];
+	char *glyph;
+
+	if(width == 0){
+
+		if(x > 0 && cell[x - 1] == 0 && editorFrameGlyph(f, y, x - 1)[0] == '\0')
+			x--;
+
+		if(x == 0)
+			return 0;
+
+		glyph = editorFrameGlyph(f, y, x - 1);
+
+		if(cell[x - 1] != 0){
+
+			memset(glyph, 0, FRAME_GLYPH);
+			glyph[0] = cell[x - 1];
+			cell[x - 1] = 0;
+			f->multi[y] = 1;
+		}
+
+		size_t used = strlen(glyph);
+
+		if(used + len < FRAME_GLYPH)
+			memcpy(&glyph[used], s, len);
+
+		return 0;
+	}
+
+	if(x + width > f->cols){
+
+		s = " ";
+		len = width = 1;
+	}
+
+	if(len == 1 && (unsigned char)s[0] < 0x80)
+		cell[x] = s[0];
+	else{
+
+		glyph = editorFrameGlyph(f, y, x);
+		memset(glyph, 0, FRAME_GLYPH);
+		memcpy(glyph, s, len < FRAME_GLYPH ? len : FRAME_GLYPH - 1);
+		cell[x] = 0;
+		f->multi[y] = 1;
+	}
+
+	f->attrs[y * f->cols + x] = attr;
+
+	if(width == 2){
+
+		memset(editorFrameGlyph(f, y, x + 1), 0, FRAME_GLYPH);
+		cell[x + 1] = 0;
+		f->attrs[y * f->cols + x + 1] = attr;
+	}
+
+	if(f->used[y] < x + width)
+		f->used[y] = x + width;
+
+	return width;
+}
+
+// Put 'len' bytes of text at column x of row y, cut at the right edge
+void editorFramePut(struct editorFrame *f, int y, int x, const char *s, int len, unsigned char attr){
+
+	if(!editorTextAscii(s, len)){
+
+		int j = 0;
+
+		while(j < len && x < f->cols){
+
+			uint32_t cp;
+			int n = editorUtf8Decode(&s[j], len - j, &cp);
+			int width = editorCharWidth(cp);
+
+			if(editorCharControl(cp, n))
+				x += editorFramePutChar(f, y, x, "?", 1, 1, attr);
+			else
+				x += editorFramePutChar(f, y, x, &s[j], n, width, attr);
+
+			j += n;
+		}
+
+		return;
+	}
+
+	if(x + len > f->cols)
+		len = f->cols - x;
+
+	if(len <= 0)
+		return;
+
+	memcpy(&f->chars[y * f->cols + x], s, len);
+	memset(&f->attrs[y * f->cols + x], attr, len);
+
+	if(f->used[y] < x + len)
+		f->used[y] = x + len;
+}
+
+// Select graphic rendition sequence of each cell attribute, made on first use
+struct editorAttrSeq {
+
+	char seq[12];
+	int len;
+
+} ATTR_SEQ[256];
+
+void editorFrameAttr(struct abuf *ab, unsigned char attr){
+
+	struct editorAttrSeq *a = &ATTR_SEQ[attr];
+
+	if(a->len == 0){
+
+		if(attr == 0)
+			a->len = snprintf(a->seq, sizeof(a->seq), "\x1b[m");
+		else if(attr & ~ATTR_INVERSE)
+			a->len = snprintf(a->seq, sizeof(a->seq), "\x1b[0%s;%dm", (attr & ATTR_INVERSE) ? ";7" : "", attr & ~ATTR_INVERSE);
+		else
+			a->len = snprintf(a->seq, sizeof(a->seq), "\x1b[0;7m");
+	}
+
+	abAppend(ab, a->seq, a->len);
+}
+
+// Move the terminal cursor from (*cy, *cx) to (y, x), -1 if unknown, the short way
+void editorFrameMove(struct abuf *ab, int *cy, int *cx, int y, int x){
+
+	char buf[32];
+	int len;
+
+	if(*cy == y && *cx == x)
+		return;
+
+	if(*cy == y && x == 0)
+		abAppend(ab, "\r", 1);
+
+	else if(*cy >= 0 && y == *cy + 1 && x == 0)
+		abAppend(ab, "\r\n", 2);
+
+	else{
+
+		if(*cy == y && x > *cx)
+			len = snprintf(buf, sizeof(buf), "\x1b[%dC", x - *cx);
+		else if(x == 0)
+			len = snprintf(buf, sizeof(buf), "\x1b[%dH", y + 1);
+		else
+			len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+
+		abAppend(ab, buf, len);
+	}
+
+	*cy = y;
+	*cx = x;
+}
+
+#define FRAME_GAP 4 // Unchanged cells rewritten rather than moved over
+
+// Whether cell x of row y, a glyph in both frames, holds the same one
+int editorFrameSameGlyph(struct editorFrame *f, struct editorFrame *old, int y, int x){
+
+	return !memcmp(editorFrameGlyph(f, y, x), editorFrameGlyph(old, y, x), FRAME_GLYPH);
+}
+
+// Whether cell x of row y is the right half of a wide character
+int editorFrameRightHalf(struct editorFrame *f, int y, int x){
+
+	return f->chars[y * f->cols + x] == 0 && editorFrameGlyph(f, y, x)[0] == '\0';
+}
+
+/*
+	Append to ab what turns the cells on the terminal into those of
+	E.frame: only the changed spans, each reached with the shortest
+	cursor move, and blanks at the end of a row are erased rather than
+	written. Glyphs are written one at a time, and a span never starts or
+	ends inside a wide character. The frame then becomes the one shown.
+*/
+void editorFrameDiff(struct abuf *ab){
+
+	struct editorFrame *f = &E.frame;
+	struct editorFrame *old = &E.shown;
+	int cy = E.shown_cy, cx = E.shown_cx;
+	unsigned char attr = 0;
+	int y, x;
+
+	// Start from a cleared screen
+	if(!E.shown_valid || old->rows != f->rows || old->cols != f->cols){
+
+		editorFrameResize(old, f->rows, f->cols);
+
+		for(y = 0; y < f->rows; y++)
+			editorFrameClearRow(old, y);
+
+		abAppend(ab, "\x1b[m\x1b[2J", 7);
+		E.shown_valid = 1;
+	}
+
+	for(y = 0; y < f->rows; y++){
+
+		char *c = &f->chars[y * f->cols];
+		unsigned char *a = &f->attrs[y * f->cols];
+		char *oc = &old->chars[y * f->cols];
+		unsigned char *oa = &old->attrs[y * f->cols];
+		int last = f->used[y];
+		int width = (last > old->used[y]) ? last : old->used[y];
+
+		// Both rows are blank past 'width', glyphs can differ where both cells hold one
+		if(!memcmp(c, oc, width) && !memcmp(a, oa, width) && !f->multi[y])
+			continue;
+
+		for(x = 0; x < width; ){
+
+			while(x < width && c[x] == oc[x] && a[x] == oa[x] && (c[x] != 0 || editorFrameSameGlyph(f, old, y, x)))
+				x++;
+
+			if(x == width)
+				break;
+
+			// Wide characters are written whole, the terminal clears both halves of one written over
+			if(x > 0 && x < last && (editorFrameRightHalf(f, y, x) || editorFrameRightHalf(old, y, x)))
+				x--;
+
+			editorFrameMove(ab, &cy, &cx, y, x);
+
+			if(x >= last){
+
+				if(attr != 0)
+					editorFrameAttr(ab, attr = 0);
+
+				abAppend(ab, "\x1b[K", 3);
+				break;
+			}
+
+			// The span ends after a long enough run of unchanged cells
+			int end = x, j;
+
+			for(j = x; j < last && j - end <= FRAME_GAP; j++){
+
+				if(c[j] != oc[j] || a[j] != oa[j] || (c[j] == 0 && !editorFrameSameGlyph(f, old, y, j)))
+					end = j;
+			}
+
+			if(end + 1 < f->cols && editorFrameRightHalf(f, y, end + 1))
+				end++;
+
+			// One copy for each run of ASCII cells with the same attribute
+			for(j = x; j <= end; ){
+
+				int k = j + 1;
+
+				if(a[j] != attr)
+					editorFrameAttr(ab, attr = a[j]);
+
+				if(c[j] == 0){
+
+					char *glyph = editorFrameGlyph(f, y, j);
+
+					abAppend(ab, glyph, strnlen(glyph, FRAME_GLYPH));
+					j = k;
+					continue;
+				}
+
+				while(k <= end && a[k] == a[j] && c[k] != 0)
+					k++;
+
+				abAppend(ab, &c[j], k - j);
+				j = k;
+			}
+
+			x = end + 1;
+			cx = x;
+
+			// Past the last column the cursor waits to wrap, where it is depends on the terminal
+			if(cx == f->cols)
+				cy = cx = -1;
+		}
+	}
+
+	if(attr != 0)
+		editorFrameAttr(ab, 0);
+
+	E.shown_cy = cy;
+	E.shown_cx = cx;
+
+	// The cells of the old frame are drawn over next time
+	struct editorFrame t = *old;
+
+	*old = *f;
+	*f = t;
+}
+
+// Screen column of 'cx', walking from column 'from' at screen column 'rx'
+long editorRowCxToRxFrom(erow *row, long from, long rx, long cx){
+
+	long j;
+
+	for(j = from; j < cx; j++){
+
+		if(row->chars[j] == '\t')
+			rx += (E.tabstop - 1) - (rx % E.tabstop);
+
+		else if((unsigned char)row->chars[j] >= 0x80){
+
+			int len;
+
+			rx += editorCharColumns(&row->chars[j], row->size - j, &len) - 1;
+			j += len - 1;
+		}
+
+		rx++;
+	}
+
+	return rx;
+}
+
+// Index of the first tab of the map at or past 'col', a column or a render column
+long editorTabMapFind(long *map, long col, int render){
+
+	long lo = 0, hi = map[0];
+
+	while(lo < hi){
+
+		long mid = lo + (hi - lo) / 2;
+
+		if(map[1 + 2 * mid + render] < col)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+long editorRowCxToRx(erow *row, long cx){
+
+	if(!(row->flags & ROW_TABMAP))
+		return editorRowCxToRxFrom(row, 0, 0, cx);
+
+	// Columns after the last tab before 'cx' are one wide
+	long *map = editorRowTabMap(row);
+	long i = editorTabMapFind(map, cx, 0);
+
+	if(i == 0)
+		return cx;
+
+	long *tab = &map[1 + 2 * (i - 1)];
+
+	return tab[1] + E.tabstop - tab[1] % E.tabstop + (cx - tab[0] - 1);
+}
+
+// Column of the character drawn at screen column 'rx', the end of the row past it
+long editorRowRxToCx(erow *row, long rx){
+
+	long cx, cur = 0;
+
+	if(row->flags & ROW_TABMAP){
+
+		long *map = editorRowTabMap(row);
+		long i = editorTabMapFind(map, rx + 1, 1);
+
+		if(i > 0){
+
+			long *tab = &map[1 + 2 * (i - 1)];
+			long end = tab[1] + E.tabstop - tab[1] % E.tabstop;
+
+			cx = (rx < end) ? tab[0] : tab[0] + 1 + (rx - end);
+		}
+		else
+			cx = rx;
+
+		return cx < row->size ? cx : row->size;
+	}
+
+	for(cx = 0; cx < row->size; cx++){
+
+		int len = 1;
+
+		if(row->chars[cx] == '\t')
+			cur += (E.tabstop - 1) - (cur % E.tabstop);
+
+		else if((unsigned char)row->chars[cx] >= 0x80)
+			cur += editorCharColumns(&row->chars[cx], row->size - cx, &len) - 1;
+
+		if(++cur > rx)
+			return cx;
+
+		cx += len - 1;
+	}
+
+	return cx;
+}
+
+/*
+	Soft wrapping. With E.wrap set a row is cut into screen lines
+	E.screencols wide instead of scrolling sideways, a wide character
+	that would cross the right edge starts the next line. Rows are laid
+	out as they come on screen and keep their line count until edited.
+*/
+
+// Whether a row is ASCII only, without rendering it
+int editorRowAscii(erow *row){
+
+	if(row->flags & ROW_RENDERED)
+		return !(row->flags & ROW_UTF8);
+
+	return editorTextAscii(row->chars, row->size);
+}
+
+/*
+	Walk the screen lines of a wrapped row up to screen column 'rx' or up
+	to line 'seg', whichever comes first. Returns the line reached,
+	*start receives its first screen column.
+*/
+long editorRowWrapWalk(erow *row, long rx, long seg, long *start){
+
+	long cols = E.screencols, cur = 0, line = 0, j;
+
+	*start = 0;
+
+	if(editorRowAscii(row)){
+
+		line = rx / cols < seg ? rx / cols : seg;
+		*start = line * cols;
+		return line;
+	}
+
+	for(j = 0; j < row->size && cur <= rx && line < seg; j++){
+
+		int len = 1, width = 1;
+
+		if(row->chars[j] == '\t')
+			width = E.tabstop - cur % E.tabstop;
+
+		else if((unsigned char)row->chars[j] >= 0x80)
+			width = editorCharColumns(&row->chars[j], row->size - j, &len);
+
+		while(cur >= *start + cols && line < seg){
+
+			*start += cols;
+			line++;
+		}
+
+		// Tabs are blanks and may be cut, a wide character moves down whole
+		if(width > 1 && row->chars[j] != '\t' && cur + width > *start + cols && cur > *start && line < seg){
+
+			*start = cur;
+			line++;
+		}
+
+		cur += width;
+		j += len - 1;
+	}
+
+	while(rx >= *start + cols && line < seg){
+
+		*start += cols;
+		line++;
+	}
+
+	return line;
+}
+
+// Screen line of a wrapped row that screen column 'rx' falls on, *col receives the column on it
+long editorRowSegment(erow *row, long rx, long *col){
+
+	long start, line = editorRowWrapWalk(row, rx, LONG_MAX, &start);
+
+	*col = rx - start;
+	return line;
+}
+
+// Screen column of column 'col' of line 'seg' of a wrapped row, kept on that line
+long editorRowSegmentRx(erow *row, long seg, long col){
+
+	long start, next;
+
+	editorRowWrapWalk(row, LONG_MAX, seg, &start);
+
+	// A line cut short by a wide character ends before the next one starts
+	if(col > 0){
+
+		editorRowWrapWalk(row, LONG_MAX, seg + 1, &next);
+
+		if(start + col >= next)
+			return next - 1;
+	}
+
+	return start + col;
+}
+
+// Screen lines of row 'at' when wrapped, laying it out if it is not yet
+long editorRowSegs(long at){
+
+	int slot;
+	rowLeaf *leaf = rowTreeLeaf(at, &slot);
+	erow *row = &leaf->rows[slot];
+
+	// After a resize the rows of a leaf are laid out again as they are reached
+	if(leaf->wrap_cols != E.screencols)
+		rowLeafUnwrap(leaf, E.screencols);
+
+	if(row->segs == 0){
+
+		long col, segs = editorRowSegment(row, editorRowCxToRx(row, row->size), &col) + 1;
+
+		row->segs = segs < UINT_MAX ? segs : UINT_MAX;
+		rowNodeWraps(&leaf->h, rowWraps(row));
+	}
+
+	return row->segs;
+}
+
+/*
+	Search kernel. Candidates are filtered on the first and the last byte
+	of the needle, 16 or 32 positions at a time on x86-64, and only the
+	positions where both match are compared in full.
+*/
+const char *editorSearchScalar(const char *hay, size_t n, const char *needle, size_t m){
+
+	if(n < m)
+		return NULL;
+
+	const char *p = hay;
+	const char *end = hay + n - m + 1;
+
+	while(p < end && (p = memchr(p, needle[0], end - p)) != NULL){
+
+		if(p[m - 1] == needle[m - 1] && !memcmp(p + 1, needle + 1, m - 1))
+			return p;
+
+		p++;
+	}
+
+	return NULL;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+
+const char *editorSearchSSE2(const char *hay, size_t n, const char *needle, size_t m){
+
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[m - 1]);
+	size_t i;
+
+	for(i = 0; i + m - 1 + 16 <= n; i += 16){
+
+		__m128i a = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(hay + i)));
+		__m128i b = _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)(hay + i + m - 1)));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+
+		while(mask){
+
+			const char *p = hay + i + __builtin_ctz(mask);
+
+			if(!memcmp(p + 1, needle + 1, m - 2))
+				return p;
+
+			mask &= mask - 1;
+		}
+	}
+
+	return editorSearchScalar(hay + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+const char *editorSearchAVX2(const char *hay, size_t n, const char *needle, size_t m){
+
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+	size_t i;
+
+	for(i = 0; i + m - 1 + 32 <= n; i += 32){
+
+		__m256i a = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)(hay + i)));
+		__m256i b = _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)(hay + i + m - 1)));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+
+		while(mask){
+
+			const char *p = hay + i + __builtin_ctz(mask);
+
+			if(!memcmp(p + 1, needle + 1, m - 2))
+				return p;
+
+			mask &= mask - 1;
+		}
+	}
+
+	return editorSearchScalar(hay + i, n - i, needle, m);
+}
+
+#endif
+
+// First occurrence of needle[0..m) in hay[0..n)
+const char *editorMemMem(const char *hay, size_t n, const char *needle, size_t m){
+
+	static const char *(*kernel)(const char *, size_t, const char *, size_t) = NULL;
+
+	if(m == 0 || n < m)
+		return m ? NULL : hay;
+
+	if(m == 1)
+		return memchr(hay, needle[0], n);
+
+	if(kernel == NULL){
+
+		kernel = editorSearchScalar;
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+		kernel = __builtin_cpu_supports("avx2") ? editorSearchAVX2 : editorSearchSSE2;
+#endif
+	}
+
+	return kernel(hay, n, needle, m);
+}
+
+/*
+	Regular expressions. A pattern is parsed into a tree and compiled to a
+	Thompson NFA, once as written and once reversed. DFAs are built from
+	the NFAs lazily, one state per set of NFA states met. A forward DFA
+	finds the first line that holds a match, the reversed one run back
+	from the line end finds where the leftmost match starts, and an
+	anchored forward DFA from there finds where the longest one ends.
+	None of them backtracks, so a search takes time linear in the text.
+
+	Word boundaries cannot be decided by a DFA, it lets them pass; for
+	patterns with them, or that can match the empty string, a Pike VM
+	finds the match on the lines the forward DFA picks out.
+*/
+#define RE_MAX_INSTS 8192 // Size limit of a compiled pattern
+#define RE_DFA_STATES 1024 // DFA states cached before the cache is flushed
+
+enum reOp {
+
+	RE_CLASS = 0, // Consume a byte of class x
+	RE_SPLIT, // Continue at x and y
+	RE_JMP, // Continue at x
+	RE_ASSERT, // Check assertion x
+	RE_MATCH
+
+};
+
+enum reAssert {
+
+	RE_BOL = 0,
+	RE_EOL,
+	RE_WORDB,
+	RE_NWORDB
+
+};
+
+enum reNodeKind {
+
+	RN_EMPTY = 0,
+	RN_CLASS, // a = class
+	RN_ASSERT, // a = assertion
+	RN_CAT, // a then b
+	RN_ALT, // a or b
+	RN_REPEAT // a, min to max times (max -1 for no limit)
+
+};
+
+typedef struct reInst {
+
+	int op;
+	int x, y;
+
+}reInst;
+
+typedef struct reNode {
+
+	int kind;
+	int a, b;
+	int min, max;
+
+}reNode;
+
+typedef struct reDfaState {
+
+	int *set; // NFA states reached, sorted
+	int nset;
+	unsigned int hash;
+
+}reDfaState;
+
+typedef struct reDfa {
+
+	reInst *prog;
+	int anchored; // Matches start only where the scan does
+	int *trans; // Transitions, 256 per state, -1 until first taken
+	unsigned char *flags;
+	reDfaState *states;
+	int nstates;
+	int *table; // Open addressed hash of state sets, 2 * RE_DFA_STATES slots
+	int start[2]; // Start states in the middle and at the start of a line
+	int flushes;
+
+}reDfa;
+
+// DFA state flags
+#define RE_ACCEPT (1<<0) // A match ends before the next byte
+#define RE_ACCEPT_EOL (1<<1) // A match ends here if the line does
+#define RE_DEAD (1<<2) // No match can follow
+
+struct editorRegex;
+
+void reDfaClosure(struct editorRegex *re, reInst *prog, int pc, int bol, int eol, int *set, int *n);
+
+struct editorRegex {
+
+	reInst *prog;
+	reInst *rprog; // The pattern reversed
+	int ninst;
+	unsigned char (*classes)[32]; // Byte sets of the RE_CLASS instructions
+	int nclass;
+	unsigned char first[32]; // Bytes a non-empty match can start with
+	char lit[64]; // A string every match contains, lines without it are skipped
+	int litlen;
+	int litprefix; // Every match starts with it
+	int pike; // Matched by the Pike VM: has word boundaries or matches empty
+	reDfa scan; // Finds lines with a match
+	reDfa span; // Anchored, finds where matches end
+	reDfa rscan; // Reversed, finds where matches start
+	reDfa rspan; // Reversed and anchored
+	int *set; // Scratch space, one slot per instruction
+	int *stack;
+	int *mark;
+	int gen;
+	int *thread_pc; // Pike VM thread lists, two of ninst each
+	const char **thread_start;
+
+};
+
+typedef struct reParser {
+
+	const char *s;
+	int pos;
+	reNode *nodes;
+	int nnodes;
+	int nodecap;
+	unsigned char (*classes)[32];
+	int nclass;
+	int classcap;
+	const char *error;
+	int depth;
+
+}reParser;
+
+#define RE_SET(cls, c) ((cls)[(unsigned char)(c) >> 3] |= 1 << ((unsigned char)(c) & 7))
+#define RE_HAS(cls, c) ((cls)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+
+int reIsWord(int c){
+
+	return isalnum(c) || c == '_';
+}
+
+int reNodeNew(reParser *ps, int kind, int a, int b){
+
+	if(ps->nnodes == ps->nodecap){
+
+		ps->nodecap = ps->nodecap ? ps->nodecap * 2 : 64;
+		ps->nodes = realloc(ps->nodes, sizeof(reNode) * ps->nodecap);
+	}
+
+	reNode *node = &ps->nodes[ps->nnodes];
+
+	node->kind = kind;
+	node->a = a;
+	node->b = b;
+	node->min = node->max = 0;
+
+	return ps->nnodes++;
+}
+
+int reClassNew(reParser *ps){
+
+	if(ps->nclass == ps->classcap){
+
+		ps->classcap = ps->classcap ? ps->classcap * 2 : 16;
+		ps->classes = realloc(ps->classes, 32 * ps->classcap);
+	}
+
+	memset(ps->classes[ps->nclass], 0, 32);
+	return ps->nclass++;
+}
+
+// Add the bytes of escape class 'c' (d, w, s and their negations) to cls
+int reEscapeClass(unsigned char *cls, int c){
+
+	int negate = isupper(c) != 0;
+	int i;
+
+	switch(tolower(c)){
+
+		case 'd': case 'w': case 's': break;
+		default: return 0;
+	}
+
+	for(i = 0; i < 256; i++){
+
+		int in = ((tolower(c) == 'd') ? isdigit(i) : (tolower(c) == 'w') ? reIsWord(i) : isspace(i)) != 0;
+
+		if(in != negate && i != '\n')
+			RE_SET(cls, i);
+	}
+
+	return 1;
+}
+
+// Byte named by the escape '\c', -1 if it is not a plain character
+int reEscapeChar(reParser *ps, int c){
+
+	switch(c){
+
+		case 't': return '\t';
+		case 'n': return '\n';
+		case 'r': return '\r';
+		case 'f': return '\f';
+		case 'v': return '\v';
+		case 'e': return '\x1b';
+	}
+
+	if(c >= '1' && c <= '9')
+		ps->error = "backreferences are not supported";
+	else if(isalnum(c))
+		ps->error = "unknown escape";
+	else if(c == '\0')
+		ps->error = "trailing backslash";
+
+	return ps->error ? -1 : c;
+}
+
+int reParseClass(reParser *ps){
+
+	int cls = reClassNew(ps);
+	int negate = 0;
+	int first = 1;
+	int i;
+
+	if(ps->s[ps->pos] == '^'){
+
+		negate = 1;
+		ps->pos++;
+	}
+
+	while(ps->s[ps->pos] != ']' || first){
+
+		int c = (unsigned char)ps->s[ps->pos++];
+		int hi;
+
+		first = 0;
+
+		if(c == '\0'){
+
+			ps->error = "missing ]";
+			return -1;
+		}
+
+		if(c == '\\'){
+
+			c = (unsigned char)ps->s[ps->pos++];
+
+			if(reEscapeClass(ps->classes[cls], c))
+				continue;
+
+			if((c = reEscapeChar(ps, c)) < 0)
+				return -1;
+		}
+
+		hi = c;
+
+		if(ps->s[ps->pos] == '-' && ps->s[ps->pos + 1] != ']' && ps->s[ps->pos + 1] != '\0'){
+
+			hi = (unsigned char)ps->s[ps->pos + 1];
+			ps->pos += 2;
+
+			if(hi == '\\' && (hi = reEscapeChar(ps, (unsigned char)ps->s[ps->pos++])) < 0)
+				return -1;
+
+			if(hi < c){
+
+				ps->error = "bad range";
+				return -1;
+			}
+		}
+
+		for(i = c; i <= hi; i++)
+			RE_SET(ps->classes[cls], i);
+	}
+	ps->pos++;
+
+	if(negate){
+
+		for(i = 0; i < 32; i++)
+			ps->classes[cls][i] ^= 0xff;
+	}
+
+	// Lines never contain a newline
+	ps->classes[cls]['\n' >> 3] &= ~(1 << ('\n' & 7));
+
+	return reNodeNew(ps, RN_CLASS, cls, 0);
+}
+
+int reParseAlt(reParser *ps);
+
+int reParseAtom(reParser *ps){
+
+	int c = (unsigned char)ps->s[ps->pos++];
+	int cls, node;
+
+	switch(c){
+
+		case '(':
+
+			if(ps->s[ps->pos] == '?'){
+
+				if(ps->s[ps->pos + 1] != ':'){
+
+					ps->error = "lookaround is not supported";
+					return -1;
+				}
+				ps->pos += 2;
+			}
+
+			if(++ps->depth > 200){
+
+				ps->error = "too deeply nested";
+				return -1;
+			}
+
+			node = reParseAlt(ps);
+			ps->depth--;
+
+			if(node < 0)
+				return -1;
+
+			if(ps->s[ps->pos] != ')'){
+
+				ps->error = "missing )";
+				return -1;
+			}
+			ps->pos++;
+			return node;
+
+		case '[':
+			return reParseClass(ps);
+
+		case '.':
+
+			cls = reClassNew(ps);
+			memset(ps->classes[cls], 0xff, 32);
+			ps->classes[cls]['\n' >> 3] &= ~(1 << ('\n' & 7));
+			return reNodeNew(ps, RN_CLASS, cls, 0);
+
+		case '^':
+			return reNodeNew(ps, RN_ASSERT, RE_BOL, 0);
+
+		case '$':
+			return reNodeNew(ps, RN_ASSERT, RE_EOL, 0);
+
+		case '*': case '+': case '?':
+
+			ps->error = "nothing to repeat";
+			return -1;
+
+		case '\\':
+
+			c = (unsigned char)ps->s[ps->pos++];
+
+			if(c == 'b' || c == 'B')
+				return reNodeNew(ps, RN_ASSERT, c == 'b' ? RE_WORDB : RE_NWORDB, 0);
+
+			cls = reClassNew(ps);
+
+			if(reEscapeClass(ps->classes[cls], c))
+				return reNodeNew(ps, RN_CLASS, cls, 0);
+
+			if((c = reEscapeChar(ps, c)) < 0)
+				return -1;
+
+			RE_SET(ps->classes[cls], c);
+			return reNodeNew(ps, RN_CLASS, cls, 0);
+	}
+
+	cls = reClassNew(ps);
+	RE_SET(ps->classes[cls], c);
+	return reNodeNew(ps, RN_CLASS, cls, 0);
+}
+
+// Parse a {m}, {m,} or {m,n} bound, a '{' that starts none is a literal
+int reParseBound(reParser *ps, int *min, int *max){
+
+	const char *s = &ps->s[ps->pos];
+	char *end;
+	long lo, hi;
+
+	if(*s != '{' || !isdigit((unsigned char)s[1]))
+		return 0;
+
+	lo = hi = strtol(s + 1, &end, 10);
+
+	if(*end == ','){
+
+		hi = -1;
+		end++;
+
+		if(isdigit((unsigned char)*end))
+			hi = strtol(end, &end, 10);
+	}
+
+	if(*end != '}')
+		return 0;
+
+	if(lo > 255 || hi > 255 || (hi >= 0 && hi < lo)){
+
+		ps->error = "bad repeat count";
+		return 0;
+	}
+
+	*min = lo;
+	*max = hi;
+	ps->pos = end + 1 - ps->s;
+	return 1;
+}
+
+int reParseRepeat(reParser *ps){
+
+	int node = reParseAtom(ps);
+
+	while(node >= 0){
+
+		int min, max;
+		char c = ps->s[ps->pos];
+
+		if(c == '*' || c == '+' || c == '?'){
+
+			min = (c == '+');
+			max = (c == '?') ? 1 : -1;
+			ps->pos++;
+		}
+		else if(!reParseBound(ps, &min, &max))
+			return ps->error ? -1 : node;
+
+		node = reNodeNew(ps, RN_REPEAT, node, 0);
+		ps->nodes[node].min = min;
+		ps->nodes[node].max = max;
+	}
+
+	return node;
+}
+
+int reParseCat(reParser *ps){
+
+	int node = reNodeNew(ps, RN_EMPTY, 0, 0);
+
+	while(ps->s[ps->pos] != '\0' && ps->s[ps->pos] != '|' && ps->s[ps->pos] != ')'){
+
+		int next = reParseRepeat(ps);
+
+		if(next < 0)
+			return -1;
+
+		node = reNodeNew(ps, RN_CAT, node, next);
+	}
+
+	return node;
+}
+
+int reParseAlt(reParser *ps){
+
+	int node = reParseCat(ps);
+
+	while(node >= 0 && ps->s[ps->pos] == '|'){
+
+		ps->pos++;
+
+		int next = reParseCat(ps);
+
+		if(next < 0)
+			return -1;
+
+		node = reNodeNew(ps, RN_ALT, node, next);
+	}
+
+	return node;
+}
+
+int reEmit(struct editorRegex *re, reInst *prog, int op, int x, int y){
+
+	if(re->ninst == RE_MAX_INSTS)
+		return -1;
+
+	prog[re->ninst].op = op;
+	prog[re->ninst].x = x;
+	prog[re->ninst].y = y;
+
+	return re->ninst++;
+}
+
+/*
+	Compile the tree below 'n' into 'prog', -1 if the program grows too
+	large. Reversed, concatenations run back to front and the line start
+	and end trade places.
+*/
+int reCompileNode(struct editorRegex *re, reInst *prog, reParser *ps, int n, int reverse){
+
+	reNode *node = &ps->nodes[n];
+	int i, split, jmp;
+
+	switch(node->kind){
+
+		case RN_EMPTY:
+			return 0;
+
+		case RN_CLASS:
+			return reEmit(re, prog, RE_CLASS, node->a, 0) < 0 ? -1 : 0;
+
+		case RN_ASSERT:
+
+			i = node->a;
+
+			if(reverse && i <= RE_EOL)
+				i = (i == RE_BOL) ? RE_EOL : RE_BOL;
+
+			return reEmit(re, prog, RE_ASSERT, i, 0) < 0 ? -1 : 0;
+
+		case RN_CAT:
+
+			if(reverse)
+				return (reCompileNode(re, prog, ps, node->b, reverse) < 0 || reCompileNode(re, prog, ps, node->a, reverse) < 0) ? -1 : 0;
+
+			return (reCompileNode(re, prog, ps, node->a, reverse) < 0 || reCompileNode(re, prog, ps, node->b, reverse) < 0) ? -1 : 0;
+
+		case RN_ALT:
+
+			if((split = reEmit(re, prog, RE_SPLIT, 0, 0)) < 0)
+				return -1;
+
+			prog[split].x = re->ninst;
+
+			if(reCompileNode(re, prog, ps, node->a, reverse) < 0 || (jmp = reEmit(re, prog, RE_JMP, 0, 0)) < 0)
+				return -1;
+
+			prog[split].y = re->ninst;
+
+			if(reCompileNode(re, prog, ps, node->b, reverse) < 0)
+				return -1;
+
+			prog[jmp].x = re->ninst;
+			return 0;
+	}
+
+	// RN_REPEAT: the mandatory copies, then a loop or the optional ones
+	for(i = 0; i < node->min; i++){
+
+		if(reCompileNode(re, prog, ps, node->a, reverse) < 0)
+			return -1;
+	}
+
+	if(node->max < 0){
+
+		if((split = reEmit(re, prog, RE_SPLIT, 0, 0)) < 0)
+			return -1;
+
+		prog[split].x = re->ninst;
+
+		if(reCompileNode(re, prog, ps, node->a, reverse) < 0 || reEmit(re, prog, RE_JMP, split, 0) < 0)
+			return -1;
+
+		prog[split].y = re->ninst;
+		return 0;
+	}
+
+	int skip[256]; // Bounds are at most 255
+	int nskip = 0;
+
+	for(i = node->min; i < node->max; i++){
+
+		if((split = reEmit(re, prog, RE_SPLIT, 0, 0)) < 0)
+			return -1;
+
+		prog[split].x = re->ninst;
+		skip[nskip++] = split;
+
+		if(reCompileNode(re, prog, ps, node->a, reverse) < 0)
+			return -1;
+	}
+
+	// Every optional copy may skip to the end
+	for(i = 0; i < nskip; i++)
+		prog[skip[i]].y = re->ninst;
+
+	return 0;
+}
+
+/*
+	Collect the runs of plain characters in the concatenation below 'n'
+	and keep the longest in re->lit. Anything but a single byte ends a
+	run, assertions take no room and do not. *pos counts the nodes that
+	take room so far.
+*/
+void reLiteral(struct editorRegex *re, reParser *ps, int n, char *run, int *runlen, int *pos){
+
+	reNode *node = &ps->nodes[n];
+	int c, only = -1;
+
+	if(node->kind == RN_CAT){
+
+		reLiteral(re, ps, node->a, run, runlen, pos);
+		reLiteral(re, ps, node->b, run, runlen, pos);
+		return;
+	}
+
+	if(node->kind == RN_EMPTY || node->kind == RN_ASSERT)
+		return;
+
+	(*pos)++;
+
+	if(node->kind == RN_CLASS){
+
+		for(c = 0; c < 256; c++){
+
+			if(RE_HAS(ps->classes[node->a], c))
+				only = (only == -1) ? c : -2;
+		}
+	}
+
+	if(only >= 0 && *runlen < (int)sizeof(re->lit)){
+
+		run[(*runlen)++] = only;
+
+		if(*runlen > re->litlen){
+
+			memcpy(re->lit, run, *runlen);
+			re->litlen = *runlen;
+			re->litprefix = (*pos == *runlen);
+		}
+	}
+	else
+		*runlen = 0;
+}
+
+void reDfaFree(reDfa *d){
+
+	int i;
+
+	for(i = 0; i < d->nstates; i++)
+		free(d->states[i].set);
+
+	free(d->trans);
+	free(d->flags);
+	free(d->states);
+	free(d->table);
+}
+
+void editorRegexFree(struct editorRegex *re){
+
+	if(re == NULL)
+		return;
+
+	reDfaFree(&re->scan);
+	reDfaFree(&re->span);
+	reDfaFree(&re->rscan);
+	reDfaFree(&re->rspan);
+	free(re->prog);
+	free(re->rprog);
+	free(re->classes);
+	free(re->set);
+	free(re->stack);
+	free(re->mark);
+	free(re->thread_pc);
+	free(re->thread_start);
+	free(re);
+}
+
+void reDfaInit(reDfa *d, reInst *prog, int anchored){
+
+	d->prog = prog;
+	d->anchored = anchored;
+	d->trans = malloc(sizeof(int) * 256 * RE_DFA_STATES);
+	d->flags = malloc(RE_DFA_STATES);
+	d->states = malloc(sizeof(reDfaState) * RE_DFA_STATES);
+	d->table = malloc(sizeof(int) * 2 * RE_DFA_STATES);
+	d->nstates = 0;
+	d->start[0] = d->start[1] = -1;
+	memset(d->table, -1, sizeof(int) * 2 * RE_DFA_STATES);
+}
+
+// Compile 'pattern', on a syntax error *error is set and NULL returned
+struct editorRegex *editorRegexCompile(const char *pattern, const char **error){
+
+	reParser ps;
+	struct editorRegex *re;
+	int root;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.s = pattern;
+
+	root = reParseAlt(&ps);
+
+	if(root >= 0 && ps.s[ps.pos] == ')')
+		ps.error = "unmatched )";
+
+	if(root < 0 || ps.error){
+
+		*error = ps.error;
+		free(ps.nodes);
+		free(ps.classes);
+		return NULL;
+	}
+
+	re = calloc(1, sizeof(struct editorRegex));
+	re->prog = malloc(sizeof(reInst) * RE_MAX_INSTS);
+	re->rprog = malloc(sizeof(reInst) * RE_MAX_INSTS);
+
+	// Both directions take as many instructions
+	if(reCompileNode(re, re->rprog, &ps, root, 1) < 0 || reEmit(re, re->rprog, RE_MATCH, 0, 0) < 0 ||
+		(re->ninst = 0, reCompileNode(re, re->prog, &ps, root, 0) < 0) || reEmit(re, re->prog, RE_MATCH, 0, 0) < 0){
+
+		*error = "pattern too large";
+		free(ps.nodes);
+		free(ps.classes);
+		editorRegexFree(re);
+		return NULL;
+	}
+
+	char run[sizeof(re->lit)];
+	int runlen = 0;
+	int pos = 0;
+
+	reLiteral(re, &ps, root, run, &runlen, &pos);
+
+	free(ps.nodes);
+	re->classes = ps.classes;
+	re->nclass = ps.nclass;
+
+	reDfaInit(&re->scan, re->prog, 0);
+	reDfaInit(&re->span, re->prog, 1);
+	reDfaInit(&re->rscan, re->rprog, 0);
+	reDfaInit(&re->rspan, re->rprog, 1);
+	re->set = malloc(sizeof(int) * re->ninst);
+	re->stack = malloc(sizeof(int) * 2 * re->ninst);
+	re->mark = calloc(re->ninst, sizeof(int));
+	re->thread_pc = malloc(sizeof(int) * 2 * re->ninst);
+	re->thread_start = malloc(sizeof(char *) * 2 * re->ninst);
+
+	int n = 0;
+	int i, j;
+
+	re->gen++;
+	reDfaClosure(re, re->prog, 0, 1, 1, re->set, &n);
+
+	for(i = 0; i < n; i++){
+
+		reInst *in = &re->prog[re->set[i]];
+
+		if(in->op == RE_CLASS){
+
+			for(j = 0; j < 32; j++)
+				re->first[j] |= re->classes[in->x][j];
+		}
+
+		if(in->op == RE_MATCH)
+			re->pike = 1;
+	}
+
+	for(i = 0; i < re->ninst; i++){
+
+		if(re->prog[i].op == RE_ASSERT && re->prog[i].x >= RE_WORDB)
+			re->pike = 1;
+	}
+
+	return re;
+}
+
+/*
+	Add the states of 'prog' reachable from 'pc' without consuming a byte
+	to set. Kept are the byte consuming states, the match state and end of
+	line assertions, which a DFA can only settle once it sees the line end.
+*/
+void reDfaClosure(struct editorRegex *re, reInst *prog, int pc, int bol, int eol, int *set, int *n){
+
+	int sp = 0;
+
+	re->stack[sp++] = pc;
+
+	while(sp > 0){
+
+		pc = re->stack[--sp];
+
+		if(re->mark[pc] == re->gen)
+			continue;
+
+		re->mark[pc] = re->gen;
+
+		reInst *in = &prog[pc];
+
+		switch(in->op){
+
+			case RE_JMP:
+				re->stack[sp++] = in->x;
+				break;
+
+			case RE_SPLIT:
+				re->stack[sp++] = in->y;
+				re->stack[sp++] = in->x;
+				break;
+
+			case RE_ASSERT:
+
+				if(in->x == RE_EOL && !eol)
+					set[(*n)++] = pc;
+				else if(in->x != RE_BOL || bol)
+					re->stack[sp++] = pc + 1;
+				break;
+
+			default:
+				set[(*n)++] = pc;
+		}
+	}
+}
+
+int reIntCompare(const void *a, const void *b){
+
+	return *(const int *)a - *(const int *)b;
+}
+
+// Drop every DFA state, the cache is rebuilt as the text needs it
+void reDfaFlush(reDfa *d){
+
+	int i;
+
+	for(i = 0; i < d->nstates; i++)
+		free(d->states[i].set);
+
+	d->nstates = 0;
+	d->start[0] = d->start[1] = -1;
+	d->flushes++;
+	memset(d->table, -1, sizeof(int) * 2 * RE_DFA_STATES);
+}
+
+// State for the n sorted NFA states in re->set, made if it is new
+int reDfaAdd(struct editorRegex *re, reDfa *d, int n){
+
+	unsigned int hash = 2166136261u;
+	int i, slot;
+
+	for(i = 0; i < n; i++)
+		hash = (hash ^ re->set[i]) * 16777619u;
+
+	for(slot = hash % (2 * RE_DFA_STATES); d->table[slot] >= 0; slot = (slot + 1) % (2 * RE_DFA_STATES)){
+
+		reDfaState *st = &d->states[d->table[slot]];
+
+		if(st->hash == hash && st->nset == n && !memcmp(st->set, re->set, sizeof(int) * n))
+			return d->table[slot];
+	}
+
+	if(d->nstates == RE_DFA_STATES){
+
+		reDfaFlush(d);
+		for(slot = hash % (2 * RE_DFA_STATES); d->table[slot] >= 0; slot = (slot + 1) % (2 * RE_DFA_STATES));
+	}
+
+	int s = d->nstates++;
+	reDfaState *st = &d->states[s];
+	unsigned char flags = 0;
+
+	st->set = malloc(sizeof(int) * (n ? n : 1));
+	memcpy(st->set, re->set, sizeof(int) * n);
+	st->nset = n;
+	st->hash = hash;
+	d->table[slot] = s;
+	memset(&d->trans[s * 256], -1, sizeof(int) * 256);
+	d->trans[s * 256 + '\n'] = d->trans[s * 256 + '\r'] = -2;
+
+	if(n == 0)
+		flags |= RE_DEAD;
+
+	// Whether a match ends here, now or at the end of the line
+	for(i = 0; i < n; i++){
+
+		reInst *in = &d->prog[st->set[i]];
+
+		if(in->op == RE_MATCH)
+			flags |= RE_ACCEPT | RE_ACCEPT_EOL;
+
+		if(in->op == RE_ASSERT && !(flags & RE_ACCEPT_EOL)){
+
+			int m = 0, k;
+
+			// re->set is free again once copied to the state
+			re->gen++;
+			reDfaClosure(re, d->prog, st->set[i] + 1, 0, 1, re->set, &m);
+
+			for(k = 0; k < m; k++){
+
+				if(d->prog[re->set[k]].op == RE_MATCH)
+					flags |= RE_ACCEPT_EOL;
+			}
+		}
+	}
+
+	d->flags[s] = flags;
+	return s;
+}
+
+int reDfaStart(struct editorRegex *re, reDfa *d, int bol){
+
+	if(d->start[bol] < 0){
+
+		int n = 0;
+
+		re->gen++;
+		reDfaClosure(re, d->prog, 0, bol, 0, re->set, &n);
+		qsort(re->set, n, sizeof(int), reIntCompare);
+		d->start[bol] = reDfaAdd(re, d, n);
+	}
+
+	return d->start[bol];
+}
+
+// Follow byte c out of state s, unless anchored a new match may start after it
+int reDfaNext(struct editorRegex *re, reDfa *d, int s, int c){
+
+	reDfaState *st = &d->states[s];
+	int n = 0;
+	int i, next;
+
+	re->gen++;
+
+	for(i = 0; i < st->nset; i++){
+
+		reInst *in = &d->prog[st->set[i]];
+
+		if(in->op == RE_CLASS && RE_HAS(re->classes[in->x], c))
+			reDfaClosure(re, d->prog, st->set[i] + 1, 0, 0, re->set, &n);
+	}
+
+	if(!d->anchored)
+		reDfaClosure(re, d->prog, 0, 0, 0, re->set, &n);
+
+	qsort(re->set, n, sizeof(int), reIntCompare);
+
+	int flushes = d->flushes;
+
+	next = reDfaAdd(re, d, n);
+
+	// A flush took s with it, and line ends keep to the slow path
+	if(flushes == d->flushes && c != '\r' && c != '\n')
+		d->trans[s * 256 + c] = next;
+
+	return next;
+}
+
+// Whether the carriage return at 'p' is only followed by others up to the line end
+int reLineEnd(const char *p, const char *end){
+
+	while(p < end && *p == '\r')
+		p++;
+
+	return p == end || *p == '\n';
+}
+
+/*
+	Run the forward DFA over the lines in [p, end) and return where to
+	look for a match on the first line that can hold one, NULL if none
+	can. *bol is moved to the start of that line, *at and *state receive
+	where and in which state the first match on it ends. Newlines and
+	carriage returns have no transitions of their own, they take the slow
+	path.
+*/
+const char *reDfaScan(struct editorRegex *re, const char **bol, const char *p, const char *end, const char **at, int *state){
+
+	reDfa *d = &re->scan;
+	const char *from = p;
+	int s = reDfaStart(re, d, p == *bol);
+
+	while(1){
+
+		unsigned char f = d->flags[s];
+
+		*at = p;
+		*state = s;
+
+		if(f & RE_ACCEPT)
+			return from;
+
+		if(p < end && !(f & RE_DEAD)){
+
+			// Bytes no match starts with leave the start state as it is
+			if(s == d->start[0]){
+
+				while(p < end && !RE_HAS(re->first, *p) && *p != '\n' && *p != '\r')
+					p++;
+
+				if(p == end)
+					continue;
+			}
+
+			int next = d->trans[s * 256 + (unsigned char)*p];
+
+			if(next >= 0){
+
+				s = next;
+				p++;
+				continue;
+			}
+
+			if(next == -1 || (*p == '\r' && !reLineEnd(p, end))){
+
+				s = reDfaNext(re, d, s, (unsigned char)*p);
+				p++;
+				continue;
+			}
+		}
+
+		// At the end of the line, or nothing can match on it
+		if(f & RE_ACCEPT_EOL)
+			return from;
+
+		if(p == end || (p = memchr(p, '\n', end - p)) == NULL)
+			return NULL;
+
+		*bol = from = ++p;
+		s = reDfaStart(re, d, 1);
+	}
+}
+
+// State 's' of DFA 'from' in DFA 'to', which runs the same program
+int reDfaMove(struct editorRegex *re, reDfa *from, int s, reDfa *to){
+
+	reDfaState *st = &from->states[s];
+
+	memcpy(re->set, st->set, sizeof(int) * st->nset);
+	return reDfaAdd(re, to, st->nset);
+}
+
+/*
+	How far the matches that end first, at 'at' in scan state 's', and all
+	others that start before it can reach: the state is followed without
+	starting new matches until nothing is left of it.
+*/
+const char *reDfaReach(struct editorRegex *re, int s, const char *at, const char *eol){
+
+	reDfa *d = &re->span;
+	const char *reach = at;
+
+	s = reDfaMove(re, &re->scan, s, d);
+
+	while(at < eol && !(d->flags[s] & RE_DEAD)){
+
+		int c = (unsigned char)*at++;
+		int next = d->trans[s * 256 + c];
+
+		s = (next >= 0) ? next : reDfaNext(re, d, s, c);
+
+		if(d->flags[s] & RE_ACCEPT)
+			reach = at;
+	}
+
+	if(at == eol && (d->flags[s] & RE_ACCEPT_EOL))
+		reach = eol;
+
+	return reach;
+}
+
+/*
+	Where the leftmost match in [p, reach) starts, NULL if there is none.
+	The reversed pattern runs back from 'reach', which is where its line
+	starts if 'reach' is the line end, and accepts wherever a match starts.
+	No match ends before 'at', from there on no new ones are tried.
+*/
+const char *reDfaLeftmost(struct editorRegex *re, const char *bol, const char *p, const char *at, const char *reach, const char *eol){
+
+	reDfa *d = &re->rscan;
+	const char *q = reach;
+	const char *start = NULL;
+	int s = reDfaStart(re, d, reach == eol);
+
+	while(q > p && !(d->flags[s] & RE_DEAD)){
+
+		int c = (unsigned char)*--q;
+
+		if(q < at && d == &re->rscan){
+
+			s = reDfaMove(re, d, s, &re->rspan);
+			d = &re->rspan;
+		}
+
+		int next = d->trans[s * 256 + c];
+
+		s = (next >= 0) ? next : reDfaNext(re, d, s, c);
+
+		if(d->flags[s] & RE_ACCEPT)
+			start = q;
+	}
+
+	if(q == bol && (d->flags[s] & RE_ACCEPT_EOL))
+		start = q;
+
+	return start;
+}
+
+// Where the longest match starting at 'p' ends, NULL if there is none
+const char *reDfaLongest(struct editorRegex *re, const char *bol, const char *p, const char *eol){
+
+	reDfa *d = &re->span;
+	const char *end = NULL;
+	int s = reDfaStart(re, d, p == bol);
+
+	while(p < eol && !(d->flags[s] & RE_DEAD)){
+
+		int c = (unsigned char)*p++;
+		int next = d->trans[s * 256 + c];
+
+		s = (next >= 0) ? next : reDfaNext(re, d, s, c);
+
+		if(d->flags[s] & RE_ACCEPT)
+			end = p;
+	}
+
+	if(p == eol && (d->flags[s] & RE_ACCEPT_EOL))
+		end = p;
+
+	return end;
+}
+
+// Whether assertion 'a' holds at 'p' in the line [bol, eol)
+int reAssertAt(int a, const char *bol, const char *p, const char *eol){
+
+	int before, after;
+
+	switch(a){
+
+		case RE_BOL: return p == bol;
+		case RE_EOL: return p == eol;
+	}
+
+	before = (p > bol) && reIsWord((unsigned char)p[-1]);
+	after = (p < eol) && reIsWord((unsigned char)*p);
+
+	return (before != after) == (a == RE_WORDB);
+}
+
+/*
+	Add a Pike VM thread at 'pc' for a match starting at 'start' to the
+	list, following jumps and assertions at 'p'. A thread that reaches the
+	match state updates the best match instead.
+*/
+void rePikeAdd(struct editorRegex *re, int *pcs, const char **starts, int *n, int pc, const char *start, const char *bol, const char *p, const char *eol, const char **best, const char **best_end){
+
+	int sp = 0;
+
+	re->stack[sp++] = pc;
+
+	while(sp > 0){
+
+		pc = re->stack[--sp];
+
+		if(re->mark[pc] == re->gen)
+			continue;
+
+		re->mark[pc] = re->gen;
+
+		reInst *in = &re->prog[pc];
+
+		switch(in->op){
+
+			case RE_JMP:
+				re->stack[sp++] = in->x;
+				break;
+
+			case RE_SPLIT:
+				re->stack[sp++] = in->y;
+				re->stack[sp++] = in->x;
+				break;
+
+			case RE_ASSERT:
+
+				if(reAssertAt(in->x, bol, p, eol))
+					re->stack[sp++] = pc + 1;
+				break;
+
+			case RE_MATCH:
+
+				// Leftmost first, then longest, never empty
+				if(p > start && (*best == NULL || start < *best || (start == *best && p > *best_end))){
+
+					*best = start;
+					*best_end = p;
+				}
+				break;
+
+			default:
+				pcs[*n] = pc;
+				starts[*n] = start;
+				(*n)++;
+		}
+	}
+}
+
+// Leftmost longest non-empty match starting in [p, eol), *len receives its length
+const char *rePikeMatch(struct editorRegex *re, const char *bol, const char *p, const char *eol, size_t *len){
+
+	int *pcs = re->thread_pc;
+	const char **starts = re->thread_start;
+	int *npcs = re->thread_pc + re->ninst;
+	const char **nstarts = re->thread_start + re->ninst;
+	const char *best = NULL;
+	const char *best_end = NULL;
+	int n = 0;
+
+	while(p < eol && !RE_HAS(re->first, *p))
+		p++;
+
+	re->gen++;
+	rePikeAdd(re, pcs, starts, &n, 0, p, bol, p, eol, &best, &best_end);
+
+	while(p < eol && (n > 0 || best == NULL)){
+
+		int c = (unsigned char)*p;
+		int nn = 0;
+		int i;
+
+		re->gen++;
+
+		for(i = 0; i < n; i++){
+
+			// Threads that started after the best match cannot beat it
+			if(best && starts[i] > best)
+				break;
+
+			if(RE_HAS(re->classes[re->prog[pcs[i]].x], c))
+				rePikeAdd(re, npcs, nstarts, &nn, pcs[i] + 1, starts[i], bol, p + 1, eol, &best, &best_end);
+		}
+
+		p++;
+
+		// With no thread left skip to a byte that can start a match
+		if(best == NULL && nn == 0){
+
+			while(p < eol && !RE_HAS(re->first, *p))
+				p++;
+
+			re->gen++;
+		}
+
+		if(best == NULL && p < eol)
+			rePikeAdd(re, npcs, nstarts, &nn, 0, p, bol, p, eol, &best, &best_end);
+
+		int *tp = pcs; pcs = npcs; npcs = tp;
+		const char **ts = starts; starts = nstarts; nstarts = ts;
+		n = nn;
+	}
+
+	if(best)
+		*len = best_end - best;
+
+	return best;
+}
+
+/*
+	First match starting in [p, end), which may hold several lines. 'bol'
+	is the start of the line p is on, or any byte of that line before p:
+	it only tells whether p starts the line. Trailing carriage returns are
+	not part of a line, like editorMapLine has it.
+*/
+const char *editorRegexFind(struct editorRegex *re, const char *bol, const char *p, const char *end, size_t *len){
+
+	while(p < end){
+
+		const char *stop = end;
+		const char *nl, *eol, *hit, *at;
+		int state;
+
+		// Only lines with the literal of the pattern need the DFA
+		if(re->litlen){
+
+			const char *lit = editorMemMem(p, end - p, re->lit, re->litlen);
+
+			if(lit == NULL)
+				return NULL;
+
+			// A match starting at the literal needs no look at the line before it
+			if(re->litprefix && lit > p)
+				bol = (lit[-1] == '\n') ? lit : lit - 1;
+
+			for(hit = lit; !re->litprefix && hit > p && hit[-1] != '\n'; hit--);
+
+			if(re->litprefix)
+				p = lit;
+			else if(hit > p)
+				p = bol = hit;
+
+			stop = (nl = memchr(lit, '\n', end - lit)) ? nl : end;
+		}
+
+		if((p = reDfaScan(re, &bol, p, stop, &at, &state)) == NULL){
+
+			if(stop == end)
+				return NULL;
+
+			p = bol = stop + 1;
+			continue;
+		}
+
+		nl = memchr(p, '\n', end - p);
+		eol = nl ? nl : end;
+
+		while(eol > p && eol[-1] == '\r')
+			eol--;
+
+		if(re->pike){
+
+			if((hit = rePikeMatch(re, bol, p, eol, len)) != NULL)
+				return hit;
+		}
+		else{
+
+			// Every match starting before the first to end finishes by 'reach'
+			const char *reach = reDfaReach(re, state, at, eol);
+
+			hit = reDfaLeftmost(re, bol, p, at, reach, eol);
+			*len = reDfaLongest(re, bol, hit, eol) - hit;
+			return hit;
+		}
+
+		if(nl == NULL)
+			break;
+
+		p = bol = nl + 1;
+	}
+
+	return NULL;
+}
+
+/*
+	First match of the search query starting in [p, end), *len receives
+	its length. 'bol' is the start of the line p is on; matches never span
+	lines.
+*/
+const char *editorQueryFind(const char *bol, const char *p, const char *end, size_t *len){
+
+	if(E.match.regex)
+		return editorRegexFind(E.match.regex, bol, p, end, len);
+
+	*len = E.match.len;
+	return editorMemMem(p, end - p, E.match.query, E.match.len);
+}
+
+// Last match that starts in [p, limit)
+const char *editorQueryFindLast(const char *bol, const char *p, const char *end, const char *limit, size_t *len){
+
+	const char *last = NULL;
+	const char *hit;
+	size_t hitlen;
+
+	while(p < limit && (hit = editorQueryFind(bol, p, end, &hitlen)) != NULL && hit < limit){
+
+		// Keep bol on the line of the hit
+		const char *q = hit;
+
+		while(q > p && q[-1] != '\n')
+			q--;
+
+		if(q > p)
+			bol = q;
+
+		last = hit;
+		*len = hitlen;
+		p = hit + 1;
+	}
+
+	return last;
+}
+
+// Line number within a lazy node of the byte at 'p'
+int editorLazyLine(rowLazy *lz, const char *p){
+
+	const char *q = E.map + lz->start;
+	int line = 0;
+
+	while((q = memchr(q, '\n', p - q)) != NULL){
+
+		line++;
+		q++;
+	}
+
+	return line;
+}
+
+// Offset of line 'line' within a lazy node
+off_t editorLazyLineStart(rowLazy *lz, int line){
+
+	char *p = E.map + lz->start;
+	char *end = E.map + lz->end;
+
+	if(line >= lz->h.n)
+		return lz->end;
+
+	while(line-- > 0)
+		p = (char *)memchr(p, '\n', end - p) + 1;
+
+	return p - E.map;
+}
+
+/*
+	Search one leaf level node for the first (direction 1) or last
+	(direction -1) match of the query in rows [from, to) of the node,
+	limited to columns at or after *col in row 'from' going forward, or
+	before *col in row to - 1 going backward (*col < 0 means no limit).
+	Lazy nodes are searched straight from the mapping. On a match the
+	row within the node is returned and *col set, else -1.
+*/
+int editorSearchNode(rowNode *node, int from, int to, int direction, long *col){
+
+	size_t len;
+	int j;
+
+	if(node->kind == ROW_LAZY){
+
+		rowLazy *lz = (rowLazy *)node;
+		char *lo = E.map + editorLazyLineStart(lz, from);
+		char *hi = E.map + editorLazyLineStart(lz, to);
+		const char *hit;
+
+		if(direction == 1){
+
+			char *bol = lo;
+			char *next;
+
+			// A column past the end of the line continues on the next one
+			if(*col > 0 && (size_t)*col <= editorMapLine(lo, hi, &next))
+				lo += *col;
+			else if(*col > 0)
+				lo = bol = next;
+
+			hit = editorQueryFind(bol, lo, hi, &len);
+		}
+		else{
+
+			char *limit = hi;
+
+			if(*col >= 0 && editorLazyLineStart(lz, to - 1) + *col < hi - E.map)
+				limit = E.map + editorLazyLineStart(lz, to - 1) + *col;
+
+			hit = editorQueryFindLast(lo, lo, hi, limit, &len);
+		}
+
+		if(hit == NULL)
+			return -1;
+
+		j = editorLazyLine(lz, hit);
+		*col = hit - (E.map + editorLazyLineStart(lz, j));
+		return j;
+	}
+
+	rowLeaf *leaf = (rowLeaf *)node;
+
+	for(j = (direction == 1) ? from : to - 1; j >= from && j < to; j += direction){
+
+		erow *row = &leaf->rows[j];
+		char *end = &row->chars[row->size];
+		const char *hit;
+
+		if(direction == 1){
+
+			long start = (j == from && *col > 0) ? *col : 0;
+
+			if(start > row->size)
+				continue;
+
+			hit = editorQueryFind(row->chars, &row->chars[start], end, &len);
+		}
+		else{
+
+			char *limit = end;
+
+			if(j == to - 1 && *col >= 0 && *col < row->size)
+				limit = &row->chars[*col];
+
+			hit = editorQueryFindLast(row->chars, row->chars, end, limit, &len);
+		}
+
+		if(hit){
+
+			*col = hit - row->chars;
+			return j;
+		}
+	}
+
+	return -1;
+}
+
+/*
+	Find the next match of the search query from (*at_row, *at_col), the
+	position itself included going forward and excluded going backward,
+	wrapping around the end of the buffer.
+*/
+int editorSearch(long *at_row, long *at_col, int direction){
+
+	long row = *at_row;
+	long col = *at_col;
+	long visited = 0;
+
+	if(E.numrows == 0 || E.match.query == NULL || (E.match.use_regex && E.match.regex == NULL))
+		return 0;
+
+	while(visited <= E.numrows){
+
+		int slot;
+		long base;
+		rowNode *node = rowTreeFind(row, &slot, &base);
+		int from = (direction == 1) ? slot : 0;
+		int to = (direction == 1) ? node->n : slot + 1;
+		int j = editorSearchNode(node, from, to, direction, &col);
+
+		if(j >= 0){
+
+			*at_row = base + j;
+			*at_col = col;
+			return 1;
+		}
+
+		visited += to - from;
+		col = -1;
+
+		if(direction == 1)
+			row = (base + node->n == E.numrows) ? 0 : base + node->n;
+		else
+			row = (base == 0) ? E.numrows - 1 : base - 1;
+	}
+
+	return 0;
+}
+
+void editorMatchAdd(long row, long col){
+
+	struct editorMatchIndex *mi = &E.match;
+
+	mi->total++;
+
+	if(mi->count == EDITOR_MATCH_MAX)
+		return;
+
+	if(mi->count == mi->cap){
+
+		mi->cap = mi->cap ? mi->cap * 2 : 1024;
+		mi->row = realloc(mi->row, sizeof(long) * mi->cap);
+		mi->col = realloc(mi->col, sizeof(long) * mi->cap);
+	}
+
+	mi->row[mi->count] = row;
+	mi->col[mi->count] = col;
+	mi->count++;
+}
+
+// Add the matches of one leaf level node to the index
+void editorMatchStep(){
+
+	struct editorMatchIndex *mi = &E.match;
+	int slot, j;
+	long base;
+	size_t len;
+	rowNode *node = rowTreeFind(mi->scan_row, &slot, &base);
+
+	if(node->kind == ROW_LAZY){
+
+		rowLazy *lz = (rowLazy *)node;
+		const char *line = E.map + editorLazyLineStart(lz, slot);
+		const char *end = E.map + lz->end;
+		const char *p = line;
+
+		j = slot;
+
+		while((p = editorQueryFind(line, p, end, &len)) != NULL){
+
+			const char *nl;
+
+			while((nl = memchr(line, '\n', p - line)) != NULL){
+
+				line = nl + 1;
+				j++;
+			}
+
+			editorMatchAdd(base + j, p - line);
+			p++;
+		}
+	}
+	else{
+
+		rowLeaf *leaf = (rowLeaf *)node;
+
+		for(j = slot; j < node->n; j++){
+
+			erow *row = &leaf->rows[j];
+			const char *p = row->chars;
+
+			while((p = editorQueryFind(row->chars, p, &row->chars[row->size], &len)) != NULL){
+
+				editorMatchAdd(base + j, p - row->chars);
+				p++;
+			}
+		}
+	}
+
+	mi->scan_row = base + node->n;
+
+	if(mi->count == mi->total)
+		mi->indexed_row = mi->scan_row;
+
+	if(mi->scan_row >= E.numrows)
+		mi->done = 1;
+}
+
+void *editorMatchWorker(void *arg){
+
+	(void)arg;
+	pthread_mutex_lock(&E.lock);
+
+	while(1){
+
+		while(E.match.query == NULL || E.match.done)
+			pthread_cond_wait(&E.match.wake, &E.lock);
+
+		editorMatchStep();
+		editorYieldLock();
+	}
+
+	return NULL;
+}
+
+// Start indexing the matches of 'query', NULL ends the search
+void editorMatchSet(const char *query){
+
+	struct editorMatchIndex *mi = &E.match;
+
+	free(mi->query);
+	mi->query = (query && *query) ? strdup(query) : NULL;
+	mi->len = mi->query ? strlen(query) : 0;
+	mi->count = 0;
+	mi->total = 0;
+	mi->indexed_row = 0;
+	mi->scan_row = 0;
+	mi->done = (E.numrows == 0);
+	mi->shown = -1;
+	mi->error = NULL;
+
+	editorRegexFree(mi->regex);
+	mi->regex = NULL;
+
+	if(mi->query && mi->use_regex && (mi->regex = editorRegexCompile(mi->query, &mi->error)) == NULL)
+		mi->done = 1;
+
+	if(mi->query == NULL){
+
+		free(mi->row);
+		free(mi->col);
+		mi->row = mi->col = NULL;
+		mi->cap = 0;
+		return;
+	}
+
+	if(!mi->running){
+
+		if(pthread_create(&mi->thread, NULL, editorMatchWorker, NULL) != 0)
+			die("pthread_create");
+
+		pthread_detach(mi->thread);
+		mi->running = 1;
+	}
+
+	pthread_cond_signal(&mi->wake);
+}
+
+// Whether every match is stored
+int editorMatchComplete(){
+
+	return E.match.done && E.match.count == E.match.total;
+}
+
+// Status bar state of the index, changes whenever it needs a redraw
+long editorMatchProgress(){
+
+	return E.match.done ? E.match.total : -E.match.total - 1;
+}
+
+// Index of the first stored match at or after (row, col)
+int editorMatchFind(long row, long col){
+
+	int lo = 0;
+	int hi = E.match.count;
+
+	while(lo < hi){
+
+		int mid = lo + (hi - lo) / 2;
+
+		if(E.match.row[mid] < row || (E.match.row[mid] == row && E.match.col[mid] < col))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+	Step from the match at (*at_row, *at_col) to the next or previous one
+	through the index. Stored matches are a prefix of all matches, so the
+	rows the worker has not reached yet fall back to editorSearch.
+*/
+int editorMatchNext(long *at_row, long *at_col, int direction){
+
+	struct editorMatchIndex *mi = &E.match;
+	int k = editorMatchFind(*at_row, *at_col + (direction == 1));
+
+	if(direction == 1){
+
+		if(k == mi->count && editorMatchComplete())
+			k = 0;
+	}
+	else if(k < mi->count || *at_row < mi->indexed_row){
+
+		k--;
+		if(k < 0 && editorMatchComplete())
+			k = mi->count - 1;
+	}
+	else
+		k = -1;
+
+	if(k < 0 || k >= mi->count){
+
+		if(direction == 1)
+			(*at_col)++;
+
+		return editorSearch(at_row, at_col, direction);
+	}
+
+	*at_row = mi->row[k];
+	*at_col = mi->col[k];
+	return 1;
+}
+
+/*
+	Render columns [spans[2i], spans[2i + 1]) of the matches that are on
+	screen in 'row', drawn from column 'from' on, at most 'max' of them.
+*/
+int editorRowMatchSpans(erow *row, long from, long *spans, int max){
+
+	const char *p = row->chars;
+	size_t len;
+	long cx = 0;
+	long rx = 0;
+	int n = 0;
+
+	if(E.match.query == NULL || (E.match.use_regex && E.match.regex == NULL))
+		return 0;
+
+	while(n < max && (p = editorQueryFind(row->chars, p, &row->chars[row->size], &len)) != NULL){
+
+		// Rows with a tab map look the column up, others walk on from the last match
+		rx = (row->flags & ROW_TABMAP) ? editorRowCxToRx(row, p - row->chars) : editorRowCxToRxFrom(row, cx, rx, p - row->chars);
+		cx = p - row->chars;
+
+		if(rx >= from + E.screencols)
+			break;
+
+		// A match that holds a tab is wider than it is long
+		long end = editorRowCxToRxFrom(row, cx, rx, cx + len);
+
+		if(end > from){
+
+			spans[2 * n] = rx;
+			spans[2 * n + 1] = end;
+			n++;
+		}
+		p++;
+	}
+
+	return n;
+}
+
+// Incremental search 
+void editorFindCallback(char *query, int key){
+
+
+ // Searching in forward and backward direction
+	static long last_row = -1;
+	static long last_col = -1;
+
+	if (key == '\r' || key == '\x1b'){
+
+		last_row = last_col = -1;
+		editorMatchSet(NULL);
+    	return;
+	}
+
+	long at_row = last_row;
+	long at_col = last_col;
+	int found;
+
+	if(key == ARROW_RIGHT || key == ARROW_DOWN || key == ARROW_LEFT || key == ARROW_UP){
+
+		int direction = (key == ARROW_LEFT || key == ARROW_UP) ? -1 : 1;
+
+		if(E.match.query == NULL)
+			return;
+
+		// Without a match both directions start over from the top
+		if(last_row == -1){
+
+			at_row = at_col = 0;
+			found = editorSearch(&at_row, &at_col, 1);
+		}
+		else
+			found = editorMatchNext(&at_row, &at_col, direction);
+	}
+	else{
+
+		// An edited query is matched again from the current match onwards
+		if(last_row == -1)
+			at_row = at_col = 0;
+
+		if(E.match.query == NULL || strcmp(query, E.match.query))
+			editorMatchSet(query);
+
+		found = editorSearch(&at_row, &at_col, 1);
+	}
+
+	if(!found){
+
+		last_row = last_col = -1;
+		return;
+	}
+
+	last_row = at_row;
+	last_col = at_col;
+	E.cy = at_row;
+	E.cx = at_col;
+	E.rowoff = E.numrows;
+
+}
+// Search utility function
+void editorFind(int regex){
+
+// Restore cursor position when search is cancelled
+
+	editorScanFinish();
+
+	long saved_cx = E.cx;
+  	long saved_cy = E.cy;
+  	long saved_coloff = E.coloff;
+  	long saved_rowoff = E.rowoff;
+  	long saved_segoff = E.segoff;
+
+	E.match.use_regex = regex;
+
+	char *query = editorPrompt(regex ? "Regex: %s (Use ESC/Arrows/Enter)" : "Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+
+	if(query)
+		free(query);
+
+	else{
+
+		E.cx = saved_cx; 
+		E.cy = saved_cy;
+    	E.coloff = saved_coloff;
+    	E.rowoff = saved_rowoff;
+    	E.segoff = saved_segoff;
+
+	}
+
+}
+/*
+	Jump to a line, to a percentage of the lines with N%, or to a byte
+	offset of the text as saved with @N. The row tree finds either from
+	its counts, without walking the rows before it.
+*/
+void editorGoto(){
+
+	char *query = editorPrompt("Go to line, N%% or @offset: %s (ESC to cancel)", NULL);
+	char *end;
+
+	if(query == NULL)
+		return;
+
+	char *number = (query[0] == '@') ? &query[1] : query;
+	long long n = strtoll(number, &end, 10);
+
+	if(end == number || n < 0 || (*end != '\0' && (*end != '%' || end[1] != '\0' || number != query))){
+
+		editorSetStatusMessage("Not a line, percentage or offset: %s", query);
+		free(query);
+		return;
+	}
+
+	E.cx = 0;
+
+	if(number != query){
+
+		editorScanToOffset(n);
+		E.cy = rowTreeLine(n, &E.cx);
+	}
+	else if(*end == '%'){
+
+		editorScanFinish();
+		E.cy = (n >= 100) ? E.numrows - 1 : (long)(E.numrows * n / 100);
+	}
+	else{
+
+		editorScanTo(n);
+		E.cy = (n > E.numrows) ? E.numrows - 1 : (long)n - 1;
+	}
+
+	if(E.cy < 0)
+		E.cy = 0;
+
+	// The line lands in the middle of the screen
+	E.rowoff = E.cy > E.screenrows / 2 ? E.cy - E.screenrows / 2 : 0;
+	E.segoff = 0;
+	free(query);
+}
+
+/*
+	Scroll by screen lines when long lines wrap. The rows that can share
+	the screen with the cursor are laid out, the tree gives the line of
+	the cursor and of the top of the screen, and the top row is found
+	back from its line.
+*/
+void editorScrollWrap(){
+
+	long j, seg = 0, col = 0;
+
+	E.coloff = 0;
+	E.rx = 0;
+
+	for(j = E.cy > E.screenrows ? E.cy - E.screenrows : 0; j <= E.cy && j < E.numrows; j++)
+		editorRowSegs(j);
+
+	if(E.rowoff < E.numrows)
+		editorRowSegs(E.rowoff);
+
+	if(E.cy < E.numrows){
+
+		erow *row = editorRowRender(E.cy);
+
+		E.rx = editorRowCxToRx(row, E.cx);
+		seg = editorRowSegment(row, E.rx, &col);
+	}
+
+	long cur = rowTreeWrapLine(E.cy) + seg;
+	long top = rowTreeWrapLine(E.rowoff) + E.segoff;
+
+	if(cur < top)
+		top = cur;
+
+	if(cur >= top + E.screenrows)
+		top = cur - E.screenrows + 1;
+
+	E.rowoff = rowTreeWrapRow(top, &E.segoff);
+	E.cursor_y = cur - top;
+	E.cursor_x = col;
+}
+
+void editorScroll(){
+
+	editorScanTo(E.cy + E.screenrows);
+
+	if(E.wrap){
+
+		editorScrollWrap();
+		return;
+	}
+
+	// The cursor row is drawn anyway, rendered it has its tab map
+	E.rx = 0;
+	if(E.cy < E.numrows)
+		E.rx = editorRowCxToRx(editorRowRender(E.cy), E.cx);
+
+	if(E.cy < E.rowoff)
+		E.rowoff = E.cy;
+
+	if(E.cy >= E.rowoff + E.screenrows)
+		E.rowoff = E.cy - E.screenrows + 1;
+
+	if(E.rx < E.coloff)
+		E.coloff = E.rx;
+
+	if(E.rx >= E.coloff + E.screencols)
+		E.coloff = E.rx - E.screencols + 1;
+
+	E.cursor_y = E.cy - E.rowoff;
+	E.cursor_x = E.rx - E.coloff;
+
+}
+// Write 'n' with thousands separators, as in 12,480
+void editorFormatCount(char *buf, long n){
+
+	char digits[24];
+	int len = snprintf(digits, sizeof(digits), "%ld", n);
+	int i;
+
+	for(i = 0; i < len; i++){
+
+		*buf++ = digits[i];
+
+		if(i < len - 1 && (len - 1 - i) % 3 == 0)
+			*buf++ = ',';
+	}
+	*buf = '\0';
+}
+
+// Status bar drawing utility -> Inverted colors 
+void editorDrawStatusBar(struct editorFrame *f){
+
+	int y = E.screenrows;
+
+	editorFrameClearRow(f, y);
+
+	char status[80],rstatus[80],which[32] = "";
+
+	if(E.nbuffers > 1)
+		snprintf(which, sizeof(which), " [%d/%d]", E.buffer + 1, E.nbuffers);
+
+	int len = snprintf(status, sizeof(status), "%.20s%s - %ld%s lines %s", E.filename ? E.filename : "[No Name]", which, E.numrows, E.scan_done ? "" : "+", E.dirty ? "(modified)": "");
+
+	// Position of the cursor among the matches while searching
+	if(E.match.query && len < (int)sizeof(status)){
+
+		char at[32], total[32];
+
+		if(len > 0 && status[len - 1] == ' ')
+			len--;
+
+		int k = editorMatchFind(E.cy, E.cx);
+		const char *more = E.match.done ? "" : "+";
+
+		editorFormatCount(total, E.match.total);
+
+		if(E.match.error)
+			len += snprintf(&status[len], sizeof(status) - len, " - %s", E.match.error);
+
+		else if(k < E.match.count && E.match.row[k] == E.cy && E.match.col[k] == E.cx){
+
+			editorFormatCount(at, k + 1);
+			len += snprintf(&status[len], sizeof(status) - len, " - match %s of %s%s", at, total, more);
+		}
+		else
+			len += snprintf(&status[len], sizeof(status) - len, " - %s%s matches", total, more);
+
+		if(len >= (int)sizeof(status))
+			len = sizeof(status) - 1;
+
+		E.match.shown = editorMatchProgress();
+	}
+
+	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %ld/%ld", E.syntax ? E.syntax->filetype : "no filetype", E.cy + 1, E.numrows);
+
+	if(len > E.screencols)
+		len = E.screencols;
+
+	// The whole bar is inverted, padding included
+	memset(&f->attrs[y * f->cols], ATTR_INVERSE, f->cols);
+	f->used[y] = f->cols;
+	editorFramePut(f, y, 0, status, len, ATTR_INVERSE);
+
+	if(E.screencols - len >= rlen)
+		editorFramePut(f, y, E.screencols - rlen, rstatus, rlen, ATTR_INVERSE);
+}
+
+void editorDrawMessageBar(struct editorFrame *f){
+
+	int y = E.screenrows + 1;
+
+	editorFrameClearRow(f, y);
+
+	int msglen = strlen(E.statusmsg);
+
+	if(msglen > E.screencols)
+		msglen = E.screencols;
+
+	// 5 second message flash
+	if(msglen && time(NULL) - E.statusmsg_time < 5)
+		editorFramePut(f, y, 0, E.statusmsg, msglen, 0);
+
+}
+/*
+	Row y of the frame from a row with UTF-8 in it, a character at a time
+	from screen column 'from' on, each in the color of its first byte.
+	A wide character cut by the left edge leaves a blank.
+*/
+void editorDrawRowUtf8(struct editorFrame *f, int y, erow *row, long from, unsigned char *colors, long *spans, int nspans){
+
+	char *c = editorRowRenderText(row);
+	unsigned char *hl = editorRowHighlight(row);
+	long j = 0, rx = 0;
+	int s = 0;
+
+	while(j < row->rsize && rx < from + f->cols){
+
+		uint32_t cp = (unsigned char)c[j];
+		int len = 1, width = 1;
+
+		if(cp >= 0x80){
+
+			len = editorUtf8Decode(&c[j], row->rsize - j, &cp);
+			width = editorCharControl(cp, len) ? 1 : editorCharWidth(cp);
+		}
+
+		long x = rx - from;
+		unsigned char attr = colors[hl[j]];
+
+		while(s < nspans && spans[2 * s + 1] <= rx)
+			s++;
+
+		if(s < nspans && spans[2 * s] <= rx)
+			attr = colors[HL_MATCH];
+
+		if(x < 0){
+
+			if(x + width > 0)
+				editorFramePutChar(f, y, 0, " ", 1, 1, attr);
+		}
+		else if(editorCharControl(cp, len)){
+
+			char sym = (cp <= 26) ? '@' + cp : '?';
+
+			editorFramePutChar(f, y, x, &sym, 1, 1, ATTR_INVERSE);
+		}
+		else
+			editorFramePutChar(f, y, x, &c[j], len, width, attr);
+
+		rx += width;
+		j += len;
+	}
+}
+
+// Draw tildes in the buffer and not actual file 
+void editorDrawRows(struct editorFrame *f) {
+
+  unsigned char colors[HL_MATCH + 1];
+  long filerow = E.rowoff, seg = E.segoff;
+  int y;
+
+  for (y = 0; y <= HL_MATCH; y++)
+    colors[y] = (y == HL_NORMAL) ? 0 : editorSyntaxToColor(y);
+
+  // Wrapped rows take a screen line per segment, from line E.segoff of the top one
+  for (y = 0; y < E.screenrows; y++, filerow += !E.wrap) {
+
+    long from = E.coloff;
+
+    editorFrameClearRow(f, y);
+
+    if (filerow >= E.numrows) {
+
+      // Print welcome message to center of terminal 
+      if (E.numrows == 0 && y == E.screenrows / 3) {
+
+        char welcome[80];
+        int welcomelen = snprintf(welcome, sizeof(welcome),
+          "Editor -- version %s", EDITOR_VERSION);
+
+        if (welcomelen > E.screencols)
+        	welcomelen = E.screencols;
+
+        int padding = (E.screencols - welcomelen) / 2;
+
+        editorFramePut(f, y, 0, "~", 1, 0);
+        editorFramePut(f, y, padding, welcome, welcomelen, 0);
+      } 
+      else {
+
+        editorFramePut(f, y, 0, "~", 1, 0);
+
+      }
+
+    } 
+    else {
+
+      erow *row = editorRowRender(filerow);
+
+      if (E.wrap) {
+
+        from = editorRowSegmentRx(row, seg, 0);
+
+        if (++seg >= editorRowSegs(filerow)) {
+
+          filerow++;
+          seg = 0;
+        }
+      }
+
+      // Matches of the search query are drawn over the syntax colors
+      long spans[2 * (E.screencols + 1)];
+      int nspans = editorRowMatchSpans(row, from, spans, E.screencols + 1);
+
+      if (row->flags & ROW_UTF8) {
+
+        editorDrawRowUtf8(f, y, row, from, colors, spans, nspans);
+        continue;
+      }
+
+      long len = row->rsize - from;
+      if(len < 0)
+      	len = 0;
+
+      if (len > E.screencols) 
+      	len = E.screencols;
+
+      char *c = &editorRowRenderText(row)[from];
+      unsigned char *hl = editorRowHighlight(row); // NULL for an empty row
+      char *cell = &f->chars[y * f->cols];
+      unsigned char *attr = &f->attrs[y * f->cols];
+      int j, s;
+
+      memcpy(cell, c, len);
+      f->used[y] = len;
+
+      for(j = 0; j < len; j++)
+      	attr[j] = colors[hl[from + j]];
+
+      for(s = 0; s < nspans; s++){
+
+      	  long start = spans[2 * s] - from;
+      	  long to = spans[2 * s + 1] - from;
+
+      	  if(start < 0)
+      	  	start = 0;
+      	  if(to > len)
+      	  	to = len;
+      	  if(start < to)
+      	  	memset(&attr[start], colors[HL_MATCH], to - start);
+      }
+
+      for(j = 0; j < len; j++){
+
+      	  if ((unsigned char)c[j] < 32 || c[j] == 127) {
+
+      	  	cell[j] = (c[j] <= 26) ? '@' + c[j] : '?';
+      	  	attr[j] = ATTR_INVERSE;
+          }
+      }
+    }
+
+  }
+
+}
+
+/*
+	Draw the frame into E.frame and write to the terminal only what
+	differs from the one on it. Drawing nothing new, as after a plain
+	cursor move, writes just the move.
+*/
+void  editorRefreshScreen(){
+
+	editorScroll();
+
+	editorFrameResize(&E.frame, E.screenrows + 2, E.screencols);
+	editorDrawRows(&E.frame);
+	editorCacheTrim();
+	editorDrawStatusBar(&E.frame);
+	editorDrawMessageBar(&E.frame);
+
+	struct abuf *ab = &E.out;
+
+	ab->len = 0;
+	abAppend(ab, "\x1b[?25l",6); // To hide cursor while redrawing
+	editorFrameDiff(ab);
+
+	// Nothing was drawn, the cursor can stay visible
+	if(ab->len == 6)
+		ab->len = 0;
+
+	int cy = E.cursor_y, cx = E.cursor_x;
+
+	if(cy != E.shown_cy || cx != E.shown_cx){
+
+		char buf[32];
+		snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cy + 1, cx + 1); // Specify exact position of cursor 
+		abAppend(ab, buf, strlen(buf));
+	}
+
+	E.shown_cy = cy;
+	E.shown_cx = cx;
+
+	if(ab->len > 6 && memcmp(ab->b, "\x1b[?25l", 6) == 0)
+		abAppend(ab, "\x1b[?25h",6); // h -> set mode 
+
+	// Finally write the buffer to the terminal
+	if(ab->len)
+		write(E.out_fd, ab->b, ab->len);
+
+	E.frame_bytes = ab->len;
+	E.frames++;
+	E.frames_bytes += ab->len;
+
+}
+
+void editorSetStatusMessage(const char *fmt, ...){
+
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+	va_end(ap);
+
+	E.statusmsg_time = time(NULL);
+
+}
+
+/*
+	Move the cursor a screen line up or down when long lines wrap,
+	keeping its column on the screen. A tab cut by the edge of a line
+	starts on the line before, the cursor goes past it onto the line.
+*/
+void editorWrapMove(int dir){
+
+	erow *row = editorRowAt(E.cy);
+	long col = 0, seg = row ? editorRowSegment(row, editorRowCxToRx(row, E.cx), &col) : 0;
+
+	if(dir < 0 && seg > 0)
+		seg--;
+
+	else if(dir < 0 && E.cy > 0)
+		seg = editorRowSegs(--E.cy) - 1;
+
+	else if(dir > 0 && row && seg + 1 < editorRowSegs(E.cy))
+		seg++;
+
+	else if(dir > 0 && E.cy < E.numrows){
+
+		E.cy++;
+		seg = 0;
+	}
+
+	row = editorRowAt(E.cy);
+
+	if(row == NULL)
+		return;
+
+	E.cx = editorRowRxToCx(row, editorRowSegmentRx(row, seg, col));
+
+	if(E.cx < row->size && editorRowSegment(row, editorRowCxToRx(row, E.cx), &col) < seg){
+
+		long next = editorRowNextChar(row, E.cx);
+
+		// Going up a line that is all tab, the cursor stays on the tab above it
+		if(dir > 0 || editorRowSegment(row, editorRowCxToRx(row, next), &col) == seg)
+			E.cx = next;
+	}
+}
+
+/*
+	The screen line a screen above the top of the screen or below its
+	bottom when long lines wrap, as PAGE_UP and PAGE_DOWN go in rows.
+	The rows in between are laid out first.
+*/
+void editorWrapPage(int dir){
+
+	long j, seg;
+	long from = dir < 0 ? E.rowoff - E.screenrows : E.rowoff;
+	long to = dir < 0 ? E.rowoff : E.rowoff + 2 * E.screenrows;
+
+	editorScanTo(to);
+
+	for(j = from > 0 ? from : 0; j <= to && j < E.numrows; j++)
+		editorRowSegs(j);
+
+	long top = rowTreeWrapLine(E.rowoff) + E.segoff;
+	long line = dir < 0 ? top - E.screenrows : top + 2 * E.screenrows - 1;
+
+	E.cy = rowTreeWrapRow(line > 0 ? line : 0, &seg);
+	E.cx = 0;
+
+	if(E.cy < E.numrows){
+
+		erow *row = editorRowAt(E.cy);
+
+		E.cx = editorRowRxToCx(row, editorRowSegmentRx(row, seg, 0));
+	}
+	else
+		E.cy = E.numrows;
+}
+
+void editorMoveCursor(int key){
+
+	// Never let the cursor reach the end of a file that is still being indexed
+	editorScanTo(E.cy + 1);
+
+	// Scroll to right
+	erow * row = editorRowAt(E.cy);
+
+	switch(key){
+
+		case ARROW_LEFT:
+			// Handle cursor from going out of screen, a whole character at a time
+			if(E.cx != 0)
+				E.cx = editorRowPrevChar(row, E.cx);
+			else if(E.cy > 0){
+				E.cy--;
+				E.cx = editorRowAt(E.cy)->size;
+			}
+			break;
+
+		case ARROW_RIGHT:
+			if(row && E.cx < row->size)
+				E.cx = editorRowNextChar(row, E.cx);
+
+			else if(row && E.cx == row->size){
+				E.cy++;
+				E.cx = 0;
+			}
+			break;
+
+		case ARROW_UP:
+		case ARROW_DOWN:
+			if(E.wrap){
+
+				editorWrapMove(key == ARROW_UP ? -1 : 1);
+				break;
+			}
+			{
+				// The cursor keeps its screen column, whatever tabs the rows have
+				long rx = row ? editorRowCxToRx(row, E.cx) : 0;
+
+				if(key == ARROW_UP && E.cy != 0)
+					E.cy--;
+
+				else if(key == ARROW_DOWN && E.cy  < E.numrows)
+					E.cy++;
+
+				if(E.cy < E.numrows)
+					E.cx = editorRowRxToCx(editorRowAt(E.cy), rx);
+			}
+			break;
+
+	}
+
+	row = editorRowAt(E.cy);
+	long rowlen = row ? row->size : 0;
+
+	if(E.cx > rowlen)
+		E.cx = rowlen;
+
+}
+// Allocator and screen statistics in the message bar
+void editorStats(){
+
+	char mapped[32], buffers[32];
+	long chunks = E.mem.chunks[ROWMEM_SLAB] + E.mem.chunks[ROWMEM_ARENA] + E.mem.chunks[ROWMEM_LARGE];
+
+	editorFormatCount(mapped, (long)(E.mem.mapped >> 10));
+	editorFormatCount(buffers, E.mem.buffers);
+	editorSetStatusMessage("Rows: %s KB in %ld chunks, %s buffers | Screen: %ld B, %ld avg", mapped, chunks, buffers, E.frame_bytes, E.frames ? E.frames_bytes / E.frames : 0);
+}
+
+/*
+	Buffers. Switching parks the state of the current file in its slot
+	of E.buffers and brings in that of the other, both by copy, so the
+	rows and their caches stay where they are.
+*/
+void editorBufferPark(struct editorBuffer *b){
+
+	b->numrows = E.numrows;
+	b->cx = E.cx;
+	b->cy = E.cy;
+	b->rowoff = E.rowoff;
+	b->coloff = E.coloff;
+	b->segoff = E.segoff;
+	b->rows = E.rows;
+	b->rowcache = E.rowcache;
+	b->rowcache_base = E.rowcache_base;
+	b->map = E.map;
+	b->maplen = E.maplen;
+	b->scan_off = E.scan_off;
+	b->scan_start = E.scan_start;
+	b->scan_lines = E.scan_lines;
+	b->scan_bytes = E.scan_bytes;
+	b->scan_done = E.scan_done;
+	b->cache_bytes = E.cache_bytes;
+	b->cache_hand = E.cache_hand;
+	b->hl_front = E.hl_front;
+	b->hl_dirty_end = E.hl_dirty_end;
+	b->undo = E.undo;
+	b->journal = E.journal;
+	b->mem = E.mem;
+	b->dirty = E.dirty;
+	b->filename = E.filename;
+	b->syntax = E.syntax;
+}
 
-	if(query)
-		free(query);
+void editorBufferLoad(struct editorBuffer *b){
+
+	E.numrows = b->numrows;
+	E.cx = b->cx;
+	E.cy = b->cy;
+	E.rowoff = b->rowoff;
+	E.coloff = b->coloff;
+	E.segoff = b->segoff;
+	E.rows = b->rows;
+	E.rowcache = b->rowcache;
+	E.rowcache_base = b->rowcache_base;
+	E.map = b->map;
+	E.maplen = b->maplen;
+	E.scan_off = b->scan_off;
+	E.scan_start = b->scan_start;
+	E.scan_lines = b->scan_lines;
+	E.scan_bytes = b->scan_bytes;
+	E.scan_done = b->scan_done;
+	E.cache_bytes = b->cache_bytes;
+	E.cache_hand = b->cache_hand;
+	E.hl_front = b->hl_front;
+	E.hl_dirty_end = b->hl_dirty_end;
+	E.undo = b->undo;
+	E.journal = b->journal;
+	E.mem = b->mem;
+	E.dirty = b->dirty;
+	E.filename = b->filename;
+	E.syntax = b->syntax;
+}
 
-	else{
+// An empty buffer in E, with an undo log of the same limit as the others
+void editorBufferReset(){
 
-		E.cx = saved_cx; 
-		E.cy = saved_cy;
-    	E.coloff = saved_coloff;
-    	E.rowoff = saved_rowoff;
+	size_t limit = E.undo.limit;
+	struct editorBuffer empty;
 
-	}
+	memset(&empty, 0, sizeof(empty));
+	empty.rows = rowNodeNew(ROW_LEAF);
+	empty.scan_done = 1;
+	empty.journal = editorJournalNew();
+	editorBufferLoad(&empty);
 
+	E.undo.limit = limit;
 }
-void editorScroll(){
 
-	E.rx = 0;
-	if(E.cy < E.numrows)
-		E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+// Add a slot for a new current buffer, the state in E going into the one it leaves
+void editorBufferAdd(){
 
-	if(E.cy < E.rowoff)
-		E.rowoff = E.cy;
+	struct editorBuffer *buffers = realloc(E.buffers, sizeof(struct editorBuffer) * (E.nbuffers + 1));
 
-	if(E.cy >= E.rowoff + E.screenrows)
-		E.rowoff = E.cy - E.screenrows + 1;
+	if(buffers == NULL)
+		die("realloc");
 
-	if(E.rx < E.coloff)
-		E.coloff = E.rx;
+	E.buffers = buffers;
 
-	if(E.rx >= E.coloff + E.screencols)
-		E.coloff = E.rx - E.screencols + 1;
+	if(E.nbuffers > 0)
+		editorBufferPark(&E.buffers[E.buffer]);
 
+	E.buffer = E.nbuffers++;
 }
-// Status bar drawing utility -> Inverted colors 
-void editorDrawStatusBar(struct abuf *ab){
 
-	abAppend(ab, "\x1b[7m",4);
+void editorBufferSwitch(int to){
 
-	char status[80],rstatus[80];
-	int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", E.filename ? E.filename : "[No Name]", E.numrows, E.dirty ? "(modified)": "");
+	if(to == E.buffer || to < 0 || to >= E.nbuffers)
+		return;
 
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.syntax ? E.syntax->filetype : "no filetype", E.cy + 1, E.numrows);
+	editorBufferPark(&E.buffers[E.buffer]);
+	editorBufferLoad(&E.buffers[to]);
+	E.buffer = to;
+	E.rx = 0;
+	editorSetStatusMessage("%s (%d of %d)", E.filename ? E.filename : "[No Name]", to + 1, E.nbuffers);
+}
 
-	if(len > E.screencols)
-		len = E.screencols;
+/*
+	Open a file in a buffer of its own, or switch to the buffer that has
+	it. A file that does not exist yet is created by the first save.
+*/
+void editorBufferOpen(){
 
-	abAppend(ab, status, len);
+	char *path = editorPrompt("Open: %s (ESC to cancel)", NULL);
+	int j, fd;
 
-	while(len < E.screencols){
+	if(path == NULL)
+		return;
 
-		if(E.screencols - len == rlen){
+	for(j = 0; j < E.nbuffers; j++){
 
-			abAppend(ab,rstatus, rlen);
-			break;
-		}
-		else{
-			abAppend(ab," ",1);
-			len++;
+		char *name = (j == E.buffer) ? E.filename : E.buffers[j].filename;
+
+		if(name && strcmp(name, path) == 0){
+
+			editorBufferSwitch(j);
+			free(path);
+			return;
 		}
-	
 	}
 
-	abAppend(ab, "\x1b[m",3);
-	abAppend(ab, "\r\n",2);
-}
+	if((fd = open(path, O_RDONLY)) == -1 && errno != ENOENT){
 
-void editorDrawMessageBar(struct abuf *ab){
+		editorSetStatusMessage("Cannot open %s: %s", path, strerror(errno));
+		free(path);
+		return;
+	}
 
-	abAppend(ab,"\x1b[K",3);
+	editorBufferAdd();
+	editorBufferReset();
 
-	int msglen = strlen(E.statusmsg);
+	if(fd != -1){
 
-	if(msglen > E.screencols)
-		msglen = E.screencols;
+		close(fd);
+		editorOpen(path);
+	}
+	else{
 
-	// 5 second message flash
-	if(msglen && time(NULL) - E.statusmsg_time < 5)
-		abAppend(ab, E.statusmsg, msglen);
+		E.filename = strdup(path);
+		editorSelectSyntaxHighlight();
+		editorSetStatusMessage("New file %s", path);
+	}
 
+	free(path);
 }
-// Draw tildes in the buffer and not actual file 
-void editorDrawRows(struct abuf *ab) {
-
-  int y;
-
-  for (y = 0; y < E.screenrows; y++) {
-
-  	int filerow = y + E.rowoff;
 
-    if (filerow >= E.numrows) {
+/*
+	Close the current buffer and free all it holds, its swap file goes
+	too. Closing the last one ends the editor.
+*/
+void editorBufferClose(){
 
-      // Print welcome message to center of terminal 
-      if (E.numrows == 0 && y == E.screenrows / 3) {
+	editorJournalStart(NULL, NULL);
 
-        char welcome[80];
-        int welcomelen = snprintf(welcome, sizeof(welcome),
-          "Editor -- version %s", EDITOR_VERSION);
+	if(E.nbuffers <= 1){
 
-        if (welcomelen > E.screencols)
-        	welcomelen = E.screencols;
+		write(E.out_fd, "\x1b[2J", 4);
+		write(E.out_fd, "\x1b[H", 3);
+		exit(0);
+	}
 
-        int padding = (E.screencols - welcomelen) / 2;
+	struct editorJournal *j = E.journal;
 
-        if (padding) {
+	pthread_mutex_lock(&j->lock);
+	j->closed = 1;
 
-          abAppend(ab, "~", 1);
-          padding--;
+	int running = j->running;
 
-        }
-        while (padding--)
-        	abAppend(ab, " ", 1);
-        
-        abAppend(ab, welcome, welcomelen);
-      } 
-      else {
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
 
-        abAppend(ab, "~", 1);
+	// A writer thread frees the journal on its way out
+	if(!running)
+		editorJournalFree(j);
 
-      }
+	editorFreeNode(E.rows);
+	rowMemRelease();
 
-    } 
-    else {
+	if(E.map)
+		munmap(E.map, E.maplen);
 
-      // Wrapping lines
-      int len = E.row[filerow].rsize - E.coloff;
-      if(len < 0)
-      	len = 0;
+	free(E.undo.ring);
+	free(E.undo.rec);
+	free(E.filename);
 
-      if (len > E.screencols) 
-      	len = E.screencols;
+	memmove(&E.buffers[E.buffer], &E.buffers[E.buffer + 1], sizeof(struct editorBuffer) * (E.nbuffers - E.buffer - 1));
+	E.nbuffers--;
 
-      char *c = &E.row[filerow].render[E.coloff];
-      unsigned char *hl = &E.row[filerow].hl[E.coloff];
-      int current_color = -1;
-      int j;
+	if(E.buffer == E.nbuffers)
+		E.buffer--;
 
-      for(j = 0; j < len; j++){
+	editorBufferLoad(&E.buffers[E.buffer]);
+	E.rx = 0;
+}
 
-      	  if (iscntrl(c[j])) {
+// Resident pages of a mapped file, in bytes
+size_t editorMapResident(char *map, off_t len){
+
+#ifdef __APPLE__
+	char vec[4096];
+#else
+	unsigned char vec[4096];
+#endif
+	long page = sysconf(_SC_PAGESIZE);
+	size_t resident = 0;
+	off_t off;
+	int j;
 
-      	  	char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-          	abAppend(ab, "\x1b[7m", 4);
-          	abAppend(ab, &sym, 1);
-          	abAppend(ab, "\x1b[m", 3);
+	for(off = 0; off < len; off += (off_t)page * sizeof(vec)){
 
-          	if (current_color != -1) {
+		size_t span = (len - off < (off_t)page * (off_t)sizeof(vec)) ? (size_t)(len - off) : page * sizeof(vec);
 
-            	char buf[16];
-            	int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-            	abAppend(ab, buf, clen);
-          	}
+		if(mincore(map + off, span, vec) == -1)
+			return 0;
 
-          }
-      		else if(hl[j] == HL_NORMAL){
-
-      			if(current_color != -1){
-
-      				abAppend(ab, "\x1b[39m", 5);
-      				current_color = -1;
-      			}
-				
-				abAppend(ab, &c[j],1);
-      		
-      		}	
-      		else{
-
-      			int color = editorSyntaxToColor(hl[j]);
-
-      			if(color != current_color){
-
-      				current_color = color;
-      				char buf[16];
-      				int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-      				abAppend(ab, buf, clen);
-
-      			}
-      			
-  				abAppend(ab, &c[j], 1);
-      		}
-      
-      	}
-      	abAppend(ab, "\x1b[39m", 5);
-    }
+		for(j = 0; j < (int)((span + page - 1) / page); j++)
+			resident += (vec[j] & 1) ? page : 0;
+	}
 
-    abAppend(ab, "\x1b[K", 3);
-    abAppend(ab, "\r\n", 2);
+	return resident;
+}
 
-  }
+// Bytes of the tree nodes below 'node'
+size_t rowNodeBytes(rowNode *node){
 
-}
+	size_t bytes = 0;
+	int j;
 
-/*
-	Write 4 bytes 
-	\x1b = Escape character <ESC>
-	[ = Begining of escape sequence
-	J = Erase in display
-	2 = Argument of J command (Clear entire screen)
-*/
-void  editorRefreshScreen(){
+	if(node->kind == ROW_LEAF)
+		return sizeof(rowLeaf);
 
-	editorScroll();
+	if(node->kind == ROW_LAZY)
+		return sizeof(rowLazy);
 
-	struct abuf ab = ABUF_INIT;
+	for(j = 0; j < node->n; j++)
+		bytes += rowNodeBytes(((rowInner *)node)->child[j]);
 
-	abAppend(&ab, "\x1b[?25l",6); // To hide cursor while redrawing
-	abAppend(&ab,"\x1b[H",3); // Reposition cursor to top-left corner
+	return bytes + sizeof(rowInner);
+}
 
-	editorDrawRows(&ab);
-	editorDrawStatusBar(&ab);
-	editorDrawMessageBar(&ab);
+// Memory a buffer holds: its rows, their caches and the tree, its undo log, and the pages of its file
+void editorBufferMemory(struct editorBuffer *b, size_t *heap, size_t *file){
 
-	char buf[32];
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1); // Specify exact position of cursor 
-	abAppend(&ab, buf, strlen(buf));
+	*heap = b->mem.mapped + rowNodeBytes(b->rows) + b->undo.cap + sizeof(struct undoRecord) * b->undo.rec_cap;
+	*file = b->map ? editorMapResident(b->map, b->maplen) : 0;
+}
 
-	abAppend(&ab, "\x1b[?25h",6); // h -> set mode 
+/*
+	List the buffers with the memory each holds, in KB on the heap and of
+	the file in the page cache, and switch to one by its number or by part
+	of its name.
+*/
+void editorBufferList(){
 
-	// Finally write the buffer to STDOUT
-	write(STDOUT_FILENO, ab.b, ab.len);
+	char prompt[sizeof(E.statusmsg)] = "Buffer: %s ";
+	size_t len = strlen(prompt);
+	int j, k;
 
-	abFree(&ab);
+	editorBufferPark(&E.buffers[E.buffer]);
 
-}
+	for(j = 0; j < E.nbuffers; j++){
 
-void editorSetStatusMessage(const char *fmt, ...){
+		struct editorBuffer *b = &E.buffers[j];
+		char entry[128], heap[32], file[32];
+		size_t h, f;
 
-	va_list ap;
-	va_start(ap, fmt);
-	vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
-	va_end(ap);
+		editorBufferMemory(b, &h, &f);
+		editorFormatCount(heap, (long)(h >> 10));
+		editorFormatCount(file, (long)(f >> 10));
+		snprintf(entry, sizeof(entry), " | %d%s %.20s%s %s+%s KB", j + 1, j == E.buffer ? ">" : "",
+			b->filename ? b->filename : "[No Name]", b->dirty ? "*" : "", heap, file);
 
-	E.statusmsg_time = time(NULL);
+		// The prompt is a format, percent signs in names are doubled
+		for(k = 0; entry[k] && len < sizeof(prompt) - 2; k++){
 
-}
+			if(entry[k] == '%')
+				prompt[len++] = '%';
+			prompt[len++] = entry[k];
+		}
+	}
 
-void editorMoveCursor(int key){
+	prompt[len] = '\0';
 
-	// Scroll to right
-	erow * row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	char *query = editorPrompt(prompt, NULL);
 
-	switch(key){
+	if(query == NULL)
+		return;
 
-		case ARROW_LEFT:
-			// Handle cursor from going out of screen
-			if(E.cx != 0)
-				E.cx--;
-			else if(E.cy > 0){
-				E.cy--;
-				E.cx = E.row[E.cy].size;
-			}
-			break;
+	char *end;
+	long n = strtol(query, &end, 10);
 
-		case ARROW_RIGHT:
-			if(row && E.cx < row->size)
-				E.cx++;
+	if(end != query && *end == '\0')
+		j = n - 1;
 
-			else if(row && E.cx == row->size){
-				E.cy++;
-				E.cx = 0;
-			}
-			break;
+	else{
 
-		case ARROW_UP:
-			if(E.cy != 0)
-				E.cy--;
-			break;
+		for(j = 0; j < E.nbuffers; j++){
 
-		case ARROW_DOWN:
-			if(E.cy  < E.numrows)
-				E.cy++;
-			break;
+			char *name = E.buffers[j].filename;
 
+			if(name && strstr(name, query))
+				break;
+		}
 	}
 
-	row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-	int rowlen = row ? row->size : 0;
-
-	if(E.cx > rowlen)
-		E.cx = rowlen;
+	if(j >= 0 && j < E.nbuffers)
+		editorBufferSwitch(j);
+	else
+		editorSetStatusMessage("No buffer %s", query);
 
+	free(query);
 }
+
 void editorProcessKeypress(){
 
 	static int quit_times = EDITOR_QUIT_TIMES;
 
 	int c = editorReadKey();
 
+	// Edits the key makes are undone as one
+	E.undo.step++;
+	E.undo.cx = E.cx;
+	E.undo.cy = E.cy;
+
 	switch(c){
 
 		case '\r':
@@ -1334,13 +8911,25 @@ void editorProcessKeypress(){
 		case CTRL_KEY('q'):
 			if(E.dirty && quit_times > 0){
 
-				editorSetStatusMessage("Warning! File has unsaved changes. Press Ctrl-Q again to quit.", quit_times);
+				editorSetStatusMessage(E.nbuffers > 1 ? "Warning! File has unsaved changes. Press Ctrl-Q again to close it." :
+					"Warning! File has unsaved changes. Press Ctrl-Q again to quit.");
 				quit_times--;
 				return;
 			}
-			write(STDOUT_FILENO,"\x1b[2J",4);
-			write(STDOUT_FILENO,"\x1b[H",3); 
-			exit(0); 
+			// Closes the buffer, the last one quits
+			editorBufferClose();
+			break;
+
+		case CTRL_KEY('o'):
+			editorBufferOpen();
+			break;
+
+		case CTRL_KEY('n'):
+			editorBufferSwitch((E.buffer + 1) % E.nbuffers);
+			break;
+
+		case CTRL_KEY('b'):
+			editorBufferList();
 			break;
 
 		case CTRL_KEY('s'):
@@ -1353,11 +8942,15 @@ void editorProcessKeypress(){
 
 		case END_KEY:
 			if(E.cy < E.numrows)
-				E.cx = E.row[E.cy].size;
+				E.cx = editorRowAt(E.cy)->size;
 			break;
 
 		case CTRL_KEY('f'):
-			editorFind();
+			editorFind(0);
+			break;
+
+		case CTRL_KEY('r'):
+			editorFind(1);
 			break;
 
 		case BACKSPACE:
@@ -1371,25 +8964,22 @@ void editorProcessKeypress(){
 
 		case PAGE_UP:
 		case PAGE_DOWN:
-			/* Move cursor to top/bottom of screen 
-			   Code block to create time variable in switch statement
-			*/
-			{
-				if(c == PAGE_UP)
-					E.cy = E.rowoff;
+			// A screen above the top or below the bottom row, set at once rather than a row at a time
+			if(E.wrap)
+				editorWrapPage(c == PAGE_UP ? -1 : 1);
 
-				else if(c == PAGE_DOWN){
+			else if(c == PAGE_UP)
+				E.cy = (E.rowoff > E.screenrows) ? E.rowoff - E.screenrows : 0;
 
-					E.cy = E.rowoff + E.screenrows - 1;
-					if(E.cy > E.numrows)
-						E.cy = E.numrows;
-
-				}
+			else{
 
-				int times = E.screenrows;
-				while(times--)
-					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+				editorScanTo(E.rowoff + 2 * E.screenrows);
+				E.cy = E.rowoff + 2 * E.screenrows - 1;
+				if(E.cy > E.numrows)
+					E.cy = E.numrows;
 			}
+
+			editorMoveCursor(0);
 			break;
 		case ARROW_UP:
 		case ARROW_DOWN:
@@ -1398,7 +8988,37 @@ void editorProcessKeypress(){
 			editorMoveCursor(c);
 			break;
 
+		// Repaint the whole screen, for when something else wrote to it
 		case CTRL_KEY('l'):
+			E.shown_valid = 0;
+			break;
+
+		case CTRL_KEY('t'):
+			editorStats();
+			break;
+
+		case CTRL_KEY('g'):
+			editorGoto();
+			break;
+
+		case CTRL_KEY('w'):
+			E.wrap = !E.wrap;
+			E.segoff = 0;
+			editorSetStatusMessage(E.wrap ? "Long lines wrap" : "Long lines scroll sideways");
+			break;
+
+		case PASTE_START:
+			editorPaste();
+			break;
+
+		case CTRL_KEY('z'):
+			editorUndoStep(0);
+			break;
+
+		case CTRL_KEY('y'):
+			editorUndoStep(1);
+			break;
+
 		case '\x1b':
 			break;
 
@@ -1407,28 +9027,183 @@ void editorProcessKeypress(){
 			break;
 
 	}
+
+	editorUndoCoalesce();
+
+	if(E.undo.applied && editorUndoAt(E.undo.applied - 1)->step == E.undo.step){
+
+		editorUndoAt(E.undo.applied - 1)->after_cx = E.cx;
+		editorUndoAt(E.undo.applied - 1)->after_cy = E.cy;
+	}
+
 	quit_times = EDITOR_QUIT_TIMES;
 
 }
 
+/*
+	Headless runs. Keys are read from a trace of terminal input, as
+	CEDIT_RECORD saves one, and frames are drawn to a virtual screen and
+	written to out_fd, so sessions can be replayed and timed without a
+	terminal. Call before initEditor.
+*/
+void editorHeadless(int trace, int out_fd, int rows, int cols){
+
+	E.headless = 1;
+	E.in_fd = trace;
+	E.out_fd = out_fd;
+	E.screenrows = rows;
+	E.screencols = cols;
+	memset(&E.replay, 0, sizeof(E.replay));
+	E.replay.start = editorNow();
+}
+
+// A key is asked for, the one handed out before it is done and drawn
+void editorReplayMark(){
+
+	double now = editorNow();
+	struct editorReplay *r = &E.replay;
+
+	if(r->first_frame == 0)
+		r->first_frame = now - r->start;
+
+	if(r->taken == 0)
+		return;
+
+	if(r->keys == r->cap){
+
+		r->cap = r->cap ? r->cap * 2 : 4096;
+
+		if((r->latency = realloc(r->latency, r->cap * sizeof(uint32_t))) == NULL)
+			die("realloc");
+	}
+
+	r->latency[r->keys++] = (now - r->taken) * 1e6;
+	r->taken = 0;
+}
+
+// Handle and draw the keys of the trace until it is used up
+void editorReplay(){
+
+	int j;
+
+	while(!E.replay.eof){
+
+		editorRefreshScreen();
+		editorProcessKeypress();
+	}
+
+	// A finished run leaves no swap files to recover
+	for(j = 0; j < E.nbuffers; j++){
+
+		editorBufferSwitch(j);
+		editorJournalStart(NULL, NULL);
+	}
+}
+
+int editorLatencyCmp(const void *a, const void *b){
+
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+// Latency of the key at fraction 'p' of them sorted, in microseconds
+unsigned int editorReplayPercentile(double p){
+
+	struct editorReplay *r = &E.replay;
+
+	return r->keys ? r->latency[(long)((r->keys - 1) * p)] : 0;
+}
+
+// Latency percentiles of the keys, the bytes of the frames and peak memory
+void editorReplayReport(FILE *fp){
+
+	struct editorReplay *r = &E.replay;
+	struct rusage ru;
+	double rss = 0;
+
+	// Kilobytes, bytes on macOS
+	if(getrusage(RUSAGE_SELF, &ru) == 0){
+
+#ifdef __APPLE__
+		rss = ru.ru_maxrss / 1048576.0;
+#else
+		rss = ru.ru_maxrss / 1024.0;
+#endif
+	}
+
+	if(r->keys)
+		qsort(r->latency, r->keys, sizeof(uint32_t), editorLatencyCmp);
+
+	fprintf(fp, "  %ld keys on %dx%d, first frame %.1f ms\n", r->keys, E.screenrows + 2, E.screencols, r->first_frame * 1e3);
+	fprintf(fp, "  latency   p50 %u us  p90 %u us  p99 %u us  max %u us\n", editorReplayPercentile(0.5),
+		editorReplayPercentile(0.9), editorReplayPercentile(0.99), editorReplayPercentile(1));
+	fprintf(fp, "  frames    %ld, %ld bytes each, %.1f KB in all\n", E.frames, E.frames ? E.frames_bytes / E.frames : 0, E.frames_bytes / 1024.0);
+	fprintf(fp, "  peak RSS  %.1f MB\n", rss);
+}
+
+// Run at exit of a headless editor, however it exits
+void editorReplayExit(){
+
+	fprintf(stderr, "replay: %s\n", getenv("CEDIT_REPLAY"));
+	editorReplayReport(stderr);
+}
+
 void initEditor(){
 
-	// Base position of cursor
-	E.cx = 0;
-	E.cy = 0;
 	E.rx = 0;
-	E.numrows = 0;
-	E.row = NULL;
-	E.rowoff = 0;
-	E.coloff = 0;
-	E.dirty = 0;
-	E.filename = NULL;
+	E.cache_budget = (size_t)EDITOR_CACHE_BUDGET << 20;
+	E.match.running = 0;
+	E.match.query = NULL;
+
+	pthread_mutex_init(&E.lock, NULL);
+	pthread_mutex_init(&E.lock_gate, NULL);
+	pthread_cond_init(&E.lock_handoff, NULL);
+	pthread_cond_init(&E.match.wake, NULL);
+	E.lock_waiting = 0;
+	pthread_mutex_lock(&E.lock);
+
+	char *budget = getenv("CEDIT_CACHE_MB");
+	if(budget && atoi(budget) > 0)
+		E.cache_budget = (size_t)atoi(budget) << 20;
+
+	char *tabstop = getenv("CEDIT_TAB_STOP");
+	E.tabstop = (tabstop && atoi(tabstop) > 0 && atoi(tabstop) <= 64) ? atoi(tabstop) : EDITOR_TAB_STOP;
+
+	char *undo = getenv("CEDIT_UNDO_KB");
+	E.undo.limit = (size_t)(undo && atoi(undo) > 0 ? atoi(undo) : EDITOR_UNDO_LIMIT) << 10;
+
+	char *wrap = getenv("CEDIT_WRAP");
+	E.wrap = wrap && atoi(wrap) > 0;
+
+	// What a headless run set stays
+	if(!E.headless){
+
+		E.in_fd = STDIN_FILENO;
+		E.out_fd = STDOUT_FILENO;
+	}
+
+	char *record = getenv("CEDIT_RECORD");
+	E.record_fd = record && !E.headless ? open(record, O_WRONLY | O_CREAT | O_TRUNC, 0600) : -1;
+
+	// The first buffer, empty until a file is opened in it
+	E.buffers = NULL;
+	E.nbuffers = 0;
+	editorBufferAdd();
+	editorBufferReset();
+
 	E.statusmsg_time = 0;
 	E.statusmsg[0] = '\0';
-	E.syntax = NULL;
+	memset(&E.frame, 0, sizeof(E.frame));
+	memset(&E.shown, 0, sizeof(E.shown));
+	E.shown_valid = 0;
+	E.shown_cx = E.shown_cy = -1;
+	E.frame_bytes = E.frames = E.frames_bytes = 0;
+	E.out.b = NULL;
+	E.out.len = E.out.cap = 0;
 
 
-	if(getWindowSize(&E.screenrows, &E.screencols) == -1)
+	if(!E.headless && getWindowSize(&E.screenrows, &E.screencols) == -1)
 		die("getWindowSize");
 
 	E.screenrows -= 2;
@@ -1436,24 +9211,76 @@ void initEditor(){
 
 // Init code 
 
+// Benchmarks include this file and bring their own main
+#ifndef CEDIT_NO_MAIN
+
 int main(int argc, char *argv[]){
 
-	enableRawMode();
+	char *replay = getenv("CEDIT_REPLAY");
+
+	// Keys from a trace onto a virtual screen, CEDIT_SCREEN rows and columns
+	if(replay){
+
+		char *screen = getenv("CEDIT_SCREEN");
+		int trace = open(replay, O_RDONLY), rows = 24, cols = 80;
+
+		if(trace == -1){
+
+			perror(replay);
+			return 1;
+		}
+
+		if(screen && (sscanf(screen, "%dx%d", &rows, &cols) != 2 || rows < 3 || cols < 1)){
+
+			fprintf(stderr, "CEDIT_SCREEN: %s is not rows x columns\n", screen);
+			return 1;
+		}
+
+		editorHeadless(trace, STDOUT_FILENO, rows, cols);
+		atexit(editorReplayExit);
+	}
+	else
+		enableRawMode();
+
 	initEditor();
+	editorInputInit();
+
+	// Each file given opens in a buffer of its own, the first is shown
+	int j;
+
+	for(j = 1; j < argc; j++){
+
+		if(j > 1){
 
-	// Open file if provided
-	if(argc >= 2){
+			editorBufferAdd();
+			editorBufferReset();
+		}
 
-		editorOpen(argv[1]);
+		editorOpen(argv[j]);
 	}
 
-	editorSetStatusMessage("HELP: Ctrl-S = Save | Ctrl-F = Find | Ctrl-Q = Quit");
+	editorBufferSwitch(0);
+
+	// Unless opening the file left a message
+	if(E.statusmsg[0] == '\0')
+		editorSetStatusMessage("HELP: Ctrl-S = Save | Ctrl-F = Find | Ctrl-R = Regex | Ctrl-G = Go to | Ctrl-Z = Undo | Ctrl-O = Open | Ctrl-B = Buffers | Ctrl-Q = Close");
+
+	if(E.headless){
+
+		editorReplay();
+		return 0;
+	}
 
 	while (1){
 
 		editorRefreshScreen();
-		editorProcessKeypress();
+
+		// Every key already read is handled before the next repaint
+		do
+			editorProcessKeypress();
+		while(editorInputPending());
 	}
 
 	return 0;
 }
+#endif